@@ -3,12 +3,32 @@
 #include <memory>
 #include <boost/shared_ptr.hpp>
 #include <helper/bounding_box.h>
+#include <helper/candidate_sampler.h>
+#include <helper/candidate_set.h>
+#include <helper/frame_arena.h>
+#include <helper/head_cascade.h>
+#include <helper/high_res_timer.h>
+#include <helper/image_proc.h>
+#include <helper/input_preprocessor.h>
+#include <helper/rng_stream.h>
 #include <helper/CommonCV.h>
+#include <helper/Constants.h>
+#include <tracker/frame_feature_store.h>
+#include <tracker/tracker_gmd.h>
+#include <train/example_generator.h>
 #include <Eigen/Dense>
 #include "../rapidxml/rapidxml.hpp"
 #include "../rapidxml/rapidxml_utils.hpp"
 #include <assert.h>
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cfloat>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <thread>
 using namespace std;
 
 using Eigen::MatrixXd;
@@ -19,6 +39,15 @@ using Eigen::Matrix;
 
 using namespace rapidxml;
 
+// Check of the tests below that stays on in release builds, where NDEBUG turns assert() into nothing
+#define TEST_CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      exit(1); \
+    } \
+  } while (0)
+
 class A {
 public:
   virtual void foo() {
@@ -89,7 +118,13 @@ void populateTestEigenFunctions() {
 
 
 void populateTestRapidXml () {
-    rapidxml::file<> xmlFile("/home/jimxing/Downloads/Tracking_Sequences/ILSVRC2015/Annotations/VID/train/ILSVRC2015_VID_train_0004/ILSVRC2015_val_00069001/000000.xml"); // Default template is char
+    const char *xml_path = "/home/jimxing/Downloads/Tracking_Sequences/ILSVRC2015/Annotations/VID/train/ILSVRC2015_VID_train_0004/ILSVRC2015_val_00069001/000000.xml";
+    // the annotation is only on the author's machine, rapidxml::file throws without it
+    if (access(xml_path, R_OK) != 0) {
+      cout << "RapidXml: skipped, no " << xml_path << endl;
+      return;
+    }
+    rapidxml::file<> xmlFile(xml_path); // Default template is char
     rapidxml::xml_document<> doc;
     doc.parse<0>(xmlFile.data());
 
@@ -130,6 +165,609 @@ void populateTestRapidXml () {
     }
 }
 
+// resident set size in bytes, from /proc/self/statm
+long getResidentBytes() {
+  long pages_total = 0;
+  long pages_resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f == NULL) {
+    return -1;
+  }
+  if (fscanf(f, "%ld %ld", &pages_total, &pages_resident) != 2) {
+    pages_resident = -1;
+  }
+  fclose(f);
+  return pages_resident * sysconf(_SC_PAGESIZE);
+}
+
+// Network of the tracker soak: no Caffe net, every candidate of a frame gets the same score, success or failure
+// as the test decides, and the pooled features of a frame are filled with its number
+class SoakRegressor : public RegressorBase {
+public:
+  SoakRegressor() : frame(0), success(true) { }
+
+  virtual void Regress(const cv::Mat& image_curr, const cv::Mat& image, const cv::Mat& target, BoundingBox* bbox) { }
+
+  virtual void Predict(const cv::Mat& image_curr, const cv::Mat& image, const cv::Mat& target, 
+                       const std::vector<BoundingBox> &candidate_bboxes, 
+                       BoundingBox* bbox,
+                       std::vector<float> *return_probabilities, 
+                       std::vector<int> *return_sorted_indexes) { }
+
+  virtual void GetBBoxConvFeatures(const cv::Mat& image_curr, const cv::Mat& image, const cv::Mat& target, 
+                       const std::vector<BoundingBox> &candidate_bboxes, float *features) {
+    memset(features, 0, sizeof(float) * candidate_bboxes.size() * BBOX_REGRESSION_FEATURE_LENGTH);
+  }
+
+  virtual void GetPooledFeatures(const cv::Mat& image_curr, const cv::Mat& target, 
+                       const std::vector<BoundingBox> &candidate_bboxes,
+                       std::vector<float> *target_feature,
+                       std::vector<float> *candidate_features) {
+    target_feature->assign(kDim, (float)frame);
+    candidate_features->assign(candidate_bboxes.size() * kDim, (float)frame);
+  }
+
+  virtual void PredictFast(const cv::Mat& image_curr, const cv::Mat& image, const cv::Mat& target, 
+                       const std::vector<BoundingBox> &candidate_bboxes,  const BoundingBox & bbox_prev,
+                       BoundingBox* bbox,
+                       std::vector<float> *return_probabilities, 
+                       std::vector<int> *return_sorted_indexes,
+                       double sd_trans,
+                       int cur_frame) {
+    return_probabilities->assign(candidate_bboxes.size(), success ? 0.9f : 0.1f);
+    return_sorted_indexes->resize(candidate_bboxes.size());
+    iota(return_sorted_indexes->begin(), return_sorted_indexes->end(), 0);
+    *bbox = bbox_prev;
+  }
+
+  virtual void PoolCandidates(const cv::Mat& image_curr, const std::vector<cv::Mat> &targets,
+                       const std::vector<const std::vector<BoundingBox>* > &candidate_bboxes) { }
+
+  virtual void PredictFastPooled(const int t, const std::vector<BoundingBox> &candidate_bboxes,
+                       const BoundingBox & bbox_prev,
+                       BoundingBox* bbox,
+                       std::vector<float> *return_probabilities, 
+                       std::vector<int> *return_sorted_indexes,
+                       double sd_trans,
+                       int cur_frame) { }
+
+  virtual void GetHeadParams(std::vector<caffe::Blob<float>* > *params) { params->clear(); }
+
+  static const int kDim = 256;
+  int frame;
+  bool success;
+};
+
+// Solver side of the tracker soak: no training, checks that every frame handed to the head fine tuning still holds
+// its own features, and counts the frames of the largest fine tune
+class SoakRegressorTrain : public RegressorTrainBase {
+public:
+  SoakRegressorTrain(const std::string& solver_file) : RegressorTrainBase(solver_file), max_frames(0), num_calls(0) { }
+
+  virtual void Train(const std::vector<cv::Mat>& images,
+             const std::vector<cv::Mat>& targets,
+             const std::vector<BoundingBox>& bboxes_gt) { }
+
+  virtual void TrainBatchFast(const std::vector<cv::Mat>& image_currs,
+                           const std::vector<cv::Mat>& images,
+                           const std::vector<cv::Mat>& targets,
+                           const std::vector<BoundingBox>& bboxes_gt,
+                           const std::vector<std::vector<BoundingBox> > &candidate_bboxes,
+                           const std::vector<std::vector<double> > &labels,
+                           int k,
+                           int inner_batch_size,
+                           int num_nohem,
+                           int frames_per_batch) { }
+
+  virtual void TrainBatchFromFeatures(const std::vector<const float*> &target_features,
+                           const std::vector<std::vector<const float*> > &candidate_features,
+                           const std::vector<std::vector<double> > &labels,
+                           int inner_batch_size,
+                           int frames_per_batch) {
+    TEST_CHECK(target_features.size() == candidate_features.size());
+    for (size_t i = 0; i < target_features.size(); i++) {
+      TEST_CHECK(candidate_features[i].size() == labels[i].size());
+      for (size_t j = 0; j < candidate_features[i].size(); j++) {
+        TEST_CHECK(candidate_features[i][j][0] == target_features[i][0]);
+      }
+    }
+    max_frames = std::max(max_frames, (int)target_features.size());
+    num_calls++;
+  }
+
+  virtual void TrainBatch(const std::vector<cv::Mat>& images,
+                           const std::vector<cv::Mat>& targets,
+                           const std::vector<BoundingBox>& bboxes_gt,
+                           const std::vector<std::vector<cv::Mat> > &candidates,
+                           const std::vector<std::vector<double> > &labels,
+                           int k) { }
+
+  virtual void SaveLossHistoryToFile(const std::string &save_path) { }
+
+  virtual void ResetSolverNet() { }
+
+  virtual void GetHeadHistory(std::vector<caffe::Blob<float>* > *history) { history->clear(); }
+
+  int max_frames;
+  int num_calls;
+};
+
+// A solver over a net with a single input and no learnable params, RegressorTrainBase needs one to exist
+string writeSoakSolver() {
+  char path[] = "/tmp/unit_test_soak_solver_XXXXXX";
+  const int fd = mkstemp(path);
+  TEST_CHECK(fd >= 0);
+  const char solver[] =
+    "net_param {\n"
+    "  name: \"soak\"\n"
+    "  layer { name: \"data\" type: \"Input\" top: \"data\" input_param { shape { dim: 1 dim: 1 } } }\n"
+    "}\n"
+    "base_lr: 0.001\n"
+    "lr_policy: \"fixed\"\n"
+    "max_iter: 1\n";
+  TEST_CHECK(write(fd, solver, sizeof(solver) - 1) == (ssize_t)(sizeof(solver) - 1));
+  close(fd);
+  return path;
+}
+
+void populateTestTrackerSoak() {
+  // Track many synthetic frames with TrackerGMD on stub networks: the retention of fine tune samples
+  // (EnqueueOnlineTraningSamples, FineTuneOnline) must keep the store, the bags and the memory bounded
+  const int num_frames = 100000;
+  const int W = 160;
+  const int H = 120;
+
+  const string solver_file = writeSoakSolver();
+  SoakRegressor regressor;
+  SoakRegressorTrain regressor_train(solver_file);
+  unlink(solver_file.c_str());
+  ExampleGenerator example_generator(5, 15, -0.4, 0.4);
+  TrackerGMD tracker(false, &example_generator, &regressor_train);
+  tracker.Seed(SEED_RNG_TRACKER);
+  example_generator.Seed(SEED_RNG_EXAMPLE_GENERATOR);
+
+  const BoundingBox bbox_gt(60, 45, 100, 75);
+  cv::Mat first_frame(H, W, CV_8UC3, cv::Scalar(0, 64, 128));
+  tracker.Init(first_frame, bbox_gt, &regressor);
+  TEST_CHECK(tracker.long_term_bag_size() == 1);
+
+  const FrameFeatureStore &store = tracker.features_finetune();
+  const int capacity = store.capacity();
+  long rss_warm = 0;
+  for (int frame = 1; frame < num_frames; frame++) {
+    // every 3rd frame is a failure, nothing enqueued and a short term fine tune
+    regressor.frame = frame;
+    regressor.success = frame % 3 != 2;
+
+    // a new frame buffer every time, as a decoder would hand out, none of them may be kept
+    cv::Mat image_curr(H, W, CV_8UC3, cv::Scalar(frame % 256, 64, 128));
+    BoundingBox bbox_estimate;
+    tracker.Track(image_curr, &regressor, &bbox_estimate);
+    tracker.UpdateState(image_curr, bbox_estimate, &regressor, frame == num_frames - 1);
+
+    TEST_CHECK(tracker.short_term_bag_size() <= SHORT_TERM_BAG_SIZE);
+    TEST_CHECK(tracker.long_term_bag_size() <= LONG_TERM_BAG_SIZE);
+    TEST_CHECK(store.capacity() == capacity);
+    TEST_CHECK(store.capacity() - store.num_free() == tracker.long_term_bag_size());
+
+    if (frame == 1000) {
+      rss_warm = getResidentBytes();
+    }
+  }
+
+  long rss_end = getResidentBytes();
+  cout << "TrackerGMD soak, " << num_frames << " frames, " << regressor_train.num_calls << " fine tunes of at most "
+       << regressor_train.max_frames << " frames, RSS after warm up: " << rss_warm / 1024
+       << " KB, RSS at the end: " << rss_end / 1024 << " KB" << endl;
+  TEST_CHECK(tracker.long_term_bag_size() == LONG_TERM_BAG_SIZE);
+  TEST_CHECK(regressor_train.num_calls > 0);
+  TEST_CHECK(regressor_train.max_frames <= LONG_TERM_BAG_SIZE);
+  // allow some slack for the allocator, but no growth with the number of frames: keeping even one frame buffer
+  // every 100 frames would add 50 MB
+  TEST_CHECK(rss_end - rss_warm < 4 * 1024 * 1024);
+
+  tracker.Reset(&regressor);
+  TEST_CHECK(store.num_free() == store.capacity());
+  TEST_CHECK(tracker.short_term_bag_size() == 0 && tracker.long_term_bag_size() == 0);
+}
+
+void populateTestCandidateBudgetShortRound() {
+  // A target grown larger than the frame: no draw around it fits, so GetCandidates comes back short of
+  // TOP_ESTIMATES and the adaptive budget must end the frame after its first round, with a finite estimate
+  const int W = 160;
+  const int H = 120;
+  const int num_frames = 5;
+
+  const string solver_file = writeSoakSolver();
+  SoakRegressor regressor;
+  SoakRegressorTrain regressor_train(solver_file);
+  unlink(solver_file.c_str());
+  ExampleGenerator example_generator(5, 15, -0.4, 0.4);
+  TrackerGMD tracker(false, &example_generator, &regressor_train);
+  CandidateBudget budget;
+  budget.adaptive = true;
+  tracker.set_candidate_budget(budget);
+  tracker.Seed(SEED_RNG_TRACKER);
+  example_generator.Seed(SEED_RNG_EXAMPLE_GENERATOR);
+
+  cv::Mat frame(H, W, CV_8UC3, cv::Scalar(0, 64, 128));
+  tracker.Init(frame, BoundingBox(60, 45, 100, 75), &regressor);
+
+  BoundingBox larger(-80, -60, 240, 180);
+  vector<BoundingBox> candidates;
+  TEST_CHECK(tracker.GetCandidates(larger, W, H, SAMPLE_CANDIDATES, candidates) == 0);
+  TEST_CHECK(candidates.empty());
+
+  // every frame is uncertain, so the budget always asks for another round; the first frame is estimated larger
+  // than the frame, which is the prior of all the next ones
+  regressor.success = false;
+  BoundingBox bbox_estimate;
+  tracker.Track(frame, &regressor, &bbox_estimate);
+  bbox_estimate = larger;
+  tracker.UpdateState(frame, bbox_estimate, &regressor, false);
+
+  for (int i = 0; i < num_frames; i++) {
+    const CandidateBudgetStats before = tracker.candidate_budget_stats();
+    tracker.Track(frame, &regressor, &bbox_estimate);
+    const CandidateBudgetStats &after = tracker.candidate_budget_stats();
+    TEST_CHECK(after.frames == before.frames + 1);
+    TEST_CHECK(after.rounds == before.rounds + 1);
+    TEST_CHECK(after.candidates == before.candidates);
+    TEST_CHECK(std::isfinite(bbox_estimate.x1_) && std::isfinite(bbox_estimate.y1_)
+               && std::isfinite(bbox_estimate.x2_) && std::isfinite(bbox_estimate.y2_));
+    TEST_CHECK(tracker.TopEstimatesAverage() == 0);
+    tracker.UpdateState(frame, bbox_estimate, &regressor, i == num_frames - 1);
+  }
+  cout << "Candidate budget: " << num_frames << " frames around a target larger than the frame, one round each" << endl;
+}
+
+void populateTestCandidateSetKernels() {
+  // CandidateSet batch kernels against the per-box BoundingBox methods: same answers, and the time of each
+  const int num_boxes = SAMPLE_CANDIDATES * 4;
+  const int num_rounds = 2000;
+  const int W = 640;
+  const int H = 480;
+
+  std::mt19937 engine(SEED_ENGINE);
+  std::uniform_real_distribution<double> coord(-50, 700);
+  std::uniform_real_distribution<double> size(0, 200);
+  vector<BoundingBox> boxes;
+  for (int i = 0; i < num_boxes; i++) {
+    double x1 = coord(engine);
+    double y1 = coord(engine);
+    boxes.push_back(BoundingBox(x1, y1, x1 + size(engine), y1 + size(engine)));
+  }
+  const BoundingBox ref(200, 150, 320, 260);
+
+  CandidateSet set;
+  set.assign(boxes);
+  vector<float> iou;
+  vector<float> distance;
+  vector<uint8_t> valid;
+  set.ComputeIOU(ref, &iou);
+  set.ComputeCenterDistance(ref, &distance);
+  set.ValidAgainstWidthHeight(W, H, &valid);
+  for (int i = 0; i < num_boxes; i++) {
+    const double this_iou = ref.compute_IOU(boxes[i]);
+    TEST_CHECK(std::isnan(this_iou) || fabs(iou[i] - this_iou) < 1e-5);
+    TEST_CHECK(fabs(distance[i] - boxes[i].compute_center_distance(ref)) < 1e-2);
+    TEST_CHECK(valid[i] == boxes[i].valid_bbox_against_width_height(W, H));
+  }
+
+  HighResTimer hrt("CandidateSet", CLOCK_MONOTONIC);
+  double sum = 0;
+
+  hrt.reset();
+  hrt.start();
+  for (int r = 0; r < num_rounds; r++) {
+    for (int i = 0; i < num_boxes; i++) {
+      sum += ref.compute_IOU(boxes[i]) + boxes[i].compute_center_distance(ref) + boxes[i].valid_bbox_against_width_height(W, H);
+    }
+  }
+  hrt.stop();
+  const double per_box_ms = hrt.getMilliseconds();
+
+  hrt.reset();
+  hrt.start();
+  for (int r = 0; r < num_rounds; r++) {
+    set.ComputeIOU(ref, &iou);
+    set.ComputeCenterDistance(ref, &distance);
+    set.ValidAgainstWidthHeight(W, H, &valid);
+    sum += iou[r % num_boxes] + distance[r % num_boxes] + valid[r % num_boxes];
+  }
+  hrt.stop();
+  const double batch_ms = hrt.getMilliseconds();
+
+  cout << "IOU + center distance + validity of " << num_boxes << " boxes x " << num_rounds << " rounds, per box: " 
+       << per_box_ms << " ms, CandidateSet: " << batch_ms << " ms (" << per_box_ms / batch_ms << "x), checksum " << sum << endl;
+}
+
+void populateTestCandidateSampler() {
+  // SampleAccepted draws until num boxes pass, but a bounded number of times when few or none can
+  RngStream rng(SEED_RNG_TRACKER, RNG_STREAM_TRACKER);
+  CandidateSampler sampler(&rng);
+  const SampleParams params(POS_TRANS_RANGE, POS_SCALE_RANGE, SD_X, SD_Y, SD_SCALE, SD_AP);
+
+  CandidateSet accepted;
+  TEST_CHECK(sampler.SampleAccepted(BoundingBox(260, 200, 380, 280), SAMPLE_CANDIDATES, 640, 480, SAMPLE_GAUSSIAN_AP,
+                                    params, -FLT_MAX, FLT_MAX, &accepted) == SAMPLE_CANDIDATES);
+  TEST_CHECK(accepted.size() == SAMPLE_CANDIDATES);
+
+  // larger than the frame, no draw can be valid
+  accepted.clear();
+  TEST_CHECK(sampler.SampleAccepted(BoundingBox(0, 0, 100, 80), SAMPLE_CANDIDATES, 40, 30, SAMPLE_GAUSSIAN_AP,
+                                    params, -FLT_MAX, FLT_MAX, &accepted) == 0);
+  TEST_CHECK(accepted.size() == 0);
+
+  // filling a tiny frame, only the few draws that shrink and stay in it pass, what is returned is all appended
+  const int num_passed = sampler.SampleAccepted(BoundingBox(0, 0, 39, 29), SAMPLE_CANDIDATES, 40, 30,
+                                                SAMPLE_GAUSSIAN_AP, params, -FLT_MAX, FLT_MAX, &accepted);
+  TEST_CHECK(num_passed <= SAMPLE_CANDIDATES);
+  TEST_CHECK((int)accepted.size() == num_passed);
+  cout << "CandidateSampler: " << num_passed << " of " << SAMPLE_CANDIDATES
+       << " boxes against the border of a tiny frame, none for a box larger than the frame" << endl;
+}
+
+void populateTestRngStream() {
+  // same (seed, stream) repeats exactly, also when drawn from several threads at once; other streams differ
+  const int num_draws = 100000;
+  const int num_threads = 4;
+
+  vector<vector<uint32_t> > draws(num_threads, vector<uint32_t>(num_draws));
+  vector<std::thread> threads;
+  for (int t = 0; t < num_threads; t++) {
+    threads.push_back(std::thread([&draws, t, num_draws]() {
+      // even threads share the tracker stream, odd threads the example generator stream
+      RngStream rng(SEED_RNG_TRACKER, t % 2 == 0 ? RNG_STREAM_TRACKER : RNG_STREAM_EXAMPLE_GENERATOR);
+      for (int i = 0; i < num_draws; i++) {
+        draws[t][i] = rng();
+      }
+    }));
+  }
+  for (size_t t = 0; t < threads.size(); t++) {
+    threads[t].join();
+  }
+  TEST_CHECK(draws[0] == draws[2]);
+  TEST_CHECK(draws[1] == draws[3]);
+
+  int same = 0;
+  for (int i = 0; i < num_draws; i++) {
+    same += draws[0][i] == draws[1][i];
+  }
+  TEST_CHECK(same < 10);
+
+  // Seed restarts the stream
+  RngStream rng(SEED_RNG_TRACKER, RNG_STREAM_TRACKER);
+  rng();
+  rng.Seed(SEED_RNG_TRACKER, RNG_STREAM_TRACKER);
+  TEST_CHECK(rng() == draws[0][0]);
+
+  // uniforms in [0, 1) with mean 1 / 2, integers in range
+  vector<float> uniforms(num_draws);
+  rng.FillUniform(num_draws, uniforms.data());
+  double sum = 0;
+  for (int i = 0; i < num_draws; i++) {
+    TEST_CHECK(uniforms[i] >= 0 && uniforms[i] < 1);
+    sum += uniforms[i];
+  }
+  TEST_CHECK(fabs(sum / num_draws - 0.5) < 0.01);
+  for (int i = 0; i < num_draws; i++) {
+    TEST_CHECK(rng.UniformInt(7) < 7);
+  }
+
+  cout << "RngStream: " << num_threads << " threads x " << num_draws << " draws reproduced, mean uniform "
+       << sum / num_draws << endl;
+}
+
+// The OpenCV chain InputPreprocessor replaces: resize, convertTo, subtract, split into the planes at dst
+void preprocessWithOpenCV(const Mat &image, const Size &size, float *dst) {
+  Mat resized;
+  if (image.size() != size) {
+    resize(image, resized, size);
+  } else {
+    resized = image;
+  }
+  Mat image_float;
+  resized.convertTo(image_float, CV_32FC3);
+  Mat normalized;
+  subtract(image_float, Mat(image_float.size(), CV_32FC3, mean_scalar), normalized);
+  vector<Mat> planes;
+  for (int c = 0; c < 3; c++) {
+    planes.push_back(Mat(size, CV_32FC1, dst + c * size.area()));
+  }
+  split(normalized, planes);
+}
+
+void populateTestFusedPreprocess() {
+  // InputPreprocessor against the OpenCV chain, on a target crop and on a full frame: same input up to the
+  // rounding of the 8 bit resize, and the time of each
+  const int num_rounds = 200;
+  std::mt19937 engine(SEED_ENGINE);
+  std::uniform_int_distribution<int> pixel(0, 255);
+
+  const Size sources[2] = {Size(160, 130), Size(1280, 720)};
+  const Size sizes[2] = {Size(227, 227), InputPreprocessor::ScaledSize(Size(1280, 720), 600.0 / 720)};
+  const char *names[2] = {"target crop", "full frame"};
+  InputPreprocessor preprocessor;
+  for (int k = 0; k < 2; k++) {
+    Mat image(sources[k], CV_8UC3);
+    for (int i = 0; i < image.rows * image.cols * 3; i++) {
+      image.data[i] = pixel(engine);
+    }
+    const Size size = sizes[k];
+    vector<float> expected(3 * size.area());
+    vector<float> fused(3 * size.area());
+    preprocessWithOpenCV(image, size, expected.data());
+    preprocessor.Run(image, size, mean_scalar, fused.data(), size.area(), size.width);
+    float max_diff = 0;
+    for (size_t i = 0; i < fused.size(); i++) {
+      max_diff = std::max(max_diff, std::fabs(fused[i] - expected[i]));
+    }
+    TEST_CHECK(max_diff <= 1.0f);
+
+    HighResTimer hrt("FusedPreprocess", CLOCK_MONOTONIC);
+    hrt.reset();
+    hrt.start();
+    for (int r = 0; r < num_rounds; r++) {
+      preprocessWithOpenCV(image, size, expected.data());
+    }
+    hrt.stop();
+    const double opencv_ms = hrt.getMilliseconds();
+
+    hrt.reset();
+    hrt.start();
+    for (int r = 0; r < num_rounds; r++) {
+      preprocessor.Run(image, size, mean_scalar, fused.data(), size.area(), size.width);
+    }
+    hrt.stop();
+    const double fused_ms = hrt.getMilliseconds();
+
+    cout << names[k] << " " << image.cols << "x" << image.rows << " -> " << size.width << "x" << size.height
+         << " x " << num_rounds << " rounds, OpenCV: " << opencv_ms << " ms, fused: " << fused_ms << " ms ("
+         << opencv_ms / fused_ms << "x), max diff " << max_diff << endl;
+  }
+}
+
+void populateTestCropPadImage() {
+  // pooled crops equal the allocating ones, inside the frame and across its borders, and reuse one buffer
+  std::mt19937 engine(SEED_ENGINE);
+  std::uniform_int_distribution<int> pixel(0, 255);
+  Mat image(480, 640, CV_8UC3);
+  for (int i = 0; i < image.rows * image.cols * 3; i++) {
+    image.data[i] = pixel(engine);
+  }
+
+  const BoundingBox boxes[5] = {BoundingBox(200, 150, 260, 230),   // inside
+                                BoundingBox(-20, -10, 50, 70),     // top left corner
+                                BoundingBox(600, 420, 660, 500),   // bottom right corner
+                                BoundingBox(300, -30, 340, 20),    // top border
+                                BoundingBox(100, 100, 140, 140)};  // inside again
+  CropBuffer buffer;
+  const uchar *storage = NULL;
+  for (int i = 0; i < 5; i++) {
+    Mat expected, pooled;
+    BoundingBox location_expected, location_pooled;
+    double spacing_x_expected, spacing_y_expected, spacing_x_pooled, spacing_y_pooled;
+    CropPadImage(boxes[i], image, &expected, &location_expected, &spacing_x_expected, &spacing_y_expected);
+    CropPadImage(boxes[i], image, &buffer, &pooled, &location_pooled, &spacing_x_pooled, &spacing_y_pooled);
+    TEST_CHECK(expected.size() == pooled.size());
+    TEST_CHECK(norm(expected, pooled, NORM_INF) == 0);
+    TEST_CHECK(spacing_x_expected == spacing_x_pooled && spacing_y_expected == spacing_y_pooled);
+    TEST_CHECK(location_expected.x1_ == location_pooled.x1_ && location_expected.y2_ == location_pooled.y2_);
+
+    const bool inside = spacing_x_pooled == 0 && spacing_y_pooled == 0 && pooled.datastart == image.datastart;
+    if (!inside) {
+      // the padded crops go to the same storage, it is sized by the first one here and the later ones are smaller
+      if (storage == NULL) {
+        storage = pooled.datastart;
+      }
+      TEST_CHECK(pooled.datastart == storage);
+    }
+    cout << "crop " << i << " " << pooled.cols << "x" << pooled.rows << (inside ? " view" : " pooled") << endl;
+  }
+}
+
+void populateTestFrameArena() {
+  // a frame of the scoring loop's shape grows the arena once, the later frames take nothing from the heap
+  FrameArena arena(1 << 16);
+  for (int frame = 0; frame < 5; frame++) {
+    float *probabilities = arena.Allocate<float>(2 * 256);
+    TEST_CHECK(((size_t)probabilities & 63) == 0);
+    FrameArena::Mark mark = arena.GetMark();
+    int *idx = arena.Allocate<int>(256);
+    Mat pool = arena.AllocateMat(256, 512 * 9, CV_32F);
+    idx[255] = 1;
+    pool.at<float>(255, 512 * 9 - 1) = 1;
+    arena.Rewind(mark);
+    // rewound memory is handed out again
+    TEST_CHECK(arena.Allocate<int>(256) == idx);
+    arena.Reset();
+
+    const FrameArenaStats &stats = arena.last_frame_stats();
+    TEST_CHECK(stats.allocations == 4);
+    TEST_CHECK(frame == 0 ? stats.heap_allocations > 0 : stats.heap_allocations == 0);
+    cout << "frame " << frame << ": " << stats.bytes << " bytes, " << stats.heap_allocations << " heap blocks" << endl;
+  }
+}
+
+void populateTestHeadCascade() {
+  // features constant over every block: the coarse product is the exact one, partial border blocks included
+  const int num_output = 8;
+  const int channels = 4;
+  const int num_rows = 3;
+  const int sizes[2] = {6, 7};
+  std::mt19937 engine(SEED_ENGINE);
+  std::uniform_real_distribution<float> value(-1, 1);
+  for (int s = 0; s < 2; s++) {
+    const int size = sizes[s];
+    const int dim = channels * size * size;
+    const int ld = dim + 5;
+    const int dim_coarse = HeadCascade::CoarseDim(channels, size, size, CASCADE_CELL);
+    TEST_CHECK(dim_coarse == channels * ((size + 1) / 2) * ((size + 1) / 2));
+
+    vector<float> weight(num_output * ld);
+    for (int i = 0; i < weight.size(); i++) {
+      weight[i] = value(engine);
+    }
+    vector<float> features(num_rows * dim);
+    for (int i = 0; i < num_rows; i++) {
+      for (int c = 0; c < channels; c++) {
+        vector<float> block_value(dim_coarse);
+        for (int b = 0; b < dim_coarse; b++) {
+          block_value[b] = value(engine);
+        }
+        for (int y = 0; y < size; y++) {
+          for (int x = 0; x < size; x++) {
+            features[i * dim + (c * size + y) * size + x] = block_value[(y / CASCADE_CELL) * ((size + 1) / 2) + x / CASCADE_CELL];
+          }
+        }
+      }
+    }
+
+    vector<float> coarse_weight(num_output * dim_coarse);
+    vector<float> coarse_features(num_rows * dim_coarse);
+    HeadCascade::CoarsenWeights(weight.data(), ld, num_output, channels, size, size, CASCADE_CELL, coarse_weight.data());
+    HeadCascade::CoarsenFeatures(features.data(), num_rows, channels, size, size, CASCADE_CELL, coarse_features.data());
+    for (int i = 0; i < num_rows; i++) {
+      for (int o = 0; o < num_output; o++) {
+        double exact = 0;
+        for (int k = 0; k < dim; k++) {
+          exact += features[i * dim + k] * weight[o * ld + k];
+        }
+        double coarse = 0;
+        for (int k = 0; k < dim_coarse; k++) {
+          coarse += coarse_features[i * dim_coarse + k] * coarse_weight[o * dim_coarse + k];
+        }
+        TEST_CHECK(fabs(exact - coarse) < 1e-4);
+      }
+    }
+  }
+
+  // survivors: within the margin of the top-th score, then bounded
+  const float sorted_scores[8] = {0.9, 0.85, 0.8, 0.6, 0.5, 0.45, 0.1, 0.05};
+  TEST_CHECK(HeadCascade::NumSurvivors(sorted_scores, 8, 3, 0.1, 1, 8) == 3);
+  TEST_CHECK(HeadCascade::NumSurvivors(sorted_scores, 8, 3, 0.4, 1, 8) == 6);
+  TEST_CHECK(HeadCascade::NumSurvivors(sorted_scores, 8, 3, 0.4, 1, 4) == 4);
+  TEST_CHECK(HeadCascade::NumSurvivors(sorted_scores, 8, 3, 0.1, 5, 8) == 5);
+  TEST_CHECK(HeadCascade::NumSurvivors(sorted_scores, 4, 5, 0.0, 20, 100) == 4);
+
+  // rejected rois: one coarse score above the weakest survivor's exact one, one tying it, one below
+  const int order[5] = {0, 1, 2, 3, 4};
+  float probabilities[10] = {0.3, 0.7, 0.7, 0.3, 0.4, 0.6, 0.73, 0.27, 0.9, 0.1};
+  const float rank_weights[5] = {1.0, 0.9, 0.8, 1.0, 1.0};
+  const float min_survivor_score = probabilities[3] * rank_weights[1];
+  probabilities[7] = min_survivor_score;
+  probabilities[6] = 1.0f - probabilities[7];
+  HeadCascade::CapRejected(order, 5, 2, rank_weights, probabilities);
+  TEST_CHECK(probabilities[1] == 0.7f && probabilities[3] == 0.3f);
+  for (int i = 2; i < 5; i++) {
+    TEST_CHECK(probabilities[2 * i + 1] * rank_weights[i] < min_survivor_score);
+    TEST_CHECK(fabs(probabilities[2 * i] + probabilities[2 * i + 1] - 1.0f) < 1e-6);
+  }
+  TEST_CHECK(probabilities[9] == 0.1f);
+  cout << "HeadCascade: coarse head matches the exact one on block constant features, rejected rois rank below the survivors" << endl;
+}
+
 int main (int argc, char *argv[]) {
   boost::shared_ptr<BoundingBox> sp;  // empty
 
@@ -226,6 +864,15 @@ int main (int argc, char *argv[]) {
 
   // populateTestEigenMap();
   // populateTestEigenFunctions();
+  populateTestTrackerSoak();
+  populateTestCandidateBudgetShortRound();
+  populateTestCandidateSetKernels();
+  populateTestCandidateSampler();
+  populateTestRngStream();
+  populateTestFusedPreprocess();
+  populateTestCropPadImage();
+  populateTestFrameArena();
+  populateTestHeadCascade();
   populateTestRapidXml();
   
 
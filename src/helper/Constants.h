@@ -53,11 +53,26 @@ const int NEG_CANDIDATES_FINETUNE = 40;
 #define LONG_TERM_UPDATE_INTERVAL 20
 #define LONG_TERM_POS_CANDIDATE_UPPER_BOUND 10
 #define LONG_TERM_NEG_CANDIDATE_UPPER_BOUND 200 // number of examples for forwarding, backward only does NOHEM_FINETUNE number of negative sampels
+#define LONG_TERM_FRAMES_PER_BATCH 5 // frames stacked into one solver step of a long term update
 const double SHORT_TERM_FINE_TUNE_TH = 0.5; // if want less frequent short term fine tune when distance window is applied, make if < 0.5
 
+// candidate budget of TrackerGMD: CANDIDATE_BUDGET_MIN candidates after a frame whose top TOP_ESTIMATES average above
+// CANDIDATE_BUDGET_CONFIDENT_PROB with a motion below CANDIDATE_BUDGET_SMALL_MOTION of the target size, SAMPLE_CANDIDATES
+// otherwise, then more rounds while the estimate stays uncertain, up to CANDIDATE_BUDGET_MAX candidates in total
+// #define ADAPTIVE_CANDIDATE_BUDGET
+const int CANDIDATE_BUDGET_MIN = 64;
+const int CANDIDATE_BUDGET_MAX = 500;
+const int CANDIDATE_BUDGET_MAX_ROUNDS = 3;
+const double CANDIDATE_BUDGET_CONFIDENT_PROB = 0.8;
+const double CANDIDATE_BUDGET_SMALL_MOTION = 0.1;
+
 // DEBUGGING
+// seed the trackers and example generators with the SEED_RNG_* values instead of time(NULL), and Caffe (Dropout of
+// the fine tuned head) with SEED_RNG_CAFFE instead of its random default, so that runs repeat exactly
+// #define REPRODUCIBLE_RNG
 #define SEED_RNG_EXAMPLE_GENERATOR 800
 #define SEED_RNG_TRACKER 500
+#define SEED_RNG_CAFFE 300
 #define SEED_ENGINE 800
 
 // Online Learning
@@ -79,12 +94,40 @@ const double SHORT_TERM_FINE_TUNE_TH = 0.5; // if want less frequent short term
 const double TARGET_SIZE = 600.0; // compare to min (W, H)
 const double MAX_SIZE = 1000.0; // make sure the image_curr does not exceed this size
 
+// scale image_curr so that the target covers ADAPTIVE_TARGET_SIZE input pixels (6 conv5 cells at stride 16),
+// instead of a fixed min side, the scale stays within [ADAPTIVE_MIN_SCALE_RATIO, ADAPTIVE_MAX_SCALE_RATIO] of the fixed one
+// #define ADAPTIVE_INPUT_SCALE
+const double ADAPTIVE_TARGET_SIZE = 96.0;
+const double ADAPTIVE_MIN_SCALE_RATIO = 0.5;
+const double ADAPTIVE_MAX_SCALE_RATIO = 2.0;
+const double ADAPTIVE_MAX_SIZE = 2000.0;
+
 // network input index
 #define TARGET_NETWORK_INPUT_IDX 0
 #define CANDIDATE_NETWORK_INPUT_IDX 1
 #define ROIS_NETWORK_INPUT_IDX 2
 #define LABEL_NETWORK_INPUT_IDX 3
 
+// forward pool6 of the target once and broadcast it inside the first fc layer, instead of copying it for every candidate
+#define BROADCAST_TARGET_FEATURE
+
+// score the candidates of PredictFast in two stages: all of them through the head with the first fc layer on
+// pool6_c averaged over CASCADE_CELL x CASCADE_CELL blocks, then only those within CASCADE_MARGIN of the
+// TOP_ESTIMATES-th coarse score (at least CASCADE_MIN_SURVIVORS, at most CASCADE_MAX_SURVIVORS) through the exact head
+// #define CASCADE_SCORING
+const int CASCADE_CELL = 2;
+const double CASCADE_MARGIN = 0.1;
+const int CASCADE_MIN_SURVIVORS = 4 * TOP_ESTIMATES;
+const int CASCADE_MAX_SURVIVORS = 100;
+
+// run the candidate backbone only over the box bounding all candidates instead of the full frame
+// #define SEARCH_REGION_BACKBONE
+const int SEARCH_REGION_MARGIN = 32; // context around the candidates, in pixels of the scaled image
+
+// frames decoded ahead of tracking on PREFETCH_THREADS threads by a TrackerManager that opts in with SetPrefetch
+const int PREFETCH_DEPTH = 4;
+const int PREFETCH_THREADS = 2;
+
 // training image mean 
 const cv::Scalar mean_scalar(104, 117, 123);
 
@@ -96,5 +139,7 @@ const cv::Scalar mean_scalar(104, 117, 123);
 const int BBOX_REGRESSION_FEATURE_LENGTH = 6 * 6 * 256;
 const float LAMBDA = 1000.0;
 // #define BOUNDING_BOX_REGRESSION
+// check the deduplicated training features of the bbox regressor pairwise, quadratic in the number of candidates
+// #define BBOX_REGRESSION_VALIDATION
 
 #endif
\ No newline at end of file
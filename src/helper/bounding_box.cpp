@@ -251,6 +251,7 @@ void BoundingBox::Shift(const cv::Mat& image,
                         const double lambda_shift_frac,
                         const double min_scale, const double max_scale,
                         const bool shift_motion_model,
+                        RngStream* rng,
                         BoundingBox* bbox_rand) const {
   const double width = get_width();
   const double height = get_height();
@@ -268,9 +269,9 @@ void BoundingBox::Shift(const cv::Mat& image,
     // Sample.
     double width_scale_factor;
     if (shift_motion_model) {
-      width_scale_factor = max(min_scale, min(max_scale, sample_exp_two_sided(lambda_scale_frac)));
+      width_scale_factor = max(min_scale, min(max_scale, sample_exp_two_sided(lambda_scale_frac, rng)));
     } else {
-      const double rand_num = sample_rand_uniform();
+      const double rand_num = sample_rand_uniform(rng);
       width_scale_factor = rand_num * (max_scale - min_scale) + min_scale;
     }
     // Expand width by scaling factor.
@@ -287,9 +288,9 @@ void BoundingBox::Shift(const cv::Mat& image,
     // Sample.
     double height_scale_factor;
     if (shift_motion_model) {
-      height_scale_factor = max(min_scale, min(max_scale, sample_exp_two_sided(lambda_scale_frac)));
+      height_scale_factor = max(min_scale, min(max_scale, sample_exp_two_sided(lambda_scale_frac, rng)));
     } else {
-      const double rand_num = sample_rand_uniform();
+      const double rand_num = sample_rand_uniform(rng);
       height_scale_factor = rand_num * (max_scale - min_scale) + min_scale;
     }
     // Expand height by scaling factor.
@@ -314,9 +315,9 @@ void BoundingBox::Shift(const cv::Mat& image,
     // Sample.
     double new_x_temp;
     if (shift_motion_model) {
-      new_x_temp = center_x + width * sample_exp_two_sided(lambda_shift_frac);
+      new_x_temp = center_x + width * sample_exp_two_sided(lambda_shift_frac, rng);
     } else {
-      const double rand_num = sample_rand_uniform();
+      const double rand_num = sample_rand_uniform(rng);
       new_x_temp = center_x + rand_num * (2 * new_width) - new_width;
     }
     // Make sure that the window stays within the image.
@@ -340,9 +341,9 @@ void BoundingBox::Shift(const cv::Mat& image,
     // Sample.
     double new_y_temp;
     if (shift_motion_model) {
-      new_y_temp = center_y + height * sample_exp_two_sided(lambda_shift_frac);
+      new_y_temp = center_y + height * sample_exp_two_sided(lambda_shift_frac, rng);
     } else {
-      const double rand_num = sample_rand_uniform();
+      const double rand_num = sample_rand_uniform(rng);
       new_y_temp = center_y + rand_num * (2 * new_height) - new_height;
     }
     // Make sure that the window stays within the image.
@@ -9,6 +9,7 @@
 #include <opencv2/highgui/highgui.hpp>
 
 class VOTRegion;
+class RngStream;
 
 // Represents a bounding box on an image, with some additional functionality.
 class BoundingBox
@@ -56,11 +57,12 @@ public:
                 const double edge_spacing_x, const double edge_spacing_y,
                 BoundingBox* bbox_uncentered) const;
 
-  // Shift the cropped region of the image to generate a new random training example.
+  // Shift the cropped region of the image to generate a new random training example, drawing from rng.
   void Shift(const cv::Mat& image,
              const double lambda_scale_frac, const double lambda_shift_frac,
              const double min_scale, const double max_scale,
              const bool shift_motion_model,
+             RngStream* rng,
              BoundingBox* bbox_rand) const;
 
   double get_scale_factor() const { return scale_factor_; }
@@ -1,11 +1,24 @@
 #include "bounding_box_regressor.h"
 #include <assert.h>
 #include <math.h>
-#include <map>
-
-#define DEBUG_ASSERT_DIFF_FEATURES
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include <glog/logging.h>
+
+// FNV-1a over the bits of a feature row, +0 and -0 are mapped alike since they compare equal
+static uint64_t hashFeatureRow(const float *row, const int length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int j = 0; j < length; j++) {
+        const float value = row[j] == 0 ? 0.0f : row[j];
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        hash = (hash ^ bits) * 1099511628211ULL;
+    }
+    return hash;
+}
 
-void printSamples(MatrixXd X) {
+void printSamples(const MatrixXf &X) {
     // DEBUG X
     for (int i = 0; i < X.rows(); i++) {
         cout << "X["<< i << "]" << endl;
@@ -16,221 +29,187 @@ void printSamples(MatrixXd X) {
     }
 }
 
-// TODO: try different solver and debug
-VectorXd Solve(MatrixXd A, VectorXd y, double lambda, string method = "normal") {
-    if (method.compare("cholesky") == 0) {
-        // Use Cholesky Decomposition
-        // (A'A + Lambda*I) x = A'y
-        // LL' = (...), LL' x = A'y
-        // z = L'x = L.inverse() * A'y
-        // x = L'.inverse() * z
-        Eigen::LLT<MatrixXd> llt(A.transpose() * A + lambda * MatrixXd::Identity(A.cols(), A.cols()));
-        cout << "finished LLT for matrix of size:" << A.cols() << ", " << A.cols() << endl;
-        MatrixXd L = llt.matrixL();
-        MatrixXd z = L.inverse() * (A.transpose() * y);
-        VectorXd x = L.transpose().inverse() * z;
-        return x;
-    }
-    else if (method.compare("normal") == 0) {
-        MatrixXd H = lambda * MatrixXd::Identity(A.cols(), A.cols());
-        H.noalias() += A.transpose() * A; 
-        cout << "finish A^T*A" << endl;
-        VectorXd x;
-        x.noalias() = H.ldlt().solve(A.transpose() * y);
+// Ridge regression for all columns of Y at once: min |A x - y|^2 + lambda |x|^2.
+// With fewer samples than features (the usual case, ~1000 candidates against 9217 features) the dual form
+// x = A' (AA' + lambda I)^-1 y only factorises a D x D matrix, otherwise the primal (A'A + lambda I) x = A'y is used.
+// Either way there is a single factorisation, shared by the 4 targets.
+MatrixXf SolveRidge(const MatrixXf &A, const MatrixXf &Y, float lambda) {
+    const int D = A.rows();
+    const int S = A.cols();
+    if (D < S) {
+        MatrixXf K = lambda * MatrixXf::Identity(D, D);
+        K.selfadjointView<Eigen::Lower>().rankUpdate(A);
+        Eigen::LLT<MatrixXf> llt(K.selfadjointView<Eigen::Lower>());
+        MatrixXf alpha = llt.solve(Y);
+        MatrixXf x;
+        x.noalias() = A.transpose() * alpha;
         return x;
     }
-    else if (method.compare("svd") == 0) {
-        MatrixXd H = lambda * MatrixXd::Identity(A.cols(), A.cols());
-        H.noalias() += A.transpose() * A;
-        return H.jacobiSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(A.transpose() * y);
-    }
     else {
-        cout << "Unknown solver method" << endl;
-        exit(-1);
+        MatrixXf H = lambda * MatrixXf::Identity(S, S);
+        H.selfadjointView<Eigen::Lower>().rankUpdate(A.transpose());
+        Eigen::LLT<MatrixXf> llt(H.selfadjointView<Eigen::Lower>());
+        MatrixXf Aty;
+        Aty.noalias() = A.transpose() * Y;
+        return llt.solve(Aty);
     }
 }
 
-void BoundingBoxRegressor::refineBoundingBox (BoundingBox &bbox, std::vector<float> &feature) {
+void BoundingBoxRegressor::refineBoundingBox (BoundingBox &bbox, const float *feature) {
+    std::vector<BoundingBox> bboxes(1, bbox);
+    refineBoundingBoxes(&bboxes, feature);
+    bbox = bboxes[0];
+}
 
-     assert (feature.size() == BBOX_REGRESSION_FEATURE_LENGTH);
+void BoundingBoxRegressor::refineBoundingBoxes (std::vector<BoundingBox> *bboxes, const float *features) {
      const int S = BBOX_REGRESSION_FEATURE_LENGTH;
-
-     VectorXd query(S);
-     for (int i = 0;i < S; i ++) {
-         query(i) = feature[i];
+     const int N = bboxes->size();
+
+     // one gemm for all queries, straight over the caller's rows
+     Eigen::Map<const Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> > query(features, N, S);
+     MatrixXf result_whitened(N, 4);
+     result_whitened.noalias() = query * Beta_.topRows(S);
+     result_whitened.rowwise() += Beta_.row(S);
+
+     MatrixXd result;
+     result.noalias() = result_whitened.cast<double>() * T_inv_;
+     result.rowwise() += Y_mu_.transpose();
+
+     for (int i = 0; i < N; i++) {
+         BoundingBox &bbox = (*bboxes)[i];
+         float dx = (float)(result(i, 0));
+         float dy = (float)(result(i, 1));
+         float dw = (float)(result(i, 2));
+         float dh = (float)(result(i, 3));
+
+         double ctr_x = bbox.get_center_x();
+         double ctr_y = bbox.get_center_y();
+         double w = bbox.get_width();
+         double h = bbox.get_height();
+
+         double refined_ctr_x = dx * w + ctr_x;
+         double refined_ctr_y = dy * h + ctr_y;
+         double refined_w = exp(dw) * w;
+         double refined_h = exp(dh) * h;
+
+         bbox.x1_ = refined_ctr_x - refined_w/2.0;
+         bbox.x2_ = refined_ctr_x + refined_w/2.0;
+         bbox.y1_ = refined_ctr_y - refined_h/2.0;
+         bbox.y2_ = refined_ctr_y + refined_h/2.0;
      }
+}
 
-     VectorXd result;
-     result.noalias() = query.transpose() * (Beta_.block(0,0,S,4)) + Beta_.row(S);
-     result.noalias() = result.transpose() * T_inv_ + Y_mu_.transpose();
-     float dx = (float)(result(0));
-     float dy = (float)(result(1));
-     float dw = (float)(result(2));
-     float dh = (float)(result(3));
-
-     double ctr_x = bbox.get_center_x();
-     double ctr_y = bbox.get_center_y();
-     double w = bbox.get_width();
-     double h = bbox.get_height();
-
-     double refined_ctr_x = dx * w + ctr_x;
-     double refined_ctr_y = dy * h + ctr_y;
-     double refined_w = exp(dw) * w;
-     double refined_h = exp(dh) * h;
-
-     bbox.x1_ = refined_ctr_x - refined_w/2.0;
-     bbox.x2_ = refined_ctr_x + refined_w/2.0;
-     bbox.y1_ = refined_ctr_y - refined_h/2.0;
-     bbox.y2_ = refined_ctr_y + refined_h/2.0;
+void BoundingBoxRegressor::trainModelUsingInitialFrameBboxes(const float *features, const std::vector<BoundingBox> & bboxes, 
+                                       const BoundingBox &gt) {
+    std::vector<const float*> rows(bboxes.size());
+    for (int i = 0; i < bboxes.size(); i++) {
+        rows[i] = features + (size_t)i * BBOX_REGRESSION_FEATURE_LENGTH;
+    }
+    trainModelUsingFeatureRows(rows, bboxes, gt);
 }
 
-void BoundingBoxRegressor::trainModelUsingInitialFrameBboxes(std::vector<std::vector<float> > &features, const std::vector<BoundingBox> & bboxes, 
+void BoundingBoxRegressor::trainModelUsingFeatureRows(const std::vector<const float*> &rows, const std::vector<BoundingBox> & bboxes, 
                                        const BoundingBox &gt) {
     
-    assert (features.size() == bboxes.size());
+    assert (rows.size() == bboxes.size());
+    const int S = BBOX_REGRESSION_FEATURE_LENGTH;
+
+    // Duplicate removal here, if several bboxes have the same feature, use their average.
+    // groups[k] holds the bboxes sharing the k-th distinct feature, rows are bucketed by hash and only
+    // compared in full within a bucket
+    std::vector<std::vector<int> > groups;
+    std::unordered_map<uint64_t, std::vector<int> > hash_to_groups;
+    hash_to_groups.reserve(rows.size());
+    for (int i = 0; i < rows.size(); i++) {
+        std::vector<int> &bucket = hash_to_groups[hashFeatureRow(rows[i], S)];
+        int group = -1;
+        for (int k = 0; k < bucket.size(); k++) {
+            if (std::equal(rows[i], rows[i] + S, rows[groups[bucket[k]][0]])) {
+                group = bucket[k];
+                break;
+            }
+        }
+        if (group < 0) {
+            group = groups.size();
+            groups.push_back(std::vector<int>());
+            bucket.push_back(group);
+        }
+        groups[group].push_back(i);
+    }
 
-    // Duplicate removal here, if several bboxes have the same feature, use their average/ just one
-    std::vector<std::vector<float> > features_unique;
-    std::vector<BoundingBox> bboxes_unique;
+    const int D = groups.size();
 
-    std::map<std::vector<float>, std::vector<int> > feature_to_bbox_idxes;
-    for (int i = 0; i < features.size(); i++) {
-        vector<float> this_feature = features[i];
-        if (feature_to_bbox_idxes.find(this_feature) == feature_to_bbox_idxes.end()) {
-            vector<int> this_idxes;
-            this_idxes.push_back(i);
-            feature_to_bbox_idxes[this_feature] = this_idxes;
-        }
-        else {
-            feature_to_bbox_idxes[this_feature].push_back(i);
+    if (debug_validation_) {
+        for (int i = 0; i < D; i ++) {
+            for (int j = i + 1; j < D; j++) {
+                CHECK(!std::equal(rows[groups[i][0]], rows[groups[i][0]] + S, rows[groups[j][0]]))
+                    << "bboxes " << groups[i][0] << " and " << groups[j][0] << " have the same features";
+            }
         }
     }
 
-    for (auto item : feature_to_bbox_idxes) {
-        features_unique.push_back(item.first);
+    // X: the distinct features plus a bias column, shape (D, S + 1); Y: dx, dy, dw, dh of the averaged bboxes, shape (D, 4)
+    MatrixXf X(D, S + 1);
+    MatrixXd Y(D, 4);
+
+    double gt_x = gt.get_center_x();
+    double gt_y = gt.get_center_y();
+    double gt_w = gt.get_width();
+    double gt_h = gt.get_height();
+
+    for (int k = 0; k < D; k ++) {
+        X.row(k).head(S) = Eigen::Map<const Eigen::RowVectorXf>(rows[groups[k][0]], S);
 
         // here use average, TODO: try just use the first one 
-        int count = 0;
         double x1_sum = 0;
         double y1_sum = 0;
         double x2_sum = 0;
         double y2_sum = 0;
-
-        for (auto idx : item.second) {
+        for (int idx : groups[k]) {
             x1_sum += bboxes[idx].x1_;
             y1_sum += bboxes[idx].y1_;
             x2_sum += bboxes[idx].x2_;
             y2_sum += bboxes[idx].y2_;
-            count ++;
         }
-        
+        const int count = groups[k].size();
         BoundingBox averaged_bbox(x1_sum/count, y1_sum/count, x2_sum/count, y2_sum/count);
-        bboxes_unique.push_back(averaged_bbox);
-    }
 
-    assert (features_unique.size() == bboxes_unique.size());
+        double this_bbox_x = averaged_bbox.get_center_x();
+        double this_bbox_y = averaged_bbox.get_center_y();
+        double this_bbox_w = averaged_bbox.get_width();
+        double this_bbox_h = averaged_bbox.get_height();
 
-#ifdef DEBUG_ASSERT_DIFF_FEATURES
-    for (int i = 0; i < features_unique.size(); i ++) {
-        for (int j = i + 1; j < features_unique.size(); j++) {
-            assert(!equalVector(features_unique[i], features_unique[j]));
-            assert (features_unique[i].size() == features_unique[j].size());
-            // if (equalVector(features_unique[i], features_unique[j])) {
-            //     cout << "candidate bbox " << i << " and " << j << " have the exact same conv5 feature" << endl;
-            //     cout << "IOU between these two boxes:" << bboxes_unique[i].compute_IOU(bboxes_unique[j]) << endl;
-            // }
-        }
+        Y(k, 0) = (gt_x -this_bbox_x)/this_bbox_w;
+        Y(k, 1) = (gt_y -this_bbox_y)/this_bbox_h;
+        Y(k, 2) = log(gt_w/this_bbox_w);
+        Y(k, 3) = log(gt_h/this_bbox_h);
     }
-#endif
-
-    // construct the 4 labels
-    std::vector<float> dx_labels;
-    std::vector<float> dy_labels;
-    std::vector<float> dw_labels;
-    std::vector<float> dh_labels;
+    X.col(S).setOnes();
 
-    double gt_x = gt.get_center_x();
-    double gt_y = gt.get_center_y();
-    double gt_w = gt.get_width();
-    double gt_h = gt.get_height();
-
-    for (int i = 0; i < bboxes_unique.size(); i ++) {
-        double this_bbox_x = bboxes_unique[i].get_center_x();
-        double this_bbox_y = bboxes_unique[i].get_center_y();
-        double this_bbox_w = bboxes_unique[i].get_width();
-        double this_bbox_h = bboxes_unique[i].get_height();
-
-
-        float this_dx_label = (float)((gt_x -this_bbox_x)/this_bbox_w);
-        float this_dy_label = (float)((gt_y -this_bbox_y)/this_bbox_h);
-        float this_dw_label = (float)(log(gt_w/this_bbox_w));
-        float this_dh_label = (float)(log(gt_h/this_bbox_h));
-
-        dx_labels.push_back(this_dx_label);
-        dy_labels.push_back(this_dy_label);
-        dw_labels.push_back(this_dw_label);
-        dh_labels.push_back(this_dh_label);
+    if (debug_validation_) {
+        for (int k = 0; k < D; k++) {
+            for (int j = 0; j < S; j ++) {
+                CHECK_EQ(X(k, j), rows[groups[k][0]][j]) << "feature " << j << " of bbox " << groups[k][0];
+            }
+            CHECK_EQ(X(k, S), 1);
+        }
     }
 
-    trainModels(features_unique, dx_labels, dy_labels, dw_labels, dh_labels);
-
+    trainModels(X, Y);
 }
 
-void BoundingBoxRegressor::trainModels(std::vector<std::vector<float> > &features, 
-                    std::vector<float> &dx_labels, std::vector<float> &dy_labels, 
-                    std::vector<float> &dw_labels, std::vector<float> &dh_labels) {
-    
-    // assert make sure data dim match
-    assert(features.size() == dx_labels.size());
-    assert(features.size() == dy_labels.size());
-    assert(features.size() == dw_labels.size());
-    assert(features.size() == dh_labels.size());
-
-    if (features.size() > 0) {
-        assert(features[0].size() == BBOX_REGRESSION_FEATURE_LENGTH);
-    }
-
-    // Construct X matrix, shape (D, S + 1), + 1 for bias ; Y matrix, shape (D, 4), dx, dy, dw, dh accordingly
-    int D = features.size();
-    int S = BBOX_REGRESSION_FEATURE_LENGTH;
-    MatrixXd X(D, S + 1);
-    MatrixXd Y(D, 4);
-
-    for (int i = 0; i < D; i ++) {
-        // set X
-        for (int j = 0; j < S; j ++) {
-            X(i, j) = (double)(features[i][j]);
-        }
-        // set Y
-        Y(i, 0) = (double)(dx_labels[i]);
-        Y(i, 1) = (double)(dy_labels[i]);
-        Y(i, 2) = (double)(dw_labels[i]);
-        Y(i, 3) = (double)(dh_labels[i]);
-    }
-
-    for (int i =0; i < D; i++) {
-        for(int j = 0;j < S; j ++) {
-            assert(X(i,j) == features[i][j]);
-        }
-    }
+void BoundingBoxRegressor::trainModels(const MatrixXf &X, const MatrixXd &Y) {
+    assert (X.cols() == BBOX_REGRESSION_FEATURE_LENGTH + 1);
+    assert (X.rows() == Y.rows() && Y.cols() == 4);
 
-    // set bias
-    VectorXd bias = VectorXd::Constant(D, 1);
-    X.col(S) = bias;
+    const int D = X.rows();
 
-    for (int i = 0;i < D; i ++) {
-        assert(X(i, S) == 1);
-    }
-    
-    // Whitening transform
-    Y_mu_ = VectorXd(4);
-    Y_mu_ << Y.col(0).mean(), Y.col(1).mean(), Y.col(2).mean(), Y.col(3).mean();
+    // Whitening transform, on the centered targets
+    Y_mu_ = Y.colwise().mean().transpose();
+    MatrixXd Y_centered = Y.rowwise() - Y_mu_.transpose();
 
-    for (int j = 0; j < 4; j ++) {
-        Y.col(j) = Y.col(j) - VectorXd::Constant(Y.col(j).size(), Y_mu_(j));
-    }
     // get data covariance matrix
-    MatrixXd cov = (Y.transpose() * Y) / D;
+    MatrixXd cov = (Y_centered.transpose() * Y_centered) / D;
     // do eigen value decomposition
     Eigen::EigenSolver<MatrixXd> es(cov);
     MatrixXd diagnal = MatrixXd::Constant(cov.rows(), cov.cols(), 0);
@@ -248,15 +227,8 @@ void BoundingBoxRegressor::trainModels(std::vector<std::vector<float> > &feature
     }
     // take Whitening^-1
     T_ = es.eigenvectors().real() * diagnal_reciprocal * es.eigenvectors().real().transpose();
-    Y = Y * T_;
-
-    // train 4 regressors for dx, dy, dw, dh
-    MatrixXd Beta(S+1, 4); // the regressed parameters
-    for (int j = 0; j < 4; j ++) {
-        cout << "solve for model " << j << endl;
-        Beta.col(j) = Solve(X, Y.col(j), LAMBDA, "normal");
-    }
+    const MatrixXf Y_white = (Y_centered * T_).cast<float>();
 
-    // save the models
-    Beta_ = Beta;
+    // train the 4 regressors for dx, dy, dw, dh together, shape (S + 1, 4)
+    Beta_ = SolveRidge(X, Y_white, LAMBDA);
 }
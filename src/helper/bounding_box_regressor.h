@@ -2,6 +2,7 @@
 #define BOUNDING_BOX_REGRESSOR_h
 #include <iostream>
 #include <vector>
+#include <stdint.h>
 #include <Eigen/Dense> // Checkout: if it will be faster if use sparse
 
 #include "Constants.h"
@@ -13,28 +14,43 @@ using Eigen::MatrixXd;
 using Eigen::ArrayXd;
 using Eigen::VectorXd;
 using Eigen::MatrixXf;
+using Eigen::VectorXf;
 using Eigen::Matrix;
 
 class BoundingBoxRegressor {
 
 public:
-    // given the bbox and its Conv features, regress it to refine
-    void refineBoundingBox (BoundingBox &bbox, std::vector<float> &feature);
+    BoundingBoxRegressor() : debug_validation_(false) { }
 
-    // given the frame 0 bboxes and their corresponding features, and gt bbox at frame 0, train the 4 models
-    void trainModelUsingInitialFrameBboxes(std::vector<std::vector<float> > &features, 
+    // given the bbox and its Conv features (BBOX_REGRESSION_FEATURE_LENGTH floats), regress it to refine
+    void refineBoundingBox (BoundingBox &bbox, const float *feature);
+
+    // refine all bboxes at once, features holds one row per bbox
+    void refineBoundingBoxes (std::vector<BoundingBox> *bboxes, const float *features);
+
+    // given the frame 0 bboxes and their corresponding features (one row per bbox), and gt bbox at frame 0, train the 4 models
+    void trainModelUsingInitialFrameBboxes(const float *features, 
                                            const std::vector<BoundingBox> & bboxes, const BoundingBox &gt);
 
-    // the actual train model function
-    void trainModels(std::vector<std::vector<float> > &features, 
-                     std::vector<float> &dx_labels, std::vector<float> &dy_labels, 
-                     std::vector<float> &dw_labels, std::vector<float> &dh_labels);
+    // same, the features are given as rows of BBOX_REGRESSION_FEATURE_LENGTH floats, which are not copied
+    // except once into the design matrix
+    void trainModelUsingFeatureRows(const std::vector<const float*> &rows,
+                                    const std::vector<BoundingBox> & bboxes, const BoundingBox &gt);
+
+    // the actual train model function, X (D, S + 1) with the bias column last, Y (D, 4) of dx, dy, dw, dh
+    void trainModels(const MatrixXf &X, const MatrixXd &Y);
+
+    // check that deduplicated features are pairwise distinct and copied correctly, O(D^2 * S), aborts otherwise.
+    // TrackerGMD turns it on with BBOX_REGRESSION_VALIDATION.
+    void setDebugValidation(const bool enable) { debug_validation_ = enable; }
 
 private:
     MatrixXd T_;
     MatrixXd T_inv_;
     VectorXd Y_mu_;
-    MatrixXd Beta_;
+    MatrixXf Beta_; // (S + 1, 4), last row is the bias
+
+    bool debug_validation_;
 
 };
 
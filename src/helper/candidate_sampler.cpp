@@ -0,0 +1,155 @@
+#include "candidate_sampler.h"
+
+#include <math.h>
+#include <cfloat>
+#include <algorithm>
+
+// never draw more than this many times the boxes still missing in one batch, nor the boxes asked for in one call
+const float kMaxOversample = 16.0f;
+
+CandidateSampler::CandidateSampler(RngStream *rng) :
+  rng_(rng)
+{
+}
+
+void CandidateSampler::FillClippedGaussian(const int n, float *out) {
+  // Box-Muller, one pair of normals per pair of uniforms
+  const int num_pairs = (n + 1) / 2;
+  uniforms_.resize(2 * num_pairs);
+  rng_->FillUniform(2 * num_pairs, uniforms_.data());
+
+  float *u = uniforms_.data();
+  const float two_pi = 2 * PI;
+  for (int k = 0; k < num_pairs; k++) {
+    const float radius = sqrtf(-2.0f * logf(1.0f - u[2 * k])); // 1 - u in (0, 1]
+    const float angle = two_pi * u[2 * k + 1];
+    u[2 * k] = radius * cosf(angle);
+    u[2 * k + 1] = radius * sinf(angle);
+  }
+
+  const float keep = KEEP_SD;
+  for (int i = 0; i < n; i++) {
+    out[i] = std::max(-keep, std::min(keep, u[i]));
+  }
+}
+
+void CandidateSampler::Sample(const BoundingBox &bbox, const int num, const int W, const int H,
+                              const SampleMethod method, const SampleParams &params, CandidateSet *out) {
+  const float w = bbox.x2_ - bbox.x1_;
+  const float h = bbox.y2_ - bbox.y1_;
+  const float centre_x = bbox.x1_ + w / 2.0f;
+  const float centre_y = bbox.y1_ + h / 2.0f;
+
+  out->resize(num);
+  r0_.resize(num);
+  r1_.resize(num);
+  r2_.resize(num);
+  r3_.resize(num);
+  const float *r0 = r0_.data(), *r1 = r1_.data(), *r2 = r2_.data(), *r3 = r3_.data();
+
+  // moved centre and size, written in place of the output coordinates then turned into corners
+  float *cx = out->mutable_x1(), *cy = out->mutable_y1(), *mw = out->mutable_x2(), *mh = out->mutable_y2();
+
+  switch (method) {
+    case SAMPLE_UNIFORM:
+    case SAMPLE_UNIFORM_AP: {
+      rng_->FillUniform(num, r0_.data());
+      rng_->FillUniform(num, r1_.data());
+      rng_->FillUniform(num, r2_.data());
+      // SAMPLE_UNIFORM scales the height with the same draw as the width
+      if (method == SAMPLE_UNIFORM_AP) {
+        rng_->FillUniform(num, r3_.data());
+      }
+      else {
+        r3 = r2;
+      }
+      const float trans_x = w * params.trans_range, trans_y = h * params.trans_range;
+      const float log_scale = log(SCALE_FACTOR) * params.scale_range;
+      for (int i = 0; i < num; i++) {
+        cx[i] = centre_x + (r0[i] * 2.0f - 1.0f) * trans_x;
+        cy[i] = centre_y + (r1[i] * 2.0f - 1.0f) * trans_y;
+        mw[i] = w * expf((r2[i] * 2.0f - 1.0f) * log_scale);
+        mh[i] = h * expf((r3[i] * 2.0f - 1.0f) * log_scale);
+      }
+      break;
+    }
+    case SAMPLE_GAUSSIAN:
+    case SAMPLE_GAUSSIAN_AP: {
+      FillClippedGaussian(num, r0_.data());
+      FillClippedGaussian(num, r1_.data());
+      FillClippedGaussian(num, r2_.data());
+      float log_ap = 0;
+      if (method == SAMPLE_GAUSSIAN_AP) {
+        FillClippedGaussian(num, r3_.data());
+        log_ap = log(MOTION_AP_FACTOR) * params.sd_ap;
+      }
+      else {
+        std::fill(r3_.begin(), r3_.end(), 0.0f);
+      }
+      const float r = round((w + h) / 2.0);
+      const float shift_x = params.sd_x * r, shift_y = params.sd_y * r;
+      const float log_scale = log(MOTION_SCALE_FACTOR) * params.sd_scale;
+      for (int i = 0; i < num; i++) {
+        cx[i] = centre_x + shift_x * r0[i];
+        cy[i] = centre_y + shift_y * r1[i];
+        const float ds = expf(log_scale * r2[i]);
+        mw[i] = w * ds;
+        mh[i] = h * ds * expf(log_ap * r3[i]);
+      }
+      break;
+    }
+    case SAMPLE_WHOLE: {
+      rng_->FillUniform(num, r0_.data());
+      rng_->FillUniform(num, r1_.data());
+      rng_->FillUniform(num, r2_.data());
+      // image_w - 1 to be safe, in case of ceiling later
+      const float min_x = w / 2, max_x = W - 1 - w / 2;
+      const float min_y = h / 2, max_y = H - 1 - h / 2;
+      const float log_scale = log(SCALE_FACTOR) * params.scale_range;
+      for (int i = 0; i < num; i++) {
+        cx[i] = r0[i] * (max_x - min_x) + min_x;
+        cy[i] = r1[i] * (max_y - min_y) + min_y;
+        const float ds = expf((r2[i] * 2.0f - 1.0f) * log_scale);
+        mw[i] = w * ds;
+        mh[i] = h * ds;
+      }
+      break;
+    }
+  }
+
+  for (int i = 0; i < num; i++) {
+    const float x = cx[i], y = cy[i], half_w = mw[i] / 2.0f, half_h = mh[i] / 2.0f;
+    cx[i] = x - half_w;
+    cy[i] = y - half_h;
+    mw[i] = x + half_w;
+    mh[i] = y + half_h;
+  }
+}
+
+int CandidateSampler::SampleAccepted(const BoundingBox &bbox, const int num, const int W, const int H,
+                                     const SampleMethod method, const SampleParams &params,
+                                     const double min_iou, const double max_iou, CandidateSet *accepted) {
+  const bool check_iou = min_iou > -FLT_MAX || max_iou < FLT_MAX;
+  // no draw may pass at all, e.g. for a box larger than the frame, so the number of draws is bounded
+  const long max_draws = (long)ceil(kMaxOversample * num);
+  long num_drawn = 0;
+  long num_passed = 0;
+  int count = 0;
+  while (count < num && num_drawn < max_draws) {
+    const int missing = num - count;
+    const float pass_rate = num_drawn > 0 ? std::max(1.0f / kMaxOversample, (float)num_passed / num_drawn) : 1.0f;
+    const int batch = (int)std::min((long)ceil(missing / pass_rate), max_draws - num_drawn);
+
+    Sample(bbox, batch, W, H, method, params, &draws_);
+    draws_.ValidAgainstWidthHeight(W, H, &mask_);
+    if (check_iou) {
+      draws_.ComputeIOU(bbox, &iou_);
+      CandidateSet::AndIOURange(iou_, min_iou, max_iou, &mask_);
+    }
+
+    num_drawn += batch;
+    num_passed += std::count(mask_.begin(), mask_.end(), 1);
+    count += accepted->AppendSelected(draws_, mask_, missing);
+  }
+  return count;
+}
@@ -0,0 +1,71 @@
+#ifndef CANDIDATE_SAMPLER_H
+#define CANDIDATE_SAMPLER_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "bounding_box.h"
+#include "candidate_set.h"
+#include "rng_stream.h"
+#include "Constants.h"
+
+// How boxes are moved around the reference box.
+enum SampleMethod {
+  SAMPLE_UNIFORM,     // shift uniform in trans_range * (w, h), scale SCALE_FACTOR^U(-scale_range, scale_range)
+  SAMPLE_UNIFORM_AP,  // as SAMPLE_UNIFORM, width and height scaled independently
+  SAMPLE_GAUSSIAN,    // shift sd_x, sd_y * mean side, scale MOTION_SCALE_FACTOR^(sd_scale * N), normals clipped at KEEP_SD
+  SAMPLE_GAUSSIAN_AP, // as SAMPLE_GAUSSIAN, aspect ratio changed by MOTION_AP_FACTOR^(sd_ap * N), the tracker's motion model
+  SAMPLE_WHOLE        // center uniform over the frame, scale as SAMPLE_UNIFORM
+};
+
+// Spread of the moved boxes, which fields are used depends on the SampleMethod
+struct SampleParams {
+  SampleParams(const double trans_range = POS_TRANS_RANGE, const double scale_range = POS_SCALE_RANGE,
+               const double sd_x = SD_X, const double sd_y = SD_Y, const double sd_scale = SD_SCALE,
+               const double sd_ap = SD_AP) :
+    trans_range(trans_range), scale_range(scale_range), sd_x(sd_x), sd_y(sd_y), sd_scale(sd_scale), sd_ap(sd_ap) { }
+
+  double trans_range;
+  double scale_range;
+  double sd_x;
+  double sd_y;
+  double sd_scale;
+  double sd_ap;
+};
+
+// Draws moved boxes a batch at a time: the random numbers of the whole batch are generated first (normals by
+// Box-Muller over uniforms), then the boxes are built in flat loops over a CandidateSet, and rejection is done
+// for the whole batch with the CandidateSet kernels.
+class CandidateSampler
+{
+public:
+  // rng is not owned
+  explicit CandidateSampler(RngStream *rng);
+
+  // Replace out with num boxes moved around bbox in a W x H frame
+  void Sample(const BoundingBox &bbox, const int num, const int W, const int H,
+              const SampleMethod method, const SampleParams &params, CandidateSet *out);
+
+  // Append to accepted num boxes moved around bbox, that are valid in the W x H frame and have an IOU with bbox
+  // in [min_iou, max_iou], in the order drawn. Draws are oversampled by the acceptance rate seen so far, up to
+  // 16 * num in total: returns how many boxes were appended, fewer than num if too few draws passed, none e.g. for
+  // a box larger than the frame.
+  int SampleAccepted(const BoundingBox &bbox, const int num, const int W, const int H,
+                     const SampleMethod method, const SampleParams &params,
+                     const double min_iou, const double max_iou, CandidateSet *accepted);
+
+private:
+  // n standard normals clipped to [-KEEP_SD, KEEP_SD]
+  void FillClippedGaussian(const int n, float *out);
+
+  RngStream *rng_;
+
+  // scratch
+  std::vector<float> r0_, r1_, r2_, r3_;
+  std::vector<float> uniforms_;
+  CandidateSet draws_;
+  std::vector<float> iou_;
+  std::vector<uint8_t> mask_;
+};
+
+#endif // CANDIDATE_SAMPLER_H
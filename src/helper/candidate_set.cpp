@@ -0,0 +1,187 @@
+#include "candidate_set.h"
+
+#include <math.h>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void CandidateSet::clear() {
+  x1_.clear();
+  y1_.clear();
+  x2_.clear();
+  y2_.clear();
+}
+
+void CandidateSet::reserve(const size_t n) {
+  x1_.reserve(n);
+  y1_.reserve(n);
+  x2_.reserve(n);
+  y2_.reserve(n);
+}
+
+void CandidateSet::resize(const size_t n) {
+  x1_.resize(n);
+  y1_.resize(n);
+  x2_.resize(n);
+  y2_.resize(n);
+}
+
+void CandidateSet::push_back(const BoundingBox &bbox) {
+  push_back(bbox.x1_, bbox.y1_, bbox.x2_, bbox.y2_);
+}
+
+void CandidateSet::push_back(const float x1, const float y1, const float x2, const float y2) {
+  x1_.push_back(x1);
+  y1_.push_back(y1);
+  x2_.push_back(x2);
+  y2_.push_back(y2);
+}
+
+void CandidateSet::assign(const std::vector<BoundingBox> &bboxes) {
+  resize(bboxes.size());
+  for (size_t i = 0; i < bboxes.size(); i++) {
+    x1_[i] = bboxes[i].x1_;
+    y1_[i] = bboxes[i].y1_;
+    x2_[i] = bboxes[i].x2_;
+    y2_[i] = bboxes[i].y2_;
+  }
+}
+
+size_t CandidateSet::AppendSelected(const CandidateSet &from, const std::vector<uint8_t> &mask, const size_t max_count) {
+  size_t appended = 0;
+  for (size_t i = 0; i < from.size() && appended < max_count; i++) {
+    if (mask[i]) {
+      push_back(from.x1_[i], from.y1_[i], from.x2_[i], from.y2_[i]);
+      appended++;
+    }
+  }
+  return appended;
+}
+
+BoundingBox CandidateSet::Get(const size_t i) const {
+  return BoundingBox(x1_[i], y1_[i], x2_[i], y2_[i]);
+}
+
+void CandidateSet::AppendTo(std::vector<BoundingBox> *bboxes) const {
+  bboxes->reserve(bboxes->size() + size());
+  for (size_t i = 0; i < size(); i++) {
+    bboxes->push_back(Get(i));
+  }
+}
+
+void CandidateSet::ComputeIOU(const BoundingBox &ref, std::vector<float> *iou) const {
+  const size_t n = size();
+  iou->resize(n);
+  const float rx1 = ref.x1_, ry1 = ref.y1_, rx2 = ref.x2_, ry2 = ref.y2_;
+  float *out = iou->data();
+
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 vrx1 = _mm_set1_ps(rx1), vry1 = _mm_set1_ps(ry1), vrx2 = _mm_set1_ps(rx2), vry2 = _mm_set1_ps(ry2);
+  for (; i + 4 <= n; i += 4) {
+    const __m128 x1 = _mm_loadu_ps(&x1_[i]), y1 = _mm_loadu_ps(&y1_[i]);
+    const __m128 x2 = _mm_loadu_ps(&x2_[i]), y2 = _mm_loadu_ps(&y2_[i]);
+    const __m128 inter_w = _mm_max_ps(zero, _mm_sub_ps(_mm_min_ps(x2, vrx2), _mm_max_ps(x1, vrx1)));
+    const __m128 inter_h = _mm_max_ps(zero, _mm_sub_ps(_mm_min_ps(y2, vry2), _mm_max_ps(y1, vry1)));
+    const __m128 union_w = _mm_max_ps(zero, _mm_sub_ps(_mm_max_ps(x2, vrx2), _mm_min_ps(x1, vrx1)));
+    const __m128 union_h = _mm_max_ps(zero, _mm_sub_ps(_mm_max_ps(y2, vry2), _mm_min_ps(y1, vry1)));
+    _mm_storeu_ps(out + i, _mm_div_ps(_mm_mul_ps(inter_w, inter_h), _mm_mul_ps(union_w, union_h)));
+  }
+#endif
+  for (; i < n; i++) {
+    const float inter_w = std::max(0.0f, std::min(x2_[i], rx2) - std::max(x1_[i], rx1));
+    const float inter_h = std::max(0.0f, std::min(y2_[i], ry2) - std::max(y1_[i], ry1));
+    const float union_w = std::max(0.0f, std::max(x2_[i], rx2) - std::min(x1_[i], rx1));
+    const float union_h = std::max(0.0f, std::max(y2_[i], ry2) - std::min(y1_[i], ry1));
+    out[i] = (inter_w * inter_h) / (union_w * union_h);
+  }
+}
+
+void CandidateSet::ComputeCenterDistance(const BoundingBox &ref, std::vector<float> *distance) const {
+  const size_t n = size();
+  distance->resize(n);
+  const float rcx = ref.get_center_x(), rcy = ref.get_center_y();
+  float *out = distance->data();
+
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 vrcx = _mm_set1_ps(rcx), vrcy = _mm_set1_ps(rcy);
+  for (; i + 4 <= n; i += 4) {
+    const __m128 dx = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&x1_[i]), _mm_loadu_ps(&x2_[i])), half), vrcx);
+    const __m128 dy = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&y1_[i]), _mm_loadu_ps(&y2_[i])), half), vrcy);
+    _mm_storeu_ps(out + i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))));
+  }
+#endif
+  for (; i < n; i++) {
+    const float dx = (x1_[i] + x2_[i]) * 0.5f - rcx;
+    const float dy = (y1_[i] + y2_[i]) * 0.5f - rcy;
+    out[i] = sqrtf(dx * dx + dy * dy);
+  }
+}
+
+void CandidateSet::CropAgainstWidthHeight(const int W, const int H) {
+  const float max_x = W - 1.0f, max_y = H - 1.0f;
+  // plain min / max loops, vectorized by the compiler
+  for (size_t i = 0; i < size(); i++) {
+    x1_[i] = std::max(x1_[i], 0.0f);
+    y1_[i] = std::max(y1_[i], 0.0f);
+    x2_[i] = std::min(x2_[i], max_x);
+    y2_[i] = std::min(y2_[i], max_y);
+  }
+}
+
+void CandidateSet::ValidAgainstWidthHeight(const int W, const int H, std::vector<uint8_t> *valid) const {
+  const size_t n = size();
+  valid->resize(n);
+  const float max_x = W - 1.0f, max_y = H - 1.0f;
+  uint8_t *out = valid->data();
+
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+  const __m128 vmax_x = _mm_set1_ps(max_x), vmax_y = _mm_set1_ps(max_y);
+  for (; i + 4 <= n; i += 4) {
+    const __m128 x1 = _mm_loadu_ps(&x1_[i]), y1 = _mm_loadu_ps(&y1_[i]);
+    const __m128 x2 = _mm_loadu_ps(&x2_[i]), y2 = _mm_loadu_ps(&y2_[i]);
+    // at least one pixel wide and high, inside [0, W - 1] x [0, H - 1]
+    __m128 ok = _mm_cmpge_ps(_mm_sub_ps(x2, x1), one);
+    ok = _mm_and_ps(ok, _mm_cmpge_ps(_mm_sub_ps(y2, y1), one));
+    ok = _mm_and_ps(ok, _mm_cmpge_ps(x1, zero));
+    ok = _mm_and_ps(ok, _mm_cmpge_ps(y1, zero));
+    ok = _mm_and_ps(ok, _mm_cmple_ps(x2, vmax_x));
+    ok = _mm_and_ps(ok, _mm_cmple_ps(y2, vmax_y));
+    const int bits = _mm_movemask_ps(ok);
+    out[i] = bits & 1;
+    out[i + 1] = (bits >> 1) & 1;
+    out[i + 2] = (bits >> 2) & 1;
+    out[i + 3] = (bits >> 3) & 1;
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = (x2_[i] - x1_[i] >= 1.0f) & (y2_[i] - y1_[i] >= 1.0f)
+             & (x1_[i] >= 0.0f) & (y1_[i] >= 0.0f) & (x2_[i] <= max_x) & (y2_[i] <= max_y);
+  }
+}
+
+void CandidateSet::AndIOURange(const std::vector<float> &iou, const float min_iou, const float max_iou,
+                               std::vector<uint8_t> *mask) {
+  for (size_t i = 0; i < iou.size(); i++) {
+    (*mask)[i] &= (iou[i] >= min_iou) & (iou[i] <= max_iou);
+  }
+}
+
+void CandidateSet::WriteRois(const int batch_id, const double scale, const double offset_x, const double offset_y,
+                             float *rois) const {
+  const float s = scale, ox = offset_x, oy = offset_y;
+  for (size_t i = 0; i < size(); i++) {
+    rois[5 * i] = batch_id;
+    rois[5 * i + 1] = (x1_[i] - ox) * s;
+    rois[5 * i + 2] = (y1_[i] - oy) * s;
+    rois[5 * i + 3] = (x2_[i] - ox) * s;
+    rois[5 * i + 4] = (y2_[i] - oy) * s;
+  }
+}
@@ -0,0 +1,72 @@
+#ifndef CANDIDATE_SET_H
+#define CANDIDATE_SET_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "bounding_box.h"
+
+// Candidate boxes as a structure of arrays (float x1 / y1 / x2 / y2), so that the per-candidate geometry used
+// when sampling and scoring candidates runs 4 boxes at a time instead of one BoundingBox call per box.
+class CandidateSet
+{
+public:
+  CandidateSet() { }
+
+  size_t size() const { return x1_.size(); }
+  bool empty() const { return x1_.empty(); }
+
+  void clear();
+  void reserve(const size_t n);
+  void resize(const size_t n);
+
+  void push_back(const BoundingBox &bbox);
+  void push_back(const float x1, const float y1, const float x2, const float y2);
+
+  // Replace the content by bboxes
+  void assign(const std::vector<BoundingBox> &bboxes);
+
+  // Append the boxes of from whose mask entry is non zero, in order, stopping at max_count appended boxes.
+  // Returns the number of boxes appended.
+  size_t AppendSelected(const CandidateSet &from, const std::vector<uint8_t> &mask, const size_t max_count);
+
+  BoundingBox Get(const size_t i) const;
+
+  // Append all boxes to bboxes
+  void AppendTo(std::vector<BoundingBox> *bboxes) const;
+
+  // IOU of every box with ref, same definition as BoundingBox::compute_IOU
+  void ComputeIOU(const BoundingBox &ref, std::vector<float> *iou) const;
+
+  // Distance between the center of every box and the center of ref
+  void ComputeCenterDistance(const BoundingBox &ref, std::vector<float> *distance) const;
+
+  // Same as BoundingBox::crop_against_width_height on every box
+  void CropAgainstWidthHeight(const int W, const int H);
+
+  // 1 for the boxes passing BoundingBox::valid_bbox_against_width_height, 0 otherwise
+  void ValidAgainstWidthHeight(const int W, const int H, std::vector<uint8_t> *valid) const;
+
+  // mask[i] &= (iou[i] >= min_iou && iou[i] <= max_iou)
+  static void AndIOURange(const std::vector<float> &iou, const float min_iou, const float max_iou,
+                          std::vector<uint8_t> *mask);
+
+  // Rows of (batch_id, x1, y1, x2, y2) for ROI pooling, coordinates relative to (offset_x, offset_y) and scaled
+  void WriteRois(const int batch_id, const double scale, const double offset_x, const double offset_y,
+                 float *rois) const;
+
+  const float* x1() const { return x1_.data(); }
+  const float* y1() const { return y1_.data(); }
+  const float* x2() const { return x2_.data(); }
+  const float* y2() const { return y2_.data(); }
+
+  float* mutable_x1() { return x1_.data(); }
+  float* mutable_y1() { return y1_.data(); }
+  float* mutable_x2() { return x2_.data(); }
+  float* mutable_y2() { return y2_.data(); }
+
+private:
+  std::vector<float> x1_, y1_, x2_, y2_;
+};
+
+#endif // CANDIDATE_SET_H
@@ -0,0 +1,77 @@
+#include "frame_arena.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+
+// cache line, also enough for SSE / AVX loads
+const size_t kArenaAlignment = 64;
+
+FrameArena::FrameArena(const size_t block_bytes) :
+  block_bytes_(block_bytes),
+  current_(0),
+  offset_(0)
+{
+}
+
+FrameArena::~FrameArena() {
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    free(blocks_[i].data);
+  }
+}
+
+void* FrameArena::Allocate(const size_t bytes) {
+  const size_t size = (std::max(bytes, (size_t)1) + kArenaAlignment - 1) & ~(kArenaAlignment - 1);
+
+  // first block from the current one with room left, blocks are only added at the end
+  while (current_ < blocks_.size() && offset_ + size > blocks_[current_].size) {
+    current_++;
+    offset_ = 0;
+  }
+
+  if (current_ == blocks_.size()) {
+    // each new block at least doubles the capacity, so a growing frame takes few of them
+    size_t capacity = 0;
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      capacity += blocks_[i].size;
+    }
+    Block block;
+    block.size = std::max(size, std::max(block_bytes_, capacity));
+    void *data = NULL;
+    if (posix_memalign(&data, kArenaAlignment, block.size) != 0) {
+      throw std::bad_alloc();
+    }
+    block.data = static_cast<char*>(data);
+    blocks_.push_back(block);
+    frame_stats_.heap_allocations++;
+  }
+
+  void *p = blocks_[current_].data + offset_;
+  offset_ += size;
+  frame_stats_.allocations++;
+  frame_stats_.bytes += bytes;
+  return p;
+}
+
+cv::Mat FrameArena::AllocateMat(const int rows, const int cols, const int type) {
+  return cv::Mat(rows, cols, type, Allocate((size_t)rows * cols * CV_ELEM_SIZE(type)));
+}
+
+FrameArena::Mark FrameArena::GetMark() const {
+  Mark mark;
+  mark.block = current_;
+  mark.offset = offset_;
+  return mark;
+}
+
+void FrameArena::Rewind(const Mark &mark) {
+  current_ = mark.block;
+  offset_ = mark.offset;
+}
+
+void FrameArena::Reset() {
+  current_ = 0;
+  offset_ = 0;
+  last_frame_stats_ = frame_stats_;
+  frame_stats_ = FrameArenaStats();
+}
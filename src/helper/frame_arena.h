@@ -0,0 +1,77 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <vector>
+#include <stddef.h>
+
+#include <opencv2/core/core.hpp>
+
+// What a FrameArena handed out during one frame
+struct FrameArenaStats {
+  FrameArenaStats() : allocations(0), bytes(0), heap_allocations(0) { }
+
+  // arrays and Mats handed out
+  int allocations;
+  size_t bytes;
+
+  // blocks taken from the heap because the arena was full, 0 once it has grown to the frame's needs
+  int heap_allocations;
+};
+
+// Bump allocator for the scratch memory of one frame of tracking. Memory is handed out from large blocks and
+// given back all at once by Reset at the end of the frame; the blocks are kept, so after the first frames
+// the tracking loop does not touch the heap for its temporaries. Nothing handed out is constructed or
+// destructed, it is for arrays of plain types and cv::Mat data.
+class FrameArena
+{
+public:
+  // Position in the arena, memory handed out after it is given back by Rewind
+  struct Mark {
+    size_t block;
+    size_t offset;
+  };
+
+  explicit FrameArena(const size_t block_bytes = 4 << 20);
+  ~FrameArena();
+
+  // bytes aligned for SIMD loads, valid until Reset or a Rewind before them
+  void* Allocate(const size_t bytes);
+
+  template <typename T>
+  T* Allocate(const size_t n) { return static_cast<T*>(Allocate(n * sizeof(T))); }
+
+  // rows x cols of type in arena memory, not reference counted, so it must not outlive the frame
+  cv::Mat AllocateMat(const int rows, const int cols, const int type);
+
+  Mark GetMark() const;
+  void Rewind(const Mark &mark);
+
+  // End of frame: give everything back and start counting the next frame
+  void Reset();
+
+  // Counters of the frame in progress and of the last frame Reset
+  const FrameArenaStats& frame_stats() const { return frame_stats_; }
+  const FrameArenaStats& last_frame_stats() const { return last_frame_stats_; }
+
+private:
+  // no copies, the blocks are owned
+  FrameArena(const FrameArena&);
+  FrameArena& operator=(const FrameArena&);
+
+  struct Block {
+    char *data;
+    size_t size;
+  };
+
+  std::vector<Block> blocks_;
+  size_t block_bytes_;
+
+  // block handed out from and first free byte in it
+  size_t current_;
+  size_t offset_;
+
+  FrameArenaStats frame_stats_;
+  FrameArenaStats last_frame_stats_;
+};
+
+#endif // FRAME_ARENA_H
@@ -0,0 +1,106 @@
+#include "head_cascade.h"
+
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+int HeadCascade::CoarseDim(const int channels, const int height, const int width, const int cell) {
+  return channels * ((height + cell - 1) / cell) * ((width + cell - 1) / cell);
+}
+
+void HeadCascade::CoarsenWeights(const float *weight, const int ld, const int num_output, const int channels,
+                                 const int height, const int width, const int cell, float *coarse) {
+  const int coarse_height = (height + cell - 1) / cell;
+  const int coarse_width = (width + cell - 1) / cell;
+  const int coarse_dim = channels * coarse_height * coarse_width;
+
+  memset(coarse, 0, sizeof(float) * num_output * coarse_dim);
+  for (int o = 0; o < num_output; o++) {
+    const float *w = weight + o * ld;
+    float *c = coarse + o * coarse_dim;
+    for (int ch = 0; ch < channels; ch++) {
+      for (int y = 0; y < height; y++) {
+        float *c_row = c + (ch * coarse_height + y / cell) * coarse_width;
+        for (int x = 0; x < width; x++) {
+          c_row[x / cell] += *w++;
+        }
+      }
+    }
+  }
+}
+
+void HeadCascade::CoarsenFeatures(const float *features, const int num_rows, const int channels,
+                                  const int height, const int width, const int cell, float *coarse) {
+  const int coarse_height = (height + cell - 1) / cell;
+  const int coarse_width = (width + cell - 1) / cell;
+  const int coarse_dim = channels * coarse_height * coarse_width;
+
+  memset(coarse, 0, sizeof(float) * num_rows * coarse_dim);
+  for (int i = 0; i < num_rows; i++) {
+    const float *f = features + i * channels * height * width;
+    float *c = coarse + i * coarse_dim;
+    for (int ch = 0; ch < channels; ch++) {
+      for (int y = 0; y < height; y++) {
+        float *c_row = c + (ch * coarse_height + y / cell) * coarse_width;
+        for (int x = 0; x < width; x++) {
+          c_row[x / cell] += *f++;
+        }
+      }
+
+      // sums to means, blocks at the right and bottom border may be partial
+      float *c_map = c + ch * coarse_height * coarse_width;
+      for (int cy = 0; cy < coarse_height; cy++) {
+        const int block_height = std::min(cell, height - cy * cell);
+        for (int cx = 0; cx < coarse_width; cx++) {
+          const int block_width = std::min(cell, width - cx * cell);
+          c_map[cy * coarse_width + cx] /= block_height * block_width;
+        }
+      }
+    }
+  }
+}
+
+int HeadCascade::NumSurvivors(const float *sorted_scores, const int num, const int top, const double margin,
+                              const int min_survivors, const int max_survivors) {
+  if (num == 0) {
+    return 0;
+  }
+  const float threshold = sorted_scores[std::min(top, num) - 1] - margin;
+  int survivors = 0;
+  while (survivors < num && sorted_scores[survivors] >= threshold) {
+    survivors++;
+  }
+  survivors = std::max(min_survivors, std::min(max_survivors, survivors));
+  return std::min(survivors, num);
+}
+
+void HeadCascade::CapRejected(const int *order, const int num, const int num_survivors, const float *rank_weights,
+                              float *probabilities) {
+  if (num_survivors == 0) {
+    return;
+  }
+  float min_survivor_score = probabilities[2 * order[0] + 1] * (rank_weights != NULL ? rank_weights[order[0]] : 1.0f);
+  for (int j = 1; j < num_survivors; j++) {
+    const int i = order[j];
+    min_survivor_score = std::min(min_survivor_score,
+                                  probabilities[2 * i + 1] * (rank_weights != NULL ? rank_weights[i] : 1.0f));
+  }
+
+  for (int j = num_survivors; j < num; j++) {
+    const int i = order[j];
+    const float rank_weight = rank_weights != NULL ? rank_weights[i] : 1.0f;
+    if (probabilities[2 * i + 1] * rank_weight < min_survivor_score) {
+      continue;
+    }
+    float capped = 0.0f;
+    if (rank_weight > 0) {
+      // the division rounds, so step down until the product PredictFast ranks by is below too
+      capped = std::nextafter(min_survivor_score, 0.0f) / rank_weight;
+      while (capped > 0 && capped * rank_weight >= min_survivor_score) {
+        capped = std::nextafter(capped, 0.0f);
+      }
+    }
+    probabilities[2 * i + 1] = capped;
+    probabilities[2 * i] = 1.0f - capped;
+  }
+}
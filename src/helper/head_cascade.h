@@ -0,0 +1,36 @@
+#ifndef HEAD_CASCADE_H
+#define HEAD_CASCADE_H
+
+// Kernels of the two stage candidate scoring of Regressor::PredictFast (CASCADE_SCORING). The first fc layer is
+// approximated on a coarser ROI grid: every channel map of pool6_c is averaged over cell x cell blocks and the
+// matching weights are summed over the same blocks, so the coarse product equals the exact one wherever the
+// features are constant inside a block, at 1 / cell^2 of its multiply-adds.
+class HeadCascade
+{
+public:
+  // Length of a coarse feature row of channels maps of height x width, partial blocks at the border included
+  static int CoarseDim(const int channels, const int height, const int width, const int cell);
+
+  // weight holds num_output rows of ld floats, the candidate part of each starting at its first float, laid out
+  // as pool6_c (channel, y, x). coarse gets num_output rows of CoarseDim floats, the sums over every block.
+  static void CoarsenWeights(const float *weight, const int ld, const int num_output, const int channels,
+                             const int height, const int width, const int cell, float *coarse);
+
+  // num_rows rows of pool6_c features into num_rows rows of CoarseDim floats, the means over every block
+  static void CoarsenFeatures(const float *features, const int num_rows, const int channels,
+                              const int height, const int width, const int cell, float *coarse);
+
+  // How many of the num scores, sorted from the highest, go through the exact head: those within margin of the
+  // top-th highest, so that the exact ranking of the top candidates is unlikely to differ from the coarse one,
+  // then bounded to [min_survivors, max_survivors] and to num
+  static int NumSurvivors(const float *sorted_scores, const int num, const int top, const double margin,
+                          const int min_survivors, const int max_survivors);
+
+  // probabilities holds num softmax pairs, order the rois from the highest coarse score, the first num_survivors of
+  // them scored exactly. Lowers the positive probability of every other roi so that its score, times rank_weights
+  // (1 if NULL), is strictly below the lowest survivor's: a tie would let a coarse score pick the estimate.
+  static void CapRejected(const int *order, const int num, const int num_survivors, const float *rank_weights,
+                          float *probabilities);
+};
+
+#endif // HEAD_CASCADE_H
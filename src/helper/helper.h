@@ -19,6 +19,8 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
+#include "rng_stream.h"
+
 // Convenience helper functions.
 
 // *******Number / string conversions*************
@@ -56,14 +58,14 @@ void find_matching_files(const boost::filesystem::path& folder, const boost::reg
                          std::vector<std::string>* files);
 
 // *******Probability*************
-// Generate a random number in (0,1)
-double sample_rand_uniform();
+// Generate a random number in (0,1) from rng
+double sample_rand_uniform(RngStream *rng);
 
 // Sample from an exponential distribution.
-double sample_exp(const double lambda);
+double sample_exp(const double lambda, RngStream *rng);
 
 // Sample from a Laplacian distribution, aka two-sided exponential.
-double sample_exp_two_sided(const double lambda);
+double sample_exp_two_sided(const double lambda, RngStream *rng);
 
 // Comparison function
 bool equalMat(cv::Mat &mat1, cv::Mat &mat2);
@@ -49,14 +49,35 @@ void ComputeCropPadImageLocation(const BoundingBox& bbox_tight, const cv::Mat& i
   pad_image_location->y2_ = roi_bottom + roi_height;
 }
 
-void CropPadImage(const BoundingBox& bbox_tight, const cv::Mat& image, cv::Mat* pad_image) {
-  BoundingBox pad_image_location;
-  double edge_spacing_x, edge_spacing_y;
-  CropPadImage(bbox_tight, image, pad_image, &pad_image_location, &edge_spacing_x, &edge_spacing_y);
+cv::Mat CropBuffer::Get(const int rows, const int cols, const int type) {
+  if (storage_.type() != type || storage_.rows < rows || storage_.cols < cols) {
+    // views handed out before keep the old storage alive
+    const bool same_type = storage_.type() == type;
+    storage_.create(same_type ? std::max(rows, storage_.rows) : rows, same_type ? std::max(cols, storage_.cols) : cols, type);
+  }
+  return storage_(cv::Rect(0, 0, cols, rows));
 }
 
-void CropPadImage(const BoundingBox& bbox_tight, const cv::Mat& image, cv::Mat* pad_image,
-                  BoundingBox* pad_image_location, double* edge_spacing_x, double* edge_spacing_y) {
+namespace {
+
+// Zero output outside inside
+void ZeroOutside(const cv::Rect& inside, cv::Mat* output) {
+  const int right = inside.x + inside.width;
+  const int bottom = inside.y + inside.height;
+  const cv::Rect strips[4] = {cv::Rect(0, 0, output->cols, inside.y),
+                              cv::Rect(0, bottom, output->cols, output->rows - bottom),
+                              cv::Rect(0, inside.y, inside.x, inside.height),
+                              cv::Rect(right, inside.y, output->cols - right, inside.height)};
+  for (int i = 0; i < 4; i++) {
+    if (strips[i].area() > 0) {
+      (*output)(strips[i]).setTo(cv::Scalar::all(0));
+    }
+  }
+}
+
+// With buffer NULL the output is a new image, as CropPadImage always did
+void CropPadImageInto(const BoundingBox& bbox_tight, const cv::Mat& image, CropBuffer* buffer, cv::Mat* pad_image,
+                      BoundingBox* pad_image_location, double* edge_spacing_x, double* edge_spacing_y) {
   // input: bbox_tight, image
   // output: pad_image, pad_image_location, edge_spacing_x, edge_spacing_y
 
@@ -78,32 +99,62 @@ void CropPadImage(const BoundingBox& bbox_tight, const cv::Mat& image, cv::Mat*
   // Now we need to place the crop in a new image of the appropriate size,
   // adding a black border where necessary to account for edge effects.
 
-  // Make a new image to store the output.
   // The new image should have size: get_output_width(), get_output_height(), but
   // to be safe we ensure that the output is not smaller than roi_width, roi_height.
   const double output_width = std::max(ceil(bbox_tight.compute_output_width()), roi_width);
   const double output_height = std::max(ceil(bbox_tight.compute_output_height()), roi_height);
-  cv::Mat output_image = cv::Mat(output_height, output_width, image.type(), cv::Scalar(0, 0, 0));
+  const cv::Size output_size(output_width, output_height);
 
   // Compute the location to place the crop so that it will be centered at the
   // center of the bounding box (accounting for edge effects).
 
   // Get the amount that the output "sticks out" beyond the left and bottom edges of the image.
   // This might be 0, but it might be > 0 if the output is near the edge of the image.
-  *edge_spacing_x = std::min(bbox_tight.edge_spacing_x(), static_cast<double>(output_image.cols - 1));
-  *edge_spacing_y = std::min(bbox_tight.edge_spacing_y(), static_cast<double>(output_image.rows - 1));
+  *edge_spacing_x = std::min(bbox_tight.edge_spacing_x(), static_cast<double>(output_size.width - 1));
+  *edge_spacing_y = std::min(bbox_tight.edge_spacing_y(), static_cast<double>(output_size.height - 1));
 
   // Get the location within the output to put the cropped image (accounting for edge effects).
   cv::Rect output_rect(*edge_spacing_x, *edge_spacing_y, roi_width, roi_height);
-  cv::Mat output_image_roi = output_image(output_rect);
+
+  // Without edge effects the crop is the output, no copy needed
+  if (buffer != NULL && output_rect == cv::Rect(cv::Point(0, 0), output_size)) {
+    *pad_image = cropped_image;
+    return;
+  }
+
+  // Make the output image, black only where the crop does not cover it.
+  cv::Mat output_image = buffer != NULL ? buffer->Get(output_size.height, output_size.width, image.type())
+                                        : cv::Mat(output_size, image.type());
+  ZeroOutside(output_rect, &output_image);
 
   // Copy the cropped image to the specified location within the output.
-  // Without edge effects, this will fill the output.
-  // With edge effects, this will comprise a subset of the output, with black
-  // being placed around the crop to account for edge effects.
+  cv::Mat output_image_roi = output_image(output_rect);
   cropped_image.copyTo(output_image_roi);
 
   // Set the output.
   *pad_image = output_image;
 }
 
+} // namespace
+
+void CropPadImage(const BoundingBox& bbox_tight, const cv::Mat& image, cv::Mat* pad_image) {
+  BoundingBox pad_image_location;
+  double edge_spacing_x, edge_spacing_y;
+  CropPadImage(bbox_tight, image, pad_image, &pad_image_location, &edge_spacing_x, &edge_spacing_y);
+}
+
+void CropPadImage(const BoundingBox& bbox_tight, const cv::Mat& image, cv::Mat* pad_image,
+                  BoundingBox* pad_image_location, double* edge_spacing_x, double* edge_spacing_y) {
+  CropPadImageInto(bbox_tight, image, NULL, pad_image, pad_image_location, edge_spacing_x, edge_spacing_y);
+}
+
+void CropPadImage(const BoundingBox& bbox_tight, const cv::Mat& image, CropBuffer* buffer, cv::Mat* pad_image) {
+  BoundingBox pad_image_location;
+  double edge_spacing_x, edge_spacing_y;
+  CropPadImage(bbox_tight, image, buffer, pad_image, &pad_image_location, &edge_spacing_x, &edge_spacing_y);
+}
+
+void CropPadImage(const BoundingBox& bbox_tight, const cv::Mat& image, CropBuffer* buffer, cv::Mat* pad_image,
+                  BoundingBox* pad_image_location, double* edge_spacing_x, double* edge_spacing_y) {
+  CropPadImageInto(bbox_tight, image, buffer, pad_image, pad_image_location, edge_spacing_x, edge_spacing_y);
+}
@@ -5,6 +5,20 @@
 
 // Functions to process images for tracking.
 
+// Storage reused by CropPadImage: crops go to the top left of storage_, which only grows, so that crops of
+// similar size do not allocate. A crop is valid until the next crop into the same buffer.
+class CropBuffer
+{
+public:
+  CropBuffer() { }
+
+  // rows x cols of the given type, uninitialized
+  cv::Mat Get(const int rows, const int cols, const int type);
+
+private:
+  cv::Mat storage_;
+};
+
 // Crop the image at the bounding box location, plus some additional padding.
 // To account for edge effects, we use a black background for space beyond the border
 // of the image.
@@ -12,6 +26,13 @@ void CropPadImage(const BoundingBox& bbox_tight, const cv::Mat& image, cv::Mat*
 void CropPadImage(const BoundingBox& bbox_tight, const cv::Mat& image, cv::Mat* pad_image,
                   BoundingBox* pad_image_location, double* edge_spacing_x, double* edge_spacing_y);
 
+// Same, without allocating: pad_image is a view into image when the padded crop lies inside it, otherwise it is
+// written to buffer, where only the strips outside the image are zeroed. pad_image must not be modified, and is
+// overwritten by the next crop into buffer. With buffer NULL, pad_image is a new image as above.
+void CropPadImage(const BoundingBox& bbox_tight, const cv::Mat& image, CropBuffer* buffer, cv::Mat* pad_image);
+void CropPadImage(const BoundingBox& bbox_tight, const cv::Mat& image, CropBuffer* buffer, cv::Mat* pad_image,
+                  BoundingBox* pad_image_location, double* edge_spacing_x, double* edge_spacing_y);
+
 // Compute the location of the cropped image, which is centered on the bounding box center
 // but has a size given by (output_width, output_height) to account for additional padding.
 // The cropped image location is also limited by the edge of the image.
@@ -0,0 +1,142 @@
+#include "input_preprocessor.h"
+
+#include <math.h>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Source position and weight of the second sample for destination index d, clamped to [0, size - 1] as in
+// cv::resize INTER_LINEAR
+void SourceCoordinate(const int d, const double inv_scale, const int size, int *s, float *alpha) {
+  const double f = (d + 0.5) * inv_scale - 0.5;
+  int s0 = (int)floor(f);
+  double a = f - s0;
+  if (s0 < 0) {
+    s0 = 0;
+    a = 0;
+  }
+  if (s0 >= size - 1) {
+    s0 = size - 1;
+    a = 0;
+  }
+  *s = s0;
+  *alpha = (float)a;
+}
+
+// out[i] = r0[i] * (1 - beta) + r1[i] * beta, for the n bytes of two source rows
+void BlendRows(const uchar *r0, const uchar *r1, const float beta, const int n, float *out) {
+  int i = 0;
+  if (beta == 0) {
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+      const __m128i v = _mm_loadu_si128((const __m128i*)(r0 + i));
+      const __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+      _mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+      _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+      _mm_storeu_ps(out + i + 8, _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+      _mm_storeu_ps(out + i + 12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+    }
+#endif
+    for (; i < n; i++) {
+      out[i] = r0[i];
+    }
+    return;
+  }
+
+  const float w0 = 1 - beta;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 vw0 = _mm_set1_ps(w0), vw1 = _mm_set1_ps(beta);
+  for (; i + 16 <= n; i += 16) {
+    const __m128i a = _mm_loadu_si128((const __m128i*)(r0 + i));
+    const __m128i b = _mm_loadu_si128((const __m128i*)(r1 + i));
+    const __m128i a_lo = _mm_unpacklo_epi8(a, zero), a_hi = _mm_unpackhi_epi8(a, zero);
+    const __m128i b_lo = _mm_unpacklo_epi8(b, zero), b_hi = _mm_unpackhi_epi8(b, zero);
+    const __m128i a16[4] = {_mm_unpacklo_epi16(a_lo, zero), _mm_unpackhi_epi16(a_lo, zero),
+                            _mm_unpacklo_epi16(a_hi, zero), _mm_unpackhi_epi16(a_hi, zero)};
+    const __m128i b16[4] = {_mm_unpacklo_epi16(b_lo, zero), _mm_unpackhi_epi16(b_lo, zero),
+                            _mm_unpacklo_epi16(b_hi, zero), _mm_unpackhi_epi16(b_hi, zero)};
+    for (int k = 0; k < 4; k++) {
+      _mm_storeu_ps(out + i + 4 * k, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(a16[k]), vw0),
+                                                _mm_mul_ps(_mm_cvtepi32_ps(b16[k]), vw1)));
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = r0[i] * w0 + r1[i] * beta;
+  }
+}
+
+} // namespace
+
+bool InputPreprocessor::Supports(const cv::Mat &src, const int num_channels) {
+  return src.depth() == CV_8U && num_channels == 3
+         && (src.channels() == 1 || src.channels() == 3 || src.channels() == 4);
+}
+
+cv::Size InputPreprocessor::ScaledSize(const cv::Size &src_size, const double scale) {
+  return cv::Size(cv::saturate_cast<int>(src_size.width * scale), cv::saturate_cast<int>(src_size.height * scale));
+}
+
+void InputPreprocessor::Run(const cv::Mat &src, const cv::Size &dst_size, const cv::Scalar &mean,
+                            float *dst, const int plane_step, const int row_step) {
+  Run(src, dst_size, (double)src.cols / dst_size.width, (double)src.rows / dst_size.height,
+      mean, dst, plane_step, row_step);
+}
+
+void InputPreprocessor::Run(const cv::Mat &src, const cv::Size &dst_size,
+                            const double inv_scale_x, const double inv_scale_y,
+                            const cv::Scalar &mean, float *dst, const int plane_step, const int row_step) {
+  CV_Assert(src.depth() == CV_8U && !src.empty());
+  const int cn = src.channels();
+  const int src_w = src.cols;
+  const int dst_w = dst_size.width;
+
+  // column tables, the same for every row
+  x_offset_.resize(dst_w);
+  x_alpha_.resize(dst_w);
+  for (int x = 0; x < dst_w; x++) {
+    int sx;
+    SourceCoordinate(x, inv_scale_x, src_w, &sx, &x_alpha_[x]);
+    x_offset_[x] = sx * cn;
+  }
+
+  // one zero pixel past the end, read with weight 0 by the last columns
+  row_.resize((src_w + 1) * cn);
+  std::fill(row_.begin() + src_w * cn, row_.end(), 0.0f);
+
+  // output channel c reads source channel c, gray is replicated
+  int src_channel[3];
+  float mean_channel[3];
+  for (int c = 0; c < 3; c++) {
+    src_channel[c] = cn == 1 ? 0 : c;
+    mean_channel[c] = (float)mean[c];
+  }
+
+  const int *x_offset = x_offset_.data();
+  const float *x_alpha = x_alpha_.data();
+  const float *row = row_.data();
+  for (int y = 0; y < dst_size.height; y++) {
+    int sy;
+    float beta;
+    SourceCoordinate(y, inv_scale_y, src.rows, &sy, &beta);
+    BlendRows(src.ptr<uchar>(sy), src.ptr<uchar>(std::min(sy + 1, src.rows - 1)), beta, src_w * cn, row_.data());
+
+    for (int c = 0; c < 3; c++) {
+      const float *row_c = row + src_channel[c];
+      const float m = mean_channel[c];
+      float *out = dst + c * plane_step + y * row_step;
+      for (int x = 0; x < dst_w; x++) {
+        const float a = x_alpha[x];
+        const float v0 = row_c[x_offset[x]];
+        const float v1 = row_c[x_offset[x] + cn];
+        out[x] = v0 + (v1 - v0) * a - m;
+      }
+    }
+  }
+}
@@ -0,0 +1,43 @@
+#ifndef INPUT_PREPROCESSOR_H
+#define INPUT_PREPROCESSOR_H
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+// Fills a network input from an 8 bit image in one pass: bilinear resize sampling (as cv::resize INTER_LINEAR),
+// uint8 to float, mean subtraction and HWC to CHW, written straight into the planes of the input blob. This
+// replaces cvtColor + resize + convertTo + subtract + split and their four full image temporaries; the only
+// buffers are the column tables and one float row, kept between calls.
+class InputPreprocessor
+{
+public:
+  InputPreprocessor() { }
+
+  // Whether Run handles src for a network with num_channels input channels: 8 bit images with 1, 3 or 4
+  // channels into 3 channels (gray is replicated, alpha dropped, as cvtColor does).
+  static bool Supports(const cv::Mat &src, const int num_channels);
+
+  // Sample src into a dst_size image, where destination pixel (x, y) is taken at source position
+  // ((x + 0.5) * inv_scale_x - 0.5, (y + 0.5) * inv_scale_y - 0.5), subtract mean and write channel c of row y to
+  // dst + c * plane_step + y * row_step.
+  void Run(const cv::Mat &src, const cv::Size &dst_size, const double inv_scale_x, const double inv_scale_y,
+           const cv::Scalar &mean, float *dst, const int plane_step, const int row_step);
+
+  // Same with the scales of a resize to dst_size, i.e. cv::resize(src, dst, dst_size)
+  void Run(const cv::Mat &src, const cv::Size &dst_size, const cv::Scalar &mean,
+           float *dst, const int plane_step, const int row_step);
+
+  // Size of cv::resize(src, dst, cv::Size(), scale, scale)
+  static cv::Size ScaledSize(const cv::Size &src_size, const double scale);
+
+private:
+  // Per destination column: first source column, times the number of channels, and weight of the second one
+  std::vector<int> x_offset_;
+  std::vector<float> x_alpha_;
+
+  // Source rows blended vertically, as float
+  std::vector<float> row_;
+};
+
+#endif // INPUT_PREPROCESSOR_H
@@ -0,0 +1,84 @@
+#include "rng_stream.h"
+
+// Philox4x32 constants, Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", SC 2011
+const uint32_t kPhiloxM0 = 0xD2511F53u;
+const uint32_t kPhiloxM1 = 0xCD9E8D57u;
+const uint32_t kPhiloxW0 = 0x9E3779B9u;
+const uint32_t kPhiloxW1 = 0xBB67AE85u;
+const int kPhiloxRounds = 10;
+
+// 2^-32
+const double kUniformScale = 1.0 / 4294967296.0;
+
+RngStream::RngStream(const uint64_t seed, const uint64_t stream) {
+  Seed(seed, stream);
+}
+
+void RngStream::Seed(const uint64_t seed, const uint64_t stream) {
+  key_[0] = (uint32_t)seed;
+  key_[1] = (uint32_t)(seed >> 32);
+  stream_ = stream;
+  counter_ = 0;
+  position_ = 4;
+}
+
+void RngStream::GenerateBlock() {
+  // the counter is (block index, stream)
+  uint32_t x0 = (uint32_t)counter_;
+  uint32_t x1 = (uint32_t)(counter_ >> 32);
+  uint32_t x2 = (uint32_t)stream_;
+  uint32_t x3 = (uint32_t)(stream_ >> 32);
+  uint32_t k0 = key_[0];
+  uint32_t k1 = key_[1];
+
+  for (int round = 0; round < kPhiloxRounds; round++) {
+    const uint64_t p0 = (uint64_t)kPhiloxM0 * x0;
+    const uint64_t p1 = (uint64_t)kPhiloxM1 * x2;
+    const uint32_t y0 = (uint32_t)(p1 >> 32) ^ x1 ^ k0;
+    const uint32_t y1 = (uint32_t)p1;
+    const uint32_t y2 = (uint32_t)(p0 >> 32) ^ x3 ^ k1;
+    const uint32_t y3 = (uint32_t)p0;
+    x0 = y0;
+    x1 = y1;
+    x2 = y2;
+    x3 = y3;
+    k0 += kPhiloxW0;
+    k1 += kPhiloxW1;
+  }
+
+  block_[0] = x0;
+  block_[1] = x1;
+  block_[2] = x2;
+  block_[3] = x3;
+  counter_++;
+  position_ = 0;
+}
+
+uint32_t RngStream::operator()() {
+  if (position_ == 4) {
+    GenerateBlock();
+  }
+  return block_[position_++];
+}
+
+double RngStream::Uniform() {
+  return (*this)() * kUniformScale;
+}
+
+void RngStream::FillUniform(const int n, float *out) {
+  // 24 bits per float, so that the result stays below 1
+  const float scale = 1.0f / 16777216.0f;
+  for (int i = 0; i < n; i++) {
+    out[i] = ((*this)() >> 8) * scale;
+  }
+}
+
+uint32_t RngStream::UniformInt(const uint32_t n) {
+  // rejection of the top partial range, so that every value is equally likely
+  const uint32_t limit = max() - max() % n;
+  uint32_t value;
+  do {
+    value = (*this)();
+  } while (value >= limit);
+  return value % n;
+}
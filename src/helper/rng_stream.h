@@ -0,0 +1,53 @@
+#ifndef RNG_STREAM_H
+#define RNG_STREAM_H
+
+#include <stdint.h>
+
+// Components drawing from the same seed use different streams, so that they never see the same numbers.
+enum RngStreamId {
+  RNG_STREAM_TRACKER = 1,
+  RNG_STREAM_EXAMPLE_GENERATOR = 2,
+  RNG_STREAM_TRAINER = 3
+};
+
+// Counter-based random numbers (Philox4x32-10): the n-th number of a stream is a function of (seed, stream, n) only.
+// Every tracker, example generator or worker owns its RngStream, so there is no shared state between threads,
+// and a run is reproduced exactly by giving its components the same seeds.
+class RngStream
+{
+public:
+  typedef uint32_t result_type;
+
+  explicit RngStream(const uint64_t seed = 0, const uint64_t stream = 0);
+
+  // Restart at the beginning of (seed, stream)
+  void Seed(const uint64_t seed, const uint64_t stream = 0);
+
+  // Uniformly distributed 32 bits, also makes RngStream usable with std::shuffle
+  uint32_t operator()();
+  static constexpr uint32_t min() { return 0; }
+  static constexpr uint32_t max() { return 0xFFFFFFFFu; }
+
+  // Uniform in [0, 1), with 32 bits of resolution
+  double Uniform();
+
+  // n uniforms in [0, 1), 4 per counter block
+  void FillUniform(const int n, float *out);
+
+  // Uniform integer in [0, n), n > 0
+  uint32_t UniformInt(const uint32_t n);
+
+private:
+  // Philox4x32-10 of counter_ under key_ into block_
+  void GenerateBlock();
+
+  uint32_t key_[2];
+  uint64_t stream_;
+  uint64_t counter_;
+
+  // outputs of the current block, position_ of them used
+  uint32_t block_[4];
+  int position_;
+};
+
+#endif // RNG_STREAM_H
@@ -0,0 +1,109 @@
+#include "frame_prefetcher.h"
+
+#include <assert.h>
+#include <algorithm>
+
+#include "helper/high_res_timer.h"
+
+FramePrefetcher::FramePrefetcher(const int depth, const int num_threads) :
+  slots_(std::max(depth, 1)),
+  video_(NULL),
+  end_frame_(0),
+  next_load_(0),
+  next_get_(0),
+  num_loading_(0),
+  stop_(false),
+  wait_ms_(0)
+{
+  for (int i = 0; i < std::max(num_threads, 1); i++) {
+    workers_.push_back(std::thread(&FramePrefetcher::WorkerLoop, this));
+  }
+}
+
+FramePrefetcher::~FramePrefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_load_.notify_all();
+  for (size_t i = 0; i < workers_.size(); i++) {
+    workers_[i].join();
+  }
+}
+
+void FramePrefetcher::Start(const Video* video, const int first_frame, const int end_frame) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  // loads of the previous video still running write into the slots, let them finish
+  cond_ready_.wait(lock, [this] { return num_loading_ == 0; });
+
+  for (size_t i = 0; i < slots_.size(); i++) {
+    slots_[i] = Slot();
+  }
+  video_ = video;
+  end_frame_ = end_frame;
+  next_load_ = first_frame;
+  next_get_ = first_frame;
+  wait_ms_ = 0;
+
+  cond_load_.notify_all();
+}
+
+bool FramePrefetcher::Get(const int frame_num, cv::Mat* image, BoundingBox* box) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  assert(video_ != NULL && frame_num == next_get_ && frame_num < end_frame_);
+
+  Slot &slot = slots_[frame_num % slots_.size()];
+  if (!(slot.frame_num == frame_num && slot.ready)) {
+    HighResTimer hrt("FramePrefetcher", CLOCK_MONOTONIC);
+    hrt.start();
+    cond_ready_.wait(lock, [&slot, frame_num] { return slot.frame_num == frame_num && slot.ready; });
+    hrt.stop();
+    wait_ms_ += hrt.getMilliseconds();
+  }
+
+  // hand the decoded image over, the slot keeps no reference to it
+  *image = slot.image;
+  *box = slot.box;
+  const bool has_annotation = slot.has_annotation;
+  slot = Slot();
+  next_get_++;
+
+  // the slot is free for the frame depth ahead
+  cond_load_.notify_one();
+  return has_annotation;
+}
+
+void FramePrefetcher::WorkerLoop() {
+  const int depth = slots_.size();
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cond_load_.wait(lock, [this, depth] {
+      return stop_ || (video_ != NULL && next_load_ < end_frame_ && next_load_ < next_get_ + depth);
+    });
+    if (stop_) {
+      return;
+    }
+
+    const int frame_num = next_load_++;
+    const Video* video = video_;
+    Slot &slot = slots_[frame_num % depth];
+    slot.frame_num = frame_num;
+    slot.ready = false;
+    num_loading_++;
+
+    // decode outside of the lock, the other workers take the following frames meanwhile
+    lock.unlock();
+    cv::Mat image;
+    BoundingBox box;
+    const bool has_annotation = video->LoadFrame(frame_num, false, false, &image, &box);
+    lock.lock();
+
+    slot.image = image;
+    slot.box = box;
+    slot.has_annotation = has_annotation;
+    slot.ready = true;
+    num_loading_--;
+    cond_ready_.notify_all();
+  }
+}
@@ -0,0 +1,70 @@
+#ifndef FRAME_PREFETCHER_H
+#define FRAME_PREFETCHER_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "loader/video.h"
+
+// Bounded producer / consumer source of the frames of a video. Worker threads load and decode (Video::LoadFrame)
+// up to depth frames ahead of the one being tracked, so that imread runs alongside the network instead of
+// before it. Frames are handed out in order, Get blocks only when the next frame is not decoded yet.
+class FramePrefetcher
+{
+public:
+  FramePrefetcher(const int depth, const int num_threads);
+
+  // Stops the workers, frames not taken are dropped
+  ~FramePrefetcher();
+
+  // Start loading the frames [first_frame, end_frame) of video, after dropping those of the previous video.
+  // video must stay alive until the next Start or the destruction of the prefetcher.
+  void Start(const Video* video, const int first_frame, const int end_frame);
+
+  // The next frame in order, which must be frame_num, as Video::LoadFrame without drawing the annotation
+  bool Get(const int frame_num, cv::Mat* image, BoundingBox* box);
+
+  // Milliseconds Get spent waiting for a frame since the last Start, i.e. loading left on the critical path
+  double wait_ms() const { return wait_ms_; }
+
+private:
+  // no copies, the workers point to this
+  FramePrefetcher(const FramePrefetcher&);
+  FramePrefetcher& operator=(const FramePrefetcher&);
+
+  struct Slot {
+    Slot(): frame_num(-1), ready(false), has_annotation(false) { }
+    int frame_num;
+    bool ready;
+    cv::Mat image;
+    BoundingBox box;
+    bool has_annotation;
+  };
+
+  void WorkerLoop();
+
+  // frame f goes to slots_[f % depth]
+  std::vector<Slot> slots_;
+
+  const Video* video_;
+  int end_frame_;
+
+  // next frame a worker will load, next frame Get will hand out
+  int next_load_;
+  int next_get_;
+
+  // loads running outside of the lock
+  int num_loading_;
+  bool stop_;
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable cond_load_;
+  std::condition_variable cond_ready_;
+
+  double wait_ms_;
+};
+
+#endif // FRAME_PREFETCHER_H
@@ -2,13 +2,16 @@
 #include "math.h"
 
 #include "helper/high_res_timer.h"
+#include "helper/head_cascade.h"
 #include <algorithm>
+#include <caffe/util/math_functions.hpp>
 
 // Credits:
 // This file was mostly taken from:
 // https://github.com/BVLC/caffe/tree/master/examples/cpp_classification
 
 using caffe::Blob;
+using caffe::Caffe;
 using caffe::Net;
 using caffe::Layer;
 using caffe::LayerParameter;
@@ -30,6 +33,18 @@ using namespace std;
 // We need 2 inputs: one for the current frame and one for the previous frame.
 const int kNumInputs = 2;
 
+#ifdef ADAPTIVE_INPUT_SCALE
+const bool kAdaptiveInputScale = true;
+#else
+const bool kAdaptiveInputScale = false;
+#endif
+
+#ifdef CASCADE_SCORING
+const bool kCascadeScoring = true;
+#else
+const bool kCascadeScoring = false;
+#endif
+
 Regressor::Regressor(const string& deploy_proto,
                      const string& caffe_model,
                      const int gpu_id,
@@ -41,8 +56,16 @@ Regressor::Regressor(const string& deploy_proto,
     caffe_model_(caffe_model),
     modified_params_(false),
     K_(K),
-    hrt_("Regressor")
-
+    hrt_("Regressor"),
+    head_roi_assign_rois_(-1),
+    head_roi_assign_targets_(-1),
+    current_frame_id_(-1),
+    conv_cache_generation_(0),
+    target_size_hint_(0),
+    adaptive_input_scale_(kAdaptiveInputScale),
+    cascade_scoring_(kCascadeScoring),
+    frame_arena_own_(1 << 20),
+    frame_arena_(&frame_arena_own_)
 {
   SetupNetwork(deploy_proto, caffe_model, gpu_id, do_train);
 }
@@ -57,8 +80,16 @@ Regressor::Regressor(const string& deploy_proto,
     caffe_model_(caffe_model),
     modified_params_(false),
     K_(-1),
-    hrt_("Regressor")
-
+    hrt_("Regressor"),
+    head_roi_assign_rois_(-1),
+    head_roi_assign_targets_(-1),
+    current_frame_id_(-1),
+    conv_cache_generation_(0),
+    target_size_hint_(0),
+    adaptive_input_scale_(kAdaptiveInputScale),
+    cascade_scoring_(kCascadeScoring),
+    frame_arena_own_(1 << 20),
+    frame_arena_(&frame_arena_own_)
 {
   SetupNetwork(deploy_proto, caffe_model, gpu_id, do_train);
 }
@@ -72,7 +103,16 @@ Regressor::Regressor(const string& deploy_proto,
     caffe_model_(caffe_model),
     modified_params_(false),
     K_(-1),
-    hrt_("Regressor")
+    hrt_("Regressor"),
+    head_roi_assign_rois_(-1),
+    head_roi_assign_targets_(-1),
+    current_frame_id_(-1),
+    conv_cache_generation_(0),
+    target_size_hint_(0),
+    adaptive_input_scale_(kAdaptiveInputScale),
+    cascade_scoring_(kCascadeScoring),
+    frame_arena_own_(1 << 20),
+    frame_arena_(&frame_arena_own_)
 {
   SetupNetwork(deploy_proto, caffe_model, gpu_id, do_train);
 }
@@ -89,6 +129,10 @@ void Regressor::SetupNetwork(const string& deploy_proto,
   caffe::Caffe::SetDevice(gpu_id);
   caffe::Caffe::set_mode(caffe::Caffe::GPU);
 #endif
+#ifdef REPRODUCIBLE_RNG
+  // after the device is picked, the GPU generator is created for it
+  caffe::Caffe::set_random_seed(SEED_RNG_CAFFE);
+#endif
 
   if (do_train) {
     printf("Setting phase to train\n");
@@ -119,6 +163,10 @@ void Regressor::SetupNetwork(const string& deploy_proto,
   // Load the binaryproto mean file.
   SetMean();
 
+  BuildExecutionPlan();
+
+  SnapshotParams();
+
   if (do_train && K_ != -1) {
     // Only if training and model has K domains, Lock the domain specific layers, will be opened each time during training
     LockDomainLayers();
@@ -133,16 +181,49 @@ void Regressor::SetMean() {
 void Regressor::Init() {
   if (modified_params_ ) {
     printf("Reloading new params\n");
-    net_->CopyTrainedLayersFrom(caffe_model_);
+    RestoreParams();
     modified_params_ = false;
   }
 }
 
 void Regressor::Reset() {
-  net_.reset(); // decrease reference count
-  net_.reset(new Net<float>(deploy_proto_, caffe::TRAIN));
-  printf("In Regressor, Reset net_\n");
-  net_->CopyTrainedLayersFrom(caffe_model_);
+  // net_ is kept, only its weights go back to the ones loaded from caffe_model_
+  printf("In Regressor, Reset net_ params\n");
+  RestoreParams();
+  InvalidateConvCache();
+}
+
+void Regressor::InvalidateConvCache() {
+  conv_cache_frames_.clear();
+  conv_cache_frame_ids_.clear();
+  conv_cache_scales_.clear();
+  conv_cache_regions_.clear();
+}
+
+void Regressor::SnapshotParams() {
+  const vector<Blob<float>* > & params = net_->learnable_params();
+  int total_count = 0;
+  for (int i = 0; i < params.size(); i++) {
+    total_count += params[i]->count();
+  }
+
+  pristine_params_.resize(total_count);
+  float* dst = pristine_params_.data();
+  for (int i = 0; i < params.size(); i++) {
+    caffe::caffe_copy(params[i]->count(), params[i]->cpu_data(), dst);
+    dst += params[i]->count();
+  }
+}
+
+void Regressor::RestoreParams() {
+  const vector<Blob<float>* > & params = net_->learnable_params();
+  const float* src = pristine_params_.data();
+  for (int i = 0; i < params.size(); i++) {
+    caffe::caffe_copy(params[i]->count(), src, params[i]->mutable_cpu_data());
+    caffe::caffe_set(params[i]->count(), 0.0f, params[i]->mutable_cpu_diff());
+    src += params[i]->count();
+  }
+  CHECK_EQ(src - pristine_params_.data(), pristine_params_.size());
 }
 
 void Regressor::LockDomainLayers() {
@@ -186,25 +267,44 @@ void Regressor::PreForwardFast(const cv::Mat image_curr,
                                const std::vector<BoundingBox> &candidate_bboxes,
                                const cv::Mat & image,
                                const cv::Mat & target) {
-  
-  const vector<string> & layer_names = net_->layer_names();
-  
-  Blob<float>* input_target = net_->input_blobs()[TARGET_NETWORK_INPUT_IDX];
-  input_target->Reshape(1, num_channels_,
-                       input_geometry_.height, input_geometry_.width);
+  pooled_begin_.clear();
+  PreForwardFast(image_curr, candidate_bboxes, &target, 1);
+}
+
+void Regressor::PreForwardFast(const cv::Mat image_curr, 
+                               const std::vector<BoundingBox> &candidate_bboxes,
+                               const cv::Mat* targets,
+                               const int num_targets) {
+#ifdef LOG_TIME
+  // accumulates only the non-forward work
+  HighResTimer hrt_setup("PreForwardFast setup");
+  hrt_setup.start();
+#endif
+
+  const int num_rois = candidate_bboxes.size();
+
+  CHECK(num_targets == 1 || head_roi_target_.size() == num_rois) << "rois of several targets need head_roi_target_";
+  plan_.target_shape[0] = num_targets;
+  ReshapeInputIfNeeded(plan_.input_target, plan_.target_shape);
   // Process the inputs so we can set them.
-  std::vector<cv::Mat> target_channels;
-  WrapInputLayerGivenIndex(&target_channels, TARGET_NETWORK_INPUT_IDX);
-  // Set the t-1 target
-  Preprocess(target, &target_channels);
+  // Set the t-1 targets
+  for (int t = 0; t < num_targets; t++) {
+    PreprocessInput(targets[t], input_geometry_, TARGET_NETWORK_INPUT_IDX, t);
+  }
 
-  int layer_conv1_idx = FindLayerIndexByName(layer_names, "conv1");
-  int layer_pool6_idx = FindLayerIndexByName(layer_names, "pool6");
+#ifdef LOG_TIME
+  hrt_setup.stop();
+#endif
 
   // Perform a forward-pass in the network.
-  net_->ForwardFromTo(layer_conv1_idx, layer_pool6_idx);
-  std::vector<cv::Mat> pool6_image;
-  WrapOutputBlob("pool6", &pool6_image);
+  net_->ForwardFromTo(plan_.conv1_idx, plan_.pool6_idx);
+#ifndef BROADCAST_TARGET_FEATURE
+  // keep pool6 of the targets until it is duplicated below, the target branch is reshaped to one row per roi
+  const FrameArena::Mark arena_mark = frame_arena_->GetMark();
+  const int dim_target = plan_.pool6->count(1);
+  float *pool6_target = frame_arena_->Allocate<float>(num_targets * dim_target);
+  caffe::caffe_copy(num_targets * dim_target, plan_.pool6->cpu_data(), pool6_target);
+#endif
 
 #ifdef INSPECT_TARGET_IN_PREFORWARD
   vector<cv::Mat> target_splitted;
@@ -217,68 +317,97 @@ void Regressor::PreForwardFast(const cv::Mat image_curr,
   waitKey(1);
 #endif
 
+#ifdef LOG_TIME
+  hrt_setup.start();
+#endif
+
   //------------------------- Now Forward the ROIs -------------------
+#ifndef BROADCAST_TARGET_FEATURE
   // Reshape target input
-  input_target->Reshape(candidate_bboxes.size(), num_channels_,
-                       input_geometry_.height, input_geometry_.width);
+  plan_.target_shape[0] = num_rois;
+  ReshapeInputIfNeeded(plan_.input_target, plan_.target_shape);
+#endif
   
   // Process the candidate, full image's input, i.e., image_curr, just one! Also record the scales
-  int im_min_size = std::min(image_curr.size().width, image_curr.size().height);
-  int im_max_size = std::max(image_curr.size().width, image_curr.size().height);
-
-  double scale_curr = TARGET_SIZE / im_min_size;
-  if (round(scale_curr * im_max_size) > MAX_SIZE) {
-    scale_curr = MAX_SIZE / im_max_size;
+  double scale_curr = GetImageScale(image_curr);
+
+  // part of image_curr the candidate branch runs over, the whole frame unless SEARCH_REGION_BACKBONE
+  cv::Rect region = GetBackboneRegion(image_curr, candidate_bboxes, scale_curr);
+
+  // The backbone weights are frozen during fine-tuning, so the conv map of a frame only depends on the frame,
+  // the scale and the region: scoring, sample generation, fine-tuning and bbox regression on the same frame share 
+  // one pass, as long as the cached region covers the candidates. The frame is told by its id (SetFrameId), not
+  // by its buffer which the caller may have refilled with another frame.
+  int conv_cache_batch_id = -1;
+  for (int f = 0; f < conv_cache_frames_.size() && conv_cache_batch_id < 0 && current_frame_id_ >= 0; f++) {
+    const cv::Mat &cached = conv_cache_frames_[f];
+    if (current_frame_id_ == conv_cache_frame_ids_[f]
+        && image_curr.data == cached.data
+        && image_curr.size() == cached.size()
+        && image_curr.type() == cached.type()
+        && image_curr.step[0] == cached.step[0]
+        && scale_curr == conv_cache_scales_[f]
+        && (region & conv_cache_regions_[f]) == region) {
+      conv_cache_batch_id = f;
+    }
+  }
+  const bool conv_cache_hit = conv_cache_batch_id >= 0;
+  if (conv_cache_hit) {
+    region = conv_cache_regions_[conv_cache_batch_id];
   }
 
-  cv::Mat image_scaled;
-  cv::resize(image_curr, image_scaled, cv::Size(), scale_curr, scale_curr);
-
+  // size of the region once rescaled, it is sampled straight into the candidate input
+  const cv::Size size_scaled = InputPreprocessor::ScaledSize(region.size(), scale_curr);
+  if (!conv_cache_hit) {
 #ifdef DEBUG_PRE_FORWARDFAST_IMAGE_SCALE 
-  cout << "scale_curr:" << scale_curr << endl;
-  cv::imshow("image_scaled:", image_scaled);
+    cout << "scale_curr:" << scale_curr << " size_scaled:" << size_scaled << endl;
 #endif
 
-  // Reshape Candidate input, full image's input, i.e., image_curr
-  Blob<float>* input_candidate = net_->input_blobs()[CANDIDATE_NETWORK_INPUT_IDX];
-  input_candidate->Reshape(1, num_channels_,
-                       image_scaled.size().height, image_scaled.size().width);
-
-  // Reshape the labels
-  Blob<float> * input_label_blob = net_->input_blobs()[LABEL_NETWORK_INPUT_IDX];
-  const size_t num_labels = candidate_bboxes.size();
-  // reshape to (|R|, 1)
-  vector<int> shape_label;
-  shape_label.push_back(num_labels);
-  shape_label.push_back(1);
-  input_label_blob->Reshape(shape_label);
-
-  // Reshape the rois
-  Blob<float> * input_rois_blob = net_->input_blobs()[ROIS_NETWORK_INPUT_IDX];
-  const size_t num_rois = candidate_bboxes.size();
-  // reshape to (|R|, 5)
-  vector<int> shape_rois;
-  shape_rois.push_back(num_rois);
-  shape_rois.push_back(5);
-  input_rois_blob->Reshape(shape_rois);
+    // Reshape Candidate input, full image's input, i.e., image_curr
+    plan_.candidate_shape[2] = size_scaled.height;
+    plan_.candidate_shape[3] = size_scaled.width;
+    ReshapeInputIfNeeded(plan_.input_candidate, plan_.candidate_shape);
+  }
 
-  // Forward dimension change to all layers.
+  // Reshape the labels to (|R|, 1)
+  plan_.label_shape[0] = num_rois;
+  ReshapeInputIfNeeded(plan_.input_label, plan_.label_shape);
+
+  // Reshape the rois to (|R|, 5)
+  plan_.rois_shape[0] = num_rois;
+  ReshapeInputIfNeeded(plan_.input_rois, plan_.rois_shape);
+
+#ifndef BROADCAST_TARGET_FEATURE
+  // Forward dimension change to all layers, always needed here since the target branch went through batch size 1
   net_->Reshape();
+#endif
+  // With BROADCAST_TARGET_FEATURE the target branch stays at batch size 1 while the candidate branch has |R| rois,
+  // which concat would reject in net_->Reshape(). Each layer reshapes itself in Forward anyway.
 
-  // Put image_curr
-  std::vector<cv::Mat> image_curr_channels;
-  WrapInputLayerGivenIndex(&image_curr_channels, CANDIDATE_NETWORK_INPUT_IDX);
+  if (!conv_cache_hit) {
+    // Put image_curr, resized on the fly
+    PreprocessInput(image_curr(region), size_scaled, 1.0 / scale_curr, 1.0 / scale_curr, CANDIDATE_NETWORK_INPUT_IDX, 0);
+  }
 
-  // Set the inputs to the network.
-  Preprocess(image_scaled, &image_curr_channels, true); // set retain the original image size
+  // Put the ROIs, relative to the region, on the conv map of this frame
+  set_rois(candidate_bboxes, scale_curr, conv_cache_hit ? conv_cache_batch_id : 0, region.x, region.y);
+
+#ifdef LOG_TIME
+  hrt_setup.stop();
+  cout << "time spent for PreForwardFast setup (excluding forward): " << hrt_setup.getMilliseconds() << " ms" << endl;
+#endif
 
-  // Put the ROIs
-  set_rois(candidate_bboxes, scale_curr);
+  if (!conv_cache_hit) {
+    net_->ForwardFromTo(plan_.conv1_c_idx, plan_.roi_pool_idx - 1);
+    conv_cache_frames_.assign(1, image_curr);
+    conv_cache_frame_ids_.assign(1, current_frame_id_);
+    conv_cache_scales_.assign(1, scale_curr);
+    conv_cache_regions_.assign(1, region);
+    conv_cache_generation_++;
+  }
 
   // ROI poolings
-  int layer_conv1_c_idx = FindLayerIndexByName(layer_names, "conv1_c");
-  int layer_pool6_c_idx = FindLayerIndexByName(layer_names, "pool6_c");
-  net_->ForwardFromTo(layer_conv1_c_idx, layer_pool6_c_idx);
+  net_->ForwardFromTo(plan_.roi_pool_idx, plan_.pool6_c_idx);
 
 #ifdef DEBUG_PRE_FORWARDFAST
   std::vector<std::vector<cv::Mat> > pool6_c_features;
@@ -300,12 +429,15 @@ void Regressor::PreForwardFast(const cv::Mat image_curr,
   }
 #endif
 
+#ifndef BROADCAST_TARGET_FEATURE
   // ------------------ Duplicate the pool5 features mannualy for candidate_bboxes.size() times -----------------
-  std::vector<std::vector<cv::Mat> > pool6_channels;
-
-  WrapBlobByNameBatch("pool6", &pool6_channels);
-
-  PreprocessDuplicateIn(pool6_image, &pool6_channels);
+  float *pool6_data = plan_.pool6->mutable_cpu_data();
+  for (int i = 0; i < num_rois; i++) {
+    const int t = num_targets == 1 ? 0 : head_roi_target_[i];
+    caffe::caffe_copy(dim_target, pool6_target + t * dim_target, pool6_data + i * dim_target);
+  }
+  frame_arena_->Rewind(arena_mark);
+#endif
 
 #ifdef INSPECT_TARGET_IN_PREFORWARD
   bool inspect_target_after_reshape = false;
@@ -323,20 +455,252 @@ void Regressor::PreForwardFast(const cv::Mat image_curr,
 
 }
 
+double Regressor::GetImageScale(const cv::Mat &image_curr) {
+  int im_min_size = std::min(image_curr.size().width, image_curr.size().height);
+  int im_max_size = std::max(image_curr.size().width, image_curr.size().height);
+
+  double scale_curr = TARGET_SIZE / im_min_size;
+  if (round(scale_curr * im_max_size) > MAX_SIZE) {
+    scale_curr = MAX_SIZE / im_max_size;
+  }
+
+  if (adaptive_input_scale_ && target_size_hint_ > 0) {
+    // bring the target to ADAPTIVE_TARGET_SIZE input pixels, i.e. a fixed number of conv5 cells for ROI pooling,
+    // quantized to quarter octaves so that the input shape only changes when the target size really does
+    double scale_adaptive = ADAPTIVE_TARGET_SIZE / target_size_hint_;
+    scale_adaptive = pow(2.0, round(log2(scale_adaptive) * 4) / 4);
+    scale_adaptive = std::max(scale_curr * ADAPTIVE_MIN_SCALE_RATIO,
+                              std::min(scale_curr * ADAPTIVE_MAX_SCALE_RATIO, scale_adaptive));
+    if (round(scale_adaptive * im_max_size) > ADAPTIVE_MAX_SIZE) {
+      scale_adaptive = ADAPTIVE_MAX_SIZE / im_max_size;
+    }
+    scale_curr = scale_adaptive;
+  }
+  return scale_curr;
+}
+
+void Regressor::SetFrameArena(FrameArena* arena) {
+  frame_arena_ = arena != NULL ? arena : &frame_arena_own_;
+}
+
+void Regressor::SetTargetSizeHint(const BoundingBox &bbox) {
+  target_size_hint_ = sqrt(std::max(bbox.compute_area(), 1.0));
+}
+
+cv::Rect Regressor::GetBackboneRegion(const cv::Mat &image_curr, const std::vector<BoundingBox> &candidate_bboxes,
+                                      const double scale) {
+  const cv::Rect full_frame(0, 0, image_curr.size().width, image_curr.size().height);
+#ifdef SEARCH_REGION_BACKBONE
+  if (candidate_bboxes.empty()) {
+    return full_frame;
+  }
+
+  double x1 = candidate_bboxes[0].x1_;
+  double y1 = candidate_bboxes[0].y1_;
+  double x2 = candidate_bboxes[0].x2_;
+  double y2 = candidate_bboxes[0].y2_;
+  for (int i = 1; i < candidate_bboxes.size(); i++) {
+    x1 = std::min(x1, candidate_bboxes[i].x1_);
+    y1 = std::min(y1, candidate_bboxes[i].y1_);
+    x2 = std::max(x2, candidate_bboxes[i].x2_);
+    y2 = std::max(y2, candidate_bboxes[i].y2_);
+  }
+
+  // keep some context around the candidates so that their conv features see the same neighbourhood as in the full frame
+  const double margin = SEARCH_REGION_MARGIN / scale;
+  const int region_x1 = (int)floor(x1 - margin);
+  const int region_y1 = (int)floor(y1 - margin);
+  const int region_x2 = (int)ceil(x2 + margin);
+  const int region_y2 = (int)ceil(y2 + margin);
+  cv::Rect region = cv::Rect(region_x1, region_y1, region_x2 - region_x1, region_y2 - region_y1) & full_frame;
+  if (region.area() == 0) {
+    return full_frame;
+  }
+  return region;
+#else
+  return full_frame;
+#endif
+}
+
+void Regressor::PreForwardFastBatch(const std::vector<cv::Mat> &image_currs,
+                                    const std::vector<std::vector<BoundingBox> > &candidate_bboxes,
+                                    const std::vector<cv::Mat> &targets) {
+  const int num_frames = image_currs.size();
+  assert(targets.size() == num_frames);
+  assert(candidate_bboxes.size() == num_frames);
+  pooled_begin_.clear();
+
+  // one target per frame
+  plan_.target_shape[0] = num_frames;
+  ReshapeInputIfNeeded(plan_.input_target, plan_.target_shape);
+  for (int f = 0; f < num_frames; f++) {
+    PreprocessInput(targets[f], input_geometry_, TARGET_NETWORK_INPUT_IDX, f);
+  }
+  net_->ForwardFromTo(plan_.conv1_idx, plan_.pool6_idx);
+
+  // every roi is tagged with its frame, both as the batch id for ROI pooling and as the target row in the head
+  int num_rois = 0;
+  for (int f = 0; f < num_frames; f++) {
+    num_rois += candidate_bboxes[f].size();
+  }
+  head_roi_target_.resize(num_rois);
+
+#ifndef BROADCAST_TARGET_FEATURE
+  // keep the per frame pool6 rows, the target branch is reshaped to one row per roi below
+  const Blob<float>* pool6 = plan_.pool6;
+  const int dim_target = pool6->count(1);
+  std::vector<float> pool6_frames(pool6->cpu_data(), pool6->cpu_data() + pool6->count());
+
+  plan_.target_shape[0] = num_rois;
+  ReshapeInputIfNeeded(plan_.input_target, plan_.target_shape);
+#endif
+
+  // frames rescaled as in PreForwardFast, stacked in the candidate input and padded to the largest one
+  std::vector<double> scales(num_frames);
+  for (int f = 0; f < num_frames; f++) {
+    scales[f] = GetImageScale(image_currs[f]);
+  }
+  SetCandidateFrames(image_currs, scales);
+
+  // the candidate branch no longer holds the conv map of a single frame
+  InvalidateConvCache();
+  conv_cache_generation_++;
+
+  plan_.label_shape[0] = num_rois;
+  ReshapeInputIfNeeded(plan_.input_label, plan_.label_shape);
+
+  plan_.rois_shape[0] = num_rois;
+  ReshapeInputIfNeeded(plan_.input_rois, plan_.rois_shape);
+  float* input_rois_data = plan_.input_rois->mutable_cpu_data();
+  int roi = 0;
+  for (int f = 0; f < num_frames; f++) {
+    for (int i = 0; i < candidate_bboxes[f].size(); i++) {
+      const BoundingBox& this_rois = candidate_bboxes[f][i];
+      input_rois_data[0] = f;
+      input_rois_data[1] = this_rois.x1_ * scales[f];
+      input_rois_data[2] = this_rois.y1_ * scales[f];
+      input_rois_data[3] = this_rois.x2_ * scales[f];
+      input_rois_data[4] = this_rois.y2_ * scales[f];
+      input_rois_data += 5;
+      head_roi_target_[roi++] = f;
+    }
+  }
+
+#ifndef BROADCAST_TARGET_FEATURE
+  net_->Reshape();
+#endif
+
+  net_->ForwardFromTo(plan_.conv1_c_idx, plan_.pool6_c_idx);
+
+#ifndef BROADCAST_TARGET_FEATURE
+  float* pool6_data = plan_.pool6->mutable_cpu_data();
+  for (int i = 0; i < num_rois; i++) {
+    caffe::caffe_copy(dim_target, pool6_frames.data() + head_roi_target_[i] * dim_target, pool6_data + i * dim_target);
+  }
+#endif
+}
+
+void Regressor::SetCandidateFrames(const std::vector<cv::Mat> &image_currs, const std::vector<double> &scales) {
+  const int num_frames = image_currs.size();
+  std::vector<cv::Size> sizes_scaled(num_frames);
+  int max_height = 0;
+  int max_width = 0;
+  for (int f = 0; f < num_frames; f++) {
+    sizes_scaled[f] = InputPreprocessor::ScaledSize(image_currs[f].size(), scales[f]);
+    max_height = std::max(max_height, sizes_scaled[f].height);
+    max_width = std::max(max_width, sizes_scaled[f].width);
+  }
+
+  plan_.candidate_shape[0] = num_frames;
+  plan_.candidate_shape[2] = max_height;
+  plan_.candidate_shape[3] = max_width;
+  ReshapeInputIfNeeded(plan_.input_candidate, plan_.candidate_shape);
+  plan_.candidate_shape[0] = 1;
+
+  // zero padding, i.e. the mean colour after mean subtraction
+  caffe::caffe_set(plan_.input_candidate->count(), 0.0f, plan_.input_candidate->mutable_cpu_data());
+  for (int f = 0; f < num_frames; f++) {
+    PreprocessInput(image_currs[f], sizes_scaled[f], 1.0 / scales[f], 1.0 / scales[f], CANDIDATE_NETWORK_INPUT_IDX, f);
+  }
+}
+
+void Regressor::ForwardBackboneBatch(const std::vector<cv::Mat> &image_currs, const std::vector<int64_t> &frame_ids,
+                                     const std::vector<BoundingBox> &size_hints) {
+  const int num_frames = image_currs.size();
+  CHECK_EQ(frame_ids.size(), num_frames);
+  CHECK_EQ(size_hints.size(), num_frames);
+
+  // the scale PreForwardFast will pick for each frame once its target's hint is set
+  const double size_hint = target_size_hint_;
+  std::vector<double> scales(num_frames);
+  for (int f = 0; f < num_frames; f++) {
+    SetTargetSizeHint(size_hints[f]);
+    scales[f] = GetImageScale(image_currs[f]);
+  }
+  target_size_hint_ = size_hint;
+
+  SetCandidateFrames(image_currs, scales);
+  net_->ForwardFromTo(plan_.conv1_c_idx, plan_.roi_pool_idx - 1);
+
+  // padding is only added right and below, so the rois of frame f keep their coordinates at batch index f
+  conv_cache_frames_ = image_currs;
+  conv_cache_frame_ids_ = frame_ids;
+  conv_cache_scales_ = scales;
+  conv_cache_generation_++;
+  conv_cache_regions_.resize(num_frames);
+  for (int f = 0; f < num_frames; f++) {
+    conv_cache_regions_[f] = cv::Rect(0, 0, image_currs[f].cols, image_currs[f].rows);
+  }
+}
+
 // Get the BBox Conv Features used for BoundingBox Regression
 void Regressor::GetBBoxConvFeatures(const cv::Mat& image_curr, const cv::Mat& image, const cv::Mat& target, 
-                       const std::vector<BoundingBox> &candidate_bboxes, std::vector <std::vector<float> > &features) {
+                       const std::vector<BoundingBox> &candidate_bboxes, float *features) {
     int batch_size = INNER_BATCH_SIZE;
     int num_batches = (int)(ceil(candidate_bboxes.size()/float(batch_size)));
+    vector<BoundingBox> this_candidates;
+    this_candidates.reserve(batch_size);
+    // the batches share the conv map of image_curr even if the caller did not say which frame it is
+    const int64_t frame_id = current_frame_id_;
+    if (frame_id < 0) {
+      SetFrameId(NewFrameId());
+    }
     for (int i = 0; i < num_batches; i++) {
-      vector<BoundingBox> this_candidates(candidate_bboxes.begin() + i * batch_size, 
-                                          candidate_bboxes.begin() + std::min((i+1) * batch_size, (int)(candidate_bboxes.size())));
+      this_candidates.assign(candidate_bboxes.begin() + i * batch_size, 
+                             candidate_bboxes.begin() + std::min((i+1) * batch_size, (int)(candidate_bboxes.size())));
       PreForwardFast(image_curr, this_candidates, image, target);
-      // get the pool5 features
-      vector<vector<float> > output_features;
-      WrapOutputBlob("pool6_c", &output_features);
-      features.insert(features.end(), output_features.begin(), output_features.begin() + output_features.size());
+      // pool6_c rows are laid out per candidate already
+      CHECK_EQ(plan_.pool6_c->count(1), BBOX_REGRESSION_FEATURE_LENGTH);
+      caffe::caffe_copy(plan_.pool6_c->count(), plan_.pool6_c->cpu_data(), 
+                        features + (size_t)i * batch_size * BBOX_REGRESSION_FEATURE_LENGTH);
+    }
+    SetFrameId(frame_id);
+}
+
+void Regressor::GetHeadParams(std::vector<caffe::Blob<float>* > *params) {
+  params->clear();
+  const vector<boost::shared_ptr<Layer<float> > > & layers = net_->layers();
+  for (int i = plan_.fc6_idx; i < layers.size(); i++) {
+    const vector<boost::shared_ptr<Blob<float> > > & blobs = layers[i]->blobs();
+    for (int j = 0; j < blobs.size(); j++) {
+      params->push_back(blobs[j].get());
     }
+  }
+}
+
+void Regressor::GetPooledFeatures(const cv::Mat& image_curr, const cv::Mat& target, 
+                       const std::vector<BoundingBox> &candidate_bboxes,
+                       std::vector<float> *target_feature,
+                       std::vector<float> *candidate_features) {
+  // image is not used by PreForwardFast, the conv map of image_curr is usually cached from PredictFast
+  PreForwardFast(image_curr, candidate_bboxes, image_curr, target);
+
+  // without BROADCAST_TARGET_FEATURE pool6 holds duplicated rows, the first one is enough
+  const float* pool6_data = plan_.pool6->cpu_data();
+  target_feature->assign(pool6_data, pool6_data + plan_.pool6->count(1));
+
+  const float* pool6_c_data = plan_.pool6_c->cpu_data();
+  candidate_features->assign(pool6_c_data, pool6_c_data + plan_.pool6_c->count());
 }
 
 void Regressor::PredictFast(const cv::Mat& image_curr, const cv::Mat& image, const cv::Mat& target, 
@@ -360,40 +724,100 @@ void Regressor::PredictFast(const cv::Mat& image_curr, const cv::Mat& image, con
 #endif
 
   PreForwardFast(image_curr, candidate_bboxes, image, target);
+  PredictPooled(0, 0, candidate_bboxes, bbox_prev, bbox, return_probabilities, return_sorted_indexes, sd_trans,
+                cur_frame);
 
-  const vector<string> & layer_names = net_->layer_names();
-  int layer_pool5_concat_idx = FindLayerIndexByName(layer_names, "concat");
-  int layer_fc8_idx = net_->layers().size() - 2;
-  net_->ForwardFromTo(layer_pool5_concat_idx, layer_fc8_idx);
-
-  vector<float> probabilities;
-  GetProbOutput(&probabilities);
+#ifdef LOG_TIME
+  hrt_.stop();
+  cout << "time spent for PredictFast: " << hrt_.getMilliseconds() << " ms" << endl;
+#endif
+}
 
-  vector<float> positive_probabilities;
-  for(int i = 0; i < candidate_bboxes.size(); i++) {
-    positive_probabilities.push_back(probabilities[2*i+1]);
+void Regressor::PoolCandidates(const cv::Mat& image_curr, const std::vector<cv::Mat> &targets,
+                               const std::vector<const std::vector<BoundingBox>* > &candidate_bboxes) {
+  const int num_targets = targets.size();
+  CHECK_EQ(candidate_bboxes.size(), num_targets);
+
+  pooled_bboxes_.clear();
+  head_roi_target_.clear();
+  std::vector<int> pooled_begin(num_targets + 1);
+  for (int t = 0; t < num_targets; t++) {
+    pooled_begin[t] = pooled_bboxes_.size();
+    pooled_bboxes_.insert(pooled_bboxes_.end(), candidate_bboxes[t]->begin(), candidate_bboxes[t]->end());
+    head_roi_target_.insert(head_roi_target_.end(), candidate_bboxes[t]->size(), t);
   }
+  pooled_begin[num_targets] = pooled_bboxes_.size();
 
-  assert (positive_probabilities.size() == candidate_bboxes.size());
+  PreForwardFast(image_curr, pooled_bboxes_, targets.data(), num_targets);
+  pooled_begin_.swap(pooled_begin);
+}
 
+void Regressor::PredictFastPooled(const int t, const std::vector<BoundingBox> &candidate_bboxes,
+                                  const BoundingBox & bbox_prev,
+                                  BoundingBox* bbox,
+                                  std::vector<float> *return_probabilities, 
+                                  std::vector<int> *return_sorted_indexes,
+                                  double sd_trans,
+                                  int cur_frame) {
+  CHECK_LT(t + 1, (int)pooled_begin_.size()) << "no PoolCandidates of this target since the last network pass";
+  CHECK_EQ(candidate_bboxes.size(), pooled_begin_[t + 1] - pooled_begin_[t]);
+  PredictPooled(pooled_begin_[t], t, candidate_bboxes, bbox_prev, bbox, return_probabilities, return_sorted_indexes,
+                sd_trans, cur_frame);
+}
 
+void Regressor::PredictPooled(const int roi_begin, const int target,
+                              const std::vector<BoundingBox> &candidate_bboxes, const BoundingBox & bbox_prev, 
+                              BoundingBox* bbox,
+                              std::vector<float> *return_probabilities, 
+                              std::vector<int> *return_sorted_indexes,
+                              double sd_trans,
+                              int cur_frame) {
+  // the per candidate arrays below live until the end of this call
+  const FrameArena::Mark arena_mark = frame_arena_->GetMark();
+  const int num_candidates = candidate_bboxes.size();
+
+  // the distance penalty only depends on the boxes, the cascade ranks the candidates with it
+  float *distance_scores = NULL;
 #ifdef ADD_DISTANCE_PENALTY
-  vector<float> distance_scores;
+  distance_scores = frame_arena_->Allocate<float>(num_candidates);
+  candidate_set_.assign(candidate_bboxes);
+  candidate_set_.ComputeCenterDistance(bbox_prev, &candidate_distances_);
+  double w = bbox_prev.x2_ - bbox_prev.x1_;
+  double h = bbox_prev.y2_ - bbox_prev.y1_;
+  double r = round((w+h)/2.0);
+  double max_shift = sqrt(pow(KEEP_SD * sd_trans * r, 2) + pow(KEEP_SD * sd_trans * r, 2) + DISTANCE_PENALTY_PAD);
   for(int i = 0; i < candidate_bboxes.size(); i++) {
-    double d = candidate_bboxes[i].compute_center_distance(bbox_prev);
-    double w = bbox_prev.x2_ - bbox_prev.x1_;
-    double h = bbox_prev.y2_ - bbox_prev.y1_;
-    double r = round((w+h)/2.0);
-    double max_shift = sqrt(pow(KEEP_SD * sd_trans * r, 2) + pow(KEEP_SD * sd_trans * r, 2) + DISTANCE_PENALTY_PAD);
+    double d = candidate_distances_[i];
     double this_distance_score = cos(d/ (max_shift) * PI/2);
     if (this_distance_score < 0) {
       cout << "out of range, problem, inspect" << endl;
       exit(-1);
     }
-    distance_scores.push_back(this_distance_score);
+    distance_scores[i] = this_distance_score;
+  }
+#endif
+
+  float *probabilities = frame_arena_->Allocate<float>(2 * num_candidates);
+#ifdef BROADCAST_TARGET_FEATURE
+  if (cascade_scoring_ && num_candidates > 0 && Caffe::mode() == Caffe::CPU) {
+    ForwardHeadCascade(plan_.predict_end_idx, roi_begin, num_candidates, target, distance_scores, probabilities);
+  } else {
+    ForwardHeadBroadcast(plan_.predict_end_idx, roi_begin, num_candidates, target);
+    GetProbOutput(probabilities);
   }
+#else
+  // the concat holds the rois of every pooled target, the head runs over all of them
+  net_->ForwardFromTo(plan_.concat_idx, plan_.predict_end_idx);
+  float *pooled_probabilities = frame_arena_->Allocate<float>(plan_.fc8->count());
+  GetProbOutput(pooled_probabilities);
+  caffe::caffe_copy(2 * num_candidates, pooled_probabilities + 2 * roi_begin, probabilities);
 #endif
 
+  float *positive_probabilities = frame_arena_->Allocate<float>(num_candidates);
+  for(int i = 0; i < num_candidates; i++) {
+    positive_probabilities[i] = probabilities[2*i+1];
+  }
+
 #ifdef DEBUG_CANDIDATE_IN_PREDICTFAST
   vector<cv::Mat> image_curr_scaled_splitted;
   WrapOutputBlob("candidate", &image_curr_scaled_splitted);
@@ -416,7 +840,7 @@ void Regressor::PredictFast(const cv::Mat& image_curr, const cv::Mat& image, con
   GetFeatures("rois", &rois_in);
 
   vector <BoundingBox> bboxes_in;
-  for (int i = 0; i < rois_in.size(); i+= 5) {
+  for (int i = roi_begin * 5; i < (roi_begin + num_candidates) * 5; i+= 5) {
     // each rois in the rois_in memory is [batch_id, x1, y1, x2, y2]
     BoundingBox this_bbox(rois_in[i + 1],
                           rois_in[i + 2],
@@ -425,7 +849,7 @@ void Regressor::PredictFast(const cv::Mat& image_curr, const cv::Mat& image, con
     bboxes_in.push_back(this_bbox);
   }
 
-  assert(positive_probabilities.size() == bboxes_in.size()); 
+  assert(num_candidates == bboxes_in.size()); 
 
   double min_prob = 1.0;
   double max_prob = 0.0;
@@ -467,18 +891,18 @@ void Regressor::PredictFast(const cv::Mat& image_curr, const cv::Mat& image, con
 
 #ifdef ADD_DISTANCE_PENALTY
   // add distance penalty to the positive_probabilities
-  for (int i = 0; i < positive_probabilities.size(); i++) {
+  for (int i = 0; i < num_candidates; i++) {
     positive_probabilities[i] *= distance_scores[i];
   }
 #endif
 
   // initialize original index locations
-  vector<int> idx(positive_probabilities.size());
-  iota(idx.begin(), idx.end(), 0);
+  int *idx = frame_arena_->Allocate<int>(num_candidates);
+  iota(idx, idx + num_candidates, 0);
 
   // sort indexes based on comparing values in v
-  sort(idx.begin(), idx.end(),
-       [&positive_probabilities](int i1, int i2) {return positive_probabilities[i1] > positive_probabilities[i2];});
+  sort(idx, idx + num_candidates,
+       [positive_probabilities](int i1, int i2) {return positive_probabilities[i1] > positive_probabilities[i2];});
 
   double x1_weighted = 0;
   double y1_weighted = 0;
@@ -486,7 +910,9 @@ void Regressor::PredictFast(const cv::Mat& image_curr, const cv::Mat& image, con
   double y2_weighted = 0;
   double denominator = 0;
 
-  for (int i = 0 ; i< TOP_ESTIMATES; i ++) {
+  // the first round may draw fewer than TOP_ESTIMATES accepted candidates
+  const int num_top = std::min(TOP_ESTIMATES, num_candidates);
+  for (int i = 0 ; i< num_top; i ++) {
     double this_prob = positive_probabilities[idx[i]];
     
     x1_weighted += candidate_bboxes[idx[i]].x1_ * this_prob;
@@ -497,19 +923,23 @@ void Regressor::PredictFast(const cv::Mat& image_curr, const cv::Mat& image, con
     denominator += this_prob;
   }
 
-  x1_weighted /= denominator;
-  y1_weighted /= denominator;
-  x2_weighted /= denominator;
-  y2_weighted /= denominator;
+  if (denominator > 0) {
+    x1_weighted /= denominator;
+    y1_weighted /= denominator;
+    x2_weighted /= denominator;
+    y2_weighted /= denominator;
+  } else {
+    // nothing to weight, keep the last estimate
+    x1_weighted = bbox_prev.x1_;
+    y1_weighted = bbox_prev.y1_;
+    x2_weighted = bbox_prev.x2_;
+    y2_weighted = bbox_prev.y2_;
+  }
 
   *bbox = BoundingBox(x1_weighted, y1_weighted, x2_weighted, y2_weighted);
-  *return_probabilities = positive_probabilities;
-  *return_sorted_indexes = idx;
-
-#ifdef LOG_TIME
-  hrt_.stop();
-  cout << "time spent for PredictFast: " << hrt_.getMilliseconds() << " ms" << endl;
-#endif
+  return_probabilities->assign(positive_probabilities, positive_probabilities + num_candidates);
+  return_sorted_indexes->assign(idx, idx + num_candidates);
+  frame_arena_->Rewind(arena_mark);
 }
 
 void Regressor::Predict(const cv::Mat& image_curr, const cv::Mat& image, const cv::Mat& target, 
@@ -569,7 +999,9 @@ void Regressor::Predict(const cv::Mat& image_curr, const cv::Mat& image, const c
   double y2_weighted = 0;
   double denominator = 0;
 
-  for (int i = 0 ; i< TOP_ESTIMATES; i ++) {
+  const int num_top = std::min(TOP_ESTIMATES, (int)positive_probabilities.size());
+  CHECK_GT(num_top, 0) << "no candidates to estimate from";
+  for (int i = 0 ; i< num_top; i ++) {
     double this_prob = positive_probabilities[idx[i]];
     
     x1_weighted += candidate_bboxes[idx[i]].x1_ * this_prob;
@@ -608,6 +1040,74 @@ int Regressor::FindLayerIndexByName( const vector<string> & layer_names, const s
   return -1;
 }
 
+void Regressor::BuildExecutionPlan() {
+  const vector<string> & layer_names = net_->layer_names();
+
+  plan_.conv1_idx = FindLayerIndexByName(layer_names, "conv1");
+  plan_.pool6_idx = FindLayerIndexByName(layer_names, "pool6");
+  plan_.conv1_c_idx = FindLayerIndexByName(layer_names, "conv1_c");
+  plan_.pool6_c_idx = FindLayerIndexByName(layer_names, "pool6_c");
+  // without a ROIPooling layer the whole candidate branch is treated as per roi, the cache then only saves
+  // the resize and preprocessing of the frame
+  plan_.roi_pool_idx = plan_.conv1_c_idx;
+  for (int i = plan_.conv1_c_idx; i >= 0 && i <= plan_.pool6_c_idx; i++) {
+    if (string(net_->layers()[i]->type()) == "ROIPooling") {
+      plan_.roi_pool_idx = i;
+      break;
+    }
+  }
+  plan_.concat_idx = FindLayerIndexByName(layer_names, "concat");
+  plan_.fc6_idx = plan_.concat_idx + 1;
+  plan_.fc8_idx = FindLayerIndexByName(layer_names, "fc8");
+  plan_.loss_idx = FindLayerIndexByName(layer_names, "loss");
+  plan_.predict_end_idx = net_->layers().size() - 2;
+  plan_.last_idx = net_->layers().size() - 1;
+
+  // nets without the two-branch layout (e.g. the GOTURN style ones) have fewer inputs and none of these blobs
+  const vector<Blob<float>*> & input_blobs = net_->input_blobs();
+  plan_.input_target = input_blobs[TARGET_NETWORK_INPUT_IDX];
+  plan_.input_candidate = input_blobs.size() > CANDIDATE_NETWORK_INPUT_IDX ? input_blobs[CANDIDATE_NETWORK_INPUT_IDX] : NULL;
+  plan_.input_rois = input_blobs.size() > ROIS_NETWORK_INPUT_IDX ? input_blobs[ROIS_NETWORK_INPUT_IDX] : NULL;
+  plan_.input_label = input_blobs.size() > LABEL_NETWORK_INPUT_IDX ? input_blobs[LABEL_NETWORK_INPUT_IDX] : NULL;
+
+  plan_.pool6 = net_->has_blob("pool6") ? net_->blob_by_name("pool6").get() : NULL;
+  plan_.pool6_c = net_->has_blob("pool6_c") ? net_->blob_by_name("pool6_c").get() : NULL;
+  plan_.fc8 = net_->has_blob("fc8") ? net_->blob_by_name("fc8").get() : NULL;
+  plan_.fc6 = NULL;
+  plan_.fc6_layer = NULL;
+  if (plan_.concat_idx != -1 && plan_.fc6_idx < net_->layers().size()) {
+    plan_.fc6 = net_->top_vecs()[plan_.fc6_idx][0];
+    plan_.fc6_layer = net_->layers()[plan_.fc6_idx].get();
+  }
+
+  plan_.target_shape.resize(4);
+  plan_.target_shape[0] = 1;
+  plan_.target_shape[1] = num_channels_;
+  plan_.target_shape[2] = input_geometry_.height;
+  plan_.target_shape[3] = input_geometry_.width;
+
+  plan_.candidate_shape.resize(4);
+  plan_.candidate_shape[0] = 1;
+  plan_.candidate_shape[1] = num_channels_;
+
+  plan_.rois_shape.resize(2);
+  plan_.rois_shape[1] = 5;
+
+  plan_.label_shape.resize(2);
+  plan_.label_shape[1] = 1;
+
+  // blob pointers may have changed, so may the content of the candidate branch
+  InvalidateConvCache();
+}
+
+bool Regressor::ReshapeInputIfNeeded(Blob<float>* blob, const std::vector<int>& shape) {
+  if (blob->shape() == shape) {
+    return false;
+  }
+  blob->Reshape(shape);
+  return true;
+}
+
 void Regressor::Estimate(std::vector<cv::Mat> &images_flattened,
                            std::vector<cv::Mat> &targets_flattened,
                            std::vector<cv::Mat> &candidates_flattened,
@@ -942,6 +1442,9 @@ void Regressor::SetImages(const std::vector<cv::Mat>& images,
 
   const size_t num_images = images.size();
 
+  // inputs are overwritten, the candidate branch no longer holds a cached frame
+  InvalidateConvCache();
+
   // Set network inputs to the appropriate size and number.
   ReshapeImageInputs(num_images);
 
@@ -959,6 +1462,8 @@ void Regressor::SetCandidates(const std::vector<cv::Mat>& candidates) {
 
   const size_t num_candidates = candidates.size();
 
+  InvalidateConvCache();
+
   // Set network inputs to the appropriate size and number.
   ReshapeCandidateInputs(num_candidates);
 
@@ -971,36 +1476,22 @@ void Regressor::SetCandidates(const std::vector<cv::Mat>& candidates) {
 }
 
 
-void Regressor::set_rois(const std::vector<BoundingBox>& candidate_bboxes, const double scale, const int batch_id) {
+void Regressor::set_rois(const std::vector<BoundingBox>& candidate_bboxes, const double scale, const int batch_id,
+                         const double offset_x, const double offset_y) {
+
+  candidate_set_.assign(candidate_bboxes);
+  set_rois(candidate_set_, scale, batch_id, offset_x, offset_y);
+}
 
+void Regressor::set_rois(const CandidateSet& candidates, const double scale, const int batch_id,
+                         const double offset_x, const double offset_y) {
   // Reshape the bbox.
-  Blob<float>* input_rois = net_->input_blobs()[ROIS_NETWORK_INPUT_IDX];
-  const size_t num_candidates = candidate_bboxes.size();
-  vector<int> shape;
-  shape.push_back(num_candidates);
-  shape.push_back(5);
-  input_rois->Reshape(shape);
-
-  // Get a pointer to the bbox memory.
-  float* input_rois_data = input_rois->mutable_cpu_data();
-
-  int input_rois_data_counter = 0;
-  for (size_t i = 0; i < candidate_bboxes.size(); ++i) {
-    const BoundingBox& this_rois = candidate_bboxes[i];
-
-    std::vector<float> bbox_vect;
-    bbox_vect.push_back(this_rois.x1_ * scale);
-    bbox_vect.push_back(this_rois.y1_ * scale);
-    bbox_vect.push_back(this_rois.x2_ * scale);
-    bbox_vect.push_back(this_rois.y2_ * scale);
-
-    input_rois_data[input_rois_data_counter] = batch_id; // put the batch id as first col
-    input_rois_data_counter++;
-    for (size_t j = 0; j < 4; ++j) {
-      input_rois_data[input_rois_data_counter] = bbox_vect[j];
-      input_rois_data_counter++;
-    }
-  }
+  Blob<float>* input_rois = plan_.input_rois;
+  plan_.rois_shape[0] = candidates.size();
+  ReshapeInputIfNeeded(input_rois, plan_.rois_shape);
+
+  // batch id as first col, then x1, y1, x2, y2
+  candidates.WriteRois(batch_id, scale, offset_x, offset_y, input_rois->mutable_cpu_data());
 }
 
 void Regressor::Estimate(const std::vector<cv::Mat>& images,
@@ -1052,19 +1543,22 @@ void Regressor::GetProbOutput(std::vector<float> *output) {
 
   // GetFeatures("prob", output);
 
+  output->resize(plan_.fc8->count());
+  GetProbOutput(output->data());
+}
+
+void Regressor::GetProbOutput(float *output) {
   // get fc8 layer and manually compute softmax since SoftMaxWithLoss is used for finetuning
-  std::vector<float> feature_fc8;
-  GetFeatures("fc8", &feature_fc8);
-  // batch size is feature_fc8.size()/2
-  for (int i = 0;i< feature_fc8.size()/2;i++) {
+  const float* feature_fc8 = plan_.fc8->cpu_data();
+  const int count = plan_.fc8->count();
+  // batch size is count/2
+  for (int i = 0;i< count/2;i++) {
     // change to softmax prob 
     double exp_0 = exp(feature_fc8[2*i]);
     double exp_1 = exp(feature_fc8[2*i + 1]);
-    feature_fc8[2*i] = exp_0/(exp_0 + exp_1);
-    feature_fc8[2*i + 1] = exp_1/(exp_0 + exp_1);
+    output[2*i] = exp_0/(exp_0 + exp_1);
+    output[2*i + 1] = exp_1/(exp_0 + exp_1);
   }
-  
-  *output = feature_fc8;
 }
 
 // Wrap the input layer of the network in separate cv::Mat objects
@@ -1122,6 +1616,20 @@ void Regressor::WrapInputLayerGivenIndex(std::vector<cv::Mat>* channels, int inp
   }
 }
 
+void Regressor::WrapInputLayerGivenIndex(std::vector<cv::Mat>* channels, int input_idx, int n, const cv::Size &size) {
+  Blob<float>* input_layer = net_->input_blobs()[input_idx];
+
+  int width = input_layer->width();
+  int height = input_layer->height();
+  assert(size.width <= width && size.height <= height);
+  float* data = input_layer->mutable_cpu_data() + input_layer->offset(n);
+  for (int i = 0; i < input_layer->channels(); ++i) {
+    cv::Mat channel(height, width, CV_32FC1, data);
+    channels->push_back(channel(cv::Rect(0, 0, size.width, size.height)));
+    data += width * height;
+  }
+}
+
 // Wrap the input layer of the network in separate cv::Mat objects
 // (one per channel). This way we save one memcpy operation and we
 // don't need to rely on cudaMemcpy2D. The last preprocessing
@@ -1293,6 +1801,35 @@ void Regressor::Preprocess(const std::vector<cv::Mat>& images,
   }
 }
 
+void Regressor::PreprocessInput(const cv::Mat& img, const cv::Size& size, const int input_idx, const int n) {
+  PreprocessInput(img, size, (double)img.cols / size.width, (double)img.rows / size.height, input_idx, n);
+}
+
+void Regressor::PreprocessInput(const cv::Mat& img, const cv::Size& size,
+                                const double inv_scale_x, const double inv_scale_y,
+                                const int input_idx, const int n) {
+  Blob<float>* input_layer = net_->input_blobs()[input_idx];
+  assert(size.width <= input_layer->width() && size.height <= input_layer->height());
+
+  if (InputPreprocessor::Supports(img, num_channels_)) {
+    input_preprocessor_.Run(img, size, inv_scale_x, inv_scale_y, mean_scalar,
+                            input_layer->mutable_cpu_data() + input_layer->offset(n),
+                            input_layer->height() * input_layer->width(), input_layer->width());
+    return;
+  }
+
+  // float or single channel network inputs, through OpenCV
+  cv::Mat img_resized;
+  if (img.size() != size) {
+    cv::resize(img, img_resized, size);
+  } else {
+    img_resized = img;
+  }
+  std::vector<cv::Mat> channels;
+  WrapInputLayerGivenIndex(&channels, input_idx, n, size);
+  Preprocess(img_resized, &channels, true);
+}
+
 void Regressor::PreprocessDuplicateIn(std::vector<cv::Mat> &data_to_duplicate, std::vector<std::vector<cv::Mat> >* blob_channels) {
   for (int batch_id = 0; batch_id < blob_channels->size(); batch_id ++) {
     // copy for each channel
@@ -1301,3 +1838,304 @@ void Regressor::PreprocessDuplicateIn(std::vector<cv::Mat> &data_to_duplicate, s
     }
   }
 }
+
+// Row major C = alpha * op(A) * op(B) + beta * C with explicit leading dimensions, so that the target and the
+// candidate blocks of the first fc layer's weights are used in place. Runs on the host or the device following
+// Caffe::mode(), like caffe_cpu_gemm / caffe_gpu_gemm; the pointers must be the matching head_*data ones.
+static void head_gemm(const CBLAS_TRANSPOSE trans_a, const CBLAS_TRANSPOSE trans_b, const int M, const int N,
+                      const int K, const float alpha, const float* A, const int lda, const float* B, const int ldb,
+                      const float beta, float* C, const int ldc) {
+  if (Caffe::mode() == Caffe::CPU) {
+    cblas_sgemm(CblasRowMajor, trans_a, trans_b, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+    return;
+  }
+#ifndef CPU_ONLY
+  // cuBLAS is column major, compute C^T = op(B)^T * op(A)^T as caffe_gpu_gemm does
+  const cublasOperation_t cu_trans_a = (trans_a == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  const cublasOperation_t cu_trans_b = (trans_b == CblasNoTrans) ? CUBLAS_OP_N : CUBLAS_OP_T;
+  CUBLAS_CHECK(cublasSgemm(Caffe::cublas_handle(), cu_trans_b, cu_trans_a, N, M, K, &alpha, B, ldb, A, lda,
+                           &beta, C, ldc));
+#else
+  NO_GPU;
+#endif
+}
+
+static const float* head_data(const Blob<float>* blob) {
+  return Caffe::mode() == Caffe::CPU ? blob->cpu_data() : blob->gpu_data();
+}
+
+static float* head_mutable_data(Blob<float>* blob) {
+  return Caffe::mode() == Caffe::CPU ? blob->mutable_cpu_data() : blob->mutable_gpu_data();
+}
+
+static const float* head_diff(const Blob<float>* blob) {
+  return Caffe::mode() == Caffe::CPU ? blob->cpu_diff() : blob->gpu_diff();
+}
+
+static float* head_mutable_diff(Blob<float>* blob) {
+  return Caffe::mode() == Caffe::CPU ? blob->mutable_cpu_diff() : blob->mutable_gpu_diff();
+}
+
+void Regressor::SetHeadRoiAssignment(const int num_rois, const int num_targets) {
+  vector<int> shape;
+  shape.push_back(num_rois);
+  shape.push_back(num_targets);
+  head_roi_assign_.Reshape(shape);
+
+  // one hot rows, only rewritten (and uploaded) when the assignment changes
+  const bool single_target = num_targets == 1;
+  if (head_roi_assign_rois_ == num_rois && head_roi_assign_targets_ == num_targets
+      && (single_target || head_roi_assign_target_ == head_roi_target_)) {
+    return;
+  }
+  float* assign = head_roi_assign_.mutable_cpu_data();
+  caffe::caffe_set(num_rois * num_targets, 0.0f, assign);
+  for (int i = 0; i < num_rois; i++) {
+    assign[i * num_targets + (single_target ? 0 : head_roi_target_[i])] = 1.0f;
+  }
+  head_roi_assign_rois_ = num_rois;
+  head_roi_assign_targets_ = num_targets;
+  head_roi_assign_target_ = single_target ? std::vector<int>() : head_roi_target_;
+}
+
+const float* Regressor::HeadOnes(const int n) {
+  if (head_ones_.count() < n) {
+    vector<int> shape(1, n);
+    head_ones_.Reshape(shape);
+    caffe::caffe_set(n, 1.0f, head_ones_.mutable_cpu_data());
+  }
+  return head_data(&head_ones_);
+}
+
+void Regressor::ForwardHeadBroadcast(const int end_layer_idx, const int roi_begin, const int num_rois_slice,
+                                     const int target) {
+  const int layer_fc6_idx = plan_.fc6_idx;
+  Layer<float>* fc6_layer = plan_.fc6_layer;
+  CHECK(fc6_layer != NULL) << "network has no concat layer";
+  CHECK_EQ(string(fc6_layer->type()), "InnerProduct") << "concat should be followed by an InnerProduct layer";
+  CHECK(net_->bottom_vecs()[layer_fc6_idx][0] == net_->top_vecs()[plan_.concat_idx][0]) 
+    << "first fc layer should read the concat output";
+  CHECK(!fc6_layer->layer_param().inner_product_param().transpose());
+
+  const Blob<float>* pool6 = plan_.pool6;
+  const Blob<float>* pool6_c = plan_.pool6_c;
+  Blob<float>* fc6 = plan_.fc6;
+  const Blob<float>* weight = fc6_layer->blobs()[0].get();
+
+  const int num_rois = num_rois_slice >= 0 ? num_rois_slice : pool6_c->shape(0) - roi_begin;
+  const int num_targets = pool6->shape(0);
+  const int num_output = weight->shape(0);
+  const int dim_target = pool6->count(1);
+  const int dim_candidate = pool6_c->count(1);
+  // concat puts pool6 first, so weight is [W_target | W_candidate] row by row
+  CHECK_EQ(weight->shape(1), dim_target + dim_candidate);
+  CHECK_LE(roi_begin + num_rois, pool6_c->shape(0));
+  CHECK_LT(target, num_targets);
+  CHECK(target >= 0 || num_rois == pool6_c->shape(0)) << "a slice of the rois needs its target";
+  CHECK(target >= 0 || num_targets == 1 || head_roi_target_.size() == num_rois)
+    << "rois of several targets need head_roi_target_";
+
+  vector<int> shape_fc6;
+  shape_fc6.push_back(num_rois);
+  shape_fc6.push_back(num_output);
+  fc6->Reshape(shape_fc6);
+
+  // target responses, computed once per target
+  ComputeHeadTargetResponse();
+
+  // every row starts from the response of its target, then accumulate W_candidate * pool6_c
+  float* fc6_data = head_mutable_data(fc6);
+  if (target >= 0) {
+    head_gemm(CblasNoTrans, CblasNoTrans, num_rois, num_output, 1, 1.0f,
+              HeadOnes(num_rois), 1, head_data(&head_target_response_) + target * num_output, num_output,
+              0.0f, fc6_data, num_output);
+  } else {
+    SetHeadRoiAssignment(num_rois, num_targets);
+    head_gemm(CblasNoTrans, CblasNoTrans, num_rois, num_output, num_targets, 1.0f,
+              head_data(&head_roi_assign_), num_targets, head_data(&head_target_response_), num_output,
+              0.0f, fc6_data, num_output);
+  }
+  head_gemm(CblasNoTrans, CblasTrans, num_rois, num_output, dim_candidate, 1.0f,
+            head_data(pool6_c) + roi_begin * dim_candidate, dim_candidate,
+            head_data(weight) + dim_target, dim_target + dim_candidate,
+            1.0f, fc6_data, num_output);
+
+  net_->ForwardFromTo(layer_fc6_idx + 1, end_layer_idx);
+}
+
+void Regressor::ComputeHeadTargetResponse() {
+  Layer<float>* fc6_layer = plan_.fc6_layer;
+  const Blob<float>* pool6 = plan_.pool6;
+  const Blob<float>* weight = fc6_layer->blobs()[0].get();
+
+  const int num_targets = pool6->shape(0);
+  const int num_output = weight->shape(0);
+  const int dim_target = pool6->count(1);
+  const int ld = weight->shape(1);
+
+  vector<int> shape;
+  shape.push_back(num_targets);
+  shape.push_back(num_output);
+  head_target_response_.Reshape(shape);
+  float* response = head_mutable_data(&head_target_response_);
+  head_gemm(CblasNoTrans, CblasTrans, num_targets, num_output, dim_target, 1.0f,
+            head_data(pool6), dim_target, head_data(weight), ld, 0.0f, response, num_output);
+  if (fc6_layer->blobs().size() > 1) {
+    // + ones * bias, one bias row per target
+    head_gemm(CblasNoTrans, CblasNoTrans, num_targets, num_output, 1, 1.0f,
+              HeadOnes(num_targets), 1, head_data(fc6_layer->blobs()[1].get()), num_output, 1.0f, response, num_output);
+  }
+}
+
+void Regressor::ForwardHeadCascade(const int end_layer_idx, const int roi_begin, const int num_rois, const int target,
+                                   const float *rank_weights, float *probabilities) {
+  const int layer_fc6_idx = plan_.fc6_idx;
+  Layer<float>* fc6_layer = plan_.fc6_layer;
+  CHECK(fc6_layer != NULL) << "network has no concat layer";
+  CHECK_EQ(string(fc6_layer->type()), "InnerProduct") << "concat should be followed by an InnerProduct layer";
+  CHECK(!fc6_layer->layer_param().inner_product_param().transpose());
+
+  const Blob<float>* pool6 = plan_.pool6;
+  const Blob<float>* pool6_c = plan_.pool6_c;
+  Blob<float>* fc6 = plan_.fc6;
+  const Blob<float>* weight = fc6_layer->blobs()[0].get();
+  CHECK_LT(target, pool6->shape(0));
+  CHECK_LE(roi_begin + num_rois, pool6_c->shape(0));
+  CHECK_EQ(pool6_c->num_axes(), 4);
+
+  const int num_output = weight->shape(0);
+  const int dim_target = pool6->count(1);
+  const int dim_candidate = pool6_c->count(1);
+  const int channels = pool6_c->shape(1);
+  const int height = pool6_c->shape(2);
+  const int width = pool6_c->shape(3);
+  const int dim_coarse = HeadCascade::CoarseDim(channels, height, width, CASCADE_CELL);
+  CHECK_EQ(weight->shape(1), dim_target + dim_candidate);
+
+  const FrameArena::Mark arena_mark = frame_arena_->GetMark();
+  ComputeHeadTargetResponse();
+  const float* weight_data = weight->cpu_data();
+  const float* target_response = head_target_response_.cpu_data() + target * num_output;
+  const float* pool6_c_data = pool6_c->cpu_data() + roi_begin * dim_candidate;
+
+  // stage one, every roi on the coarse grid. The weights follow the online fine tuning, so they are coarsened
+  // every call, which costs about one exact roi.
+  cascade_weight_.resize(num_output * dim_coarse);
+  HeadCascade::CoarsenWeights(weight_data + dim_target, dim_target + dim_candidate, num_output,
+                              channels, height, width, CASCADE_CELL, cascade_weight_.data());
+  float *coarse_features = frame_arena_->Allocate<float>(num_rois * dim_coarse);
+  HeadCascade::CoarsenFeatures(pool6_c_data, num_rois, channels, height, width, CASCADE_CELL, coarse_features);
+
+  vector<int> shape_fc6;
+  shape_fc6.push_back(num_rois);
+  shape_fc6.push_back(num_output);
+  fc6->Reshape(shape_fc6);
+  float* fc6_data = fc6->mutable_cpu_data();
+  for (int i = 0; i < num_rois; i++) {
+    caffe::caffe_copy(num_output, target_response, fc6_data + i * num_output);
+  }
+  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, num_rois, num_output, dim_coarse, 1.0f,
+              coarse_features, dim_coarse, cascade_weight_.data(), dim_coarse,
+              1.0f, fc6_data, num_output);
+  net_->ForwardFromTo(layer_fc6_idx + 1, end_layer_idx);
+  GetProbOutput(probabilities);
+
+  // rank by the score PredictFast ranks by
+  float *scores = frame_arena_->Allocate<float>(num_rois);
+  int *order = frame_arena_->Allocate<int>(num_rois);
+  for (int i = 0; i < num_rois; i++) {
+    scores[i] = probabilities[2 * i + 1] * (rank_weights != NULL ? rank_weights[i] : 1.0f);
+    order[i] = i;
+  }
+  sort(order, order + num_rois, [scores](int i1, int i2) { return scores[i1] > scores[i2]; });
+  float *sorted_scores = frame_arena_->Allocate<float>(num_rois);
+  for (int i = 0; i < num_rois; i++) {
+    sorted_scores[i] = scores[order[i]];
+  }
+  const int num_survivors = HeadCascade::NumSurvivors(sorted_scores, num_rois, TOP_ESTIMATES, CASCADE_MARGIN,
+                                                      CASCADE_MIN_SURVIVORS, CASCADE_MAX_SURVIVORS);
+
+  // stage two, the survivors' pool6_c rows through the exact head
+  float *survivor_features = frame_arena_->Allocate<float>(num_survivors * dim_candidate);
+  for (int j = 0; j < num_survivors; j++) {
+    caffe::caffe_copy(dim_candidate, pool6_c_data + order[j] * dim_candidate, survivor_features + j * dim_candidate);
+  }
+  shape_fc6[0] = num_survivors;
+  fc6->Reshape(shape_fc6);
+  fc6_data = fc6->mutable_cpu_data();
+  for (int j = 0; j < num_survivors; j++) {
+    caffe::caffe_copy(num_output, target_response, fc6_data + j * num_output);
+  }
+  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, num_survivors, num_output, dim_candidate, 1.0f,
+              survivor_features, dim_candidate, weight_data + dim_target, dim_target + dim_candidate,
+              1.0f, fc6_data, num_output);
+  net_->ForwardFromTo(layer_fc6_idx + 1, end_layer_idx);
+
+  float *exact = frame_arena_->Allocate<float>(2 * num_survivors);
+  GetProbOutput(exact);
+  for (int j = 0; j < num_survivors; j++) {
+    const int i = order[j];
+    probabilities[2 * i] = exact[2 * j];
+    probabilities[2 * i + 1] = exact[2 * j + 1];
+  }
+
+  // the top of the ranking, hence the estimate, only comes from exact scores
+  HeadCascade::CapRejected(order, num_rois, num_survivors, rank_weights, probabilities);
+  frame_arena_->Rewind(arena_mark);
+
+  cascade_stats_.frames++;
+  cascade_stats_.candidates += num_rois;
+  cascade_stats_.survivors += num_survivors;
+  cascade_stats_.macs_exact += (double)num_rois * num_output * dim_candidate;
+  cascade_stats_.macs_cascade += (double)num_rois * num_output * dim_coarse
+                                 + (double)num_survivors * num_output * dim_candidate
+                                 + (double)num_output * dim_candidate;
+}
+
+void Regressor::BackwardHeadBroadcast(const int start_layer_idx) {
+  const int layer_fc6_idx = plan_.fc6_idx;
+
+  net_->BackwardFromTo(start_layer_idx, layer_fc6_idx + 1);
+
+  Layer<float>* fc6_layer = plan_.fc6_layer;
+  const Blob<float>* pool6 = plan_.pool6;
+  const Blob<float>* pool6_c = plan_.pool6_c;
+  const Blob<float>* fc6 = plan_.fc6;
+  Blob<float>* weight = fc6_layer->blobs()[0].get();
+
+  const int num_rois = pool6_c->shape(0);
+  const int num_targets = pool6->shape(0);
+  const int num_output = weight->shape(0);
+  const int dim_target = pool6->count(1);
+  const int dim_candidate = pool6_c->count(1);
+  const float* fc6_diff = head_diff(fc6);
+
+  // a shared target row receives the gradient of every candidate of its target, through the assignment of the
+  // forward pass
+  vector<int> shape;
+  shape.push_back(num_targets);
+  shape.push_back(num_output);
+  head_diff_sum_.Reshape(shape);
+  float* diff_sum = head_mutable_data(&head_diff_sum_);
+  head_gemm(CblasTrans, CblasNoTrans, num_targets, num_output, num_rois, 1.0f,
+            head_data(&head_roi_assign_), num_targets, fc6_diff, num_output, 0.0f, diff_sum, num_output);
+
+  if (fc6_layer->param_propagate_down(0)) {
+    float* weight_diff = head_mutable_diff(weight);
+    // dW_target += sum_t(sum_i(dfc6_i) * pool6_t^T)
+    head_gemm(CblasTrans, CblasNoTrans, num_output, dim_target, num_targets, 1.0f,
+              diff_sum, num_output, head_data(pool6), dim_target,
+              1.0f, weight_diff, dim_target + dim_candidate);
+    // dW_candidate += dfc6^T * pool6_c
+    head_gemm(CblasTrans, CblasNoTrans, num_output, dim_candidate, num_rois, 1.0f,
+              fc6_diff, num_output, head_data(pool6_c), dim_candidate,
+              1.0f, weight_diff + dim_target, dim_target + dim_candidate);
+  }
+
+  if (fc6_layer->blobs().size() > 1 && fc6_layer->param_propagate_down(1)) {
+    // dbias += ones^T * diff_sum
+    head_gemm(CblasTrans, CblasNoTrans, 1, num_output, num_targets, 1.0f,
+              HeadOnes(num_targets), 1, diff_sum, num_output,
+              1.0f, head_mutable_diff(fc6_layer->blobs()[1].get()), num_output);
+  }
+}
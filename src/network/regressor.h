@@ -12,6 +12,9 @@
 #include <vector>
 
 #include "helper/bounding_box.h"
+#include "helper/candidate_set.h"
+#include "helper/frame_arena.h"
+#include "helper/input_preprocessor.h"
 #include "helper/high_res_timer.h"
 #include "network/regressor_base.h"
 #include "helper/Constants.h"
@@ -22,6 +25,62 @@ using namespace std;
 const string FREEZE_LAYER_PREFIX = "fc8_k";
 const string LOSS_LAYER_PREFIX = "loss_k";
 
+// Layer ranges and blobs of the two-branch network, resolved once in SetupNetwork/Reset,
+// so that the per-frame forward/backward path does no name lookups
+struct ExecutionPlan {
+  // target branch
+  int conv1_idx;
+  int pool6_idx;
+
+  // candidate branch, ROI pooling included, roi_pool_idx splits it into the full frame backbone and the per roi part
+  int conv1_c_idx;
+  int roi_pool_idx;
+  int pool6_c_idx;
+
+  // head, fc6_idx is the first fc layer after concat, loss_idx is -1 if there is no single "loss" layer
+  int concat_idx;
+  int fc6_idx;
+  int fc8_idx;
+  int loss_idx;
+
+  // last layer before the loss, prediction forwards until here
+  int predict_end_idx;
+  int last_idx;
+
+  caffe::Blob<float>* input_target;
+  caffe::Blob<float>* input_candidate;
+  caffe::Blob<float>* input_rois;
+  caffe::Blob<float>* input_label;
+
+  caffe::Blob<float>* pool6;
+  caffe::Blob<float>* pool6_c;
+  caffe::Blob<float>* fc6;
+  caffe::Blob<float>* fc8;
+
+  caffe::Layer<float>* fc6_layer;
+
+  // scratch shapes compared against the input blobs, so unchanged inputs are not reshaped
+  std::vector<int> target_shape;
+  std::vector<int> candidate_shape;
+  std::vector<int> rois_shape;
+  std::vector<int> label_shape;
+};
+
+// Head compute of the two stage scoring of PredictFast (CASCADE_SCORING) since the last ResetCascadeStats
+struct CascadeStats {
+  CascadeStats() : frames(0), candidates(0), survivors(0), macs_exact(0), macs_cascade(0) { }
+  int frames;
+
+  // rois scored, and those of them that went through the exact head
+  long candidates;
+  long survivors;
+
+  // multiply-adds of the candidate part of the first fc layer: exact head on every roi, versus coarse head on
+  // every roi plus exact head on the survivors plus summing the coarse weights
+  double macs_exact;
+  double macs_cascade;
+};
+
 class Regressor : public RegressorBase {
  public:
   // Set up a network with the architecture specified in deploy_proto,
@@ -60,8 +119,45 @@ class Regressor : public RegressorBase {
                        std::vector<float> * return_probabilities,
                        std::vector<int> *return_sorted_indexes);
 
+  // pool6_c of the candidates, copied out of the blob once per INNER_BATCH_SIZE candidates
   virtual void GetBBoxConvFeatures(const cv::Mat& image_curr, const cv::Mat& image, const cv::Mat& target, 
-                       const std::vector<BoundingBox> &candidate_bboxes, std::vector <std::vector<float> > &features);
+                       const std::vector<BoundingBox> &candidate_bboxes, float *features);
+
+  // Size of the target in the next frames, picks the input scale when adaptive_input_scale_ is on
+  virtual void SetTargetSizeHint(const BoundingBox &bbox);
+
+  // Candidate branch backbone of several frames as one batch, each at the scale of its size hint, kept in the conv
+  // cache so that PredictFast and GetPooledFeatures on any of them only pool their rois from it
+  virtual void ForwardBackboneBatch(const std::vector<cv::Mat> &image_currs, const std::vector<int64_t> &frame_ids,
+                                    const std::vector<BoundingBox> &size_hints);
+
+  virtual int64_t conv_cache_generation() const { return conv_cache_generation_; }
+
+  // The conv cache only serves calls made under the id of the frame it was computed for
+  virtual void SetFrameId(const int64_t frame_id) { current_frame_id_ = frame_id; }
+  int64_t frame_id() const { return current_frame_id_; }
+
+  // Temporaries of PredictFast and PreForwardFast come from arena, or from frame_arena_own_ with NULL
+  virtual void SetFrameArena(FrameArena* arena);
+
+  // Switch between the fixed and the target-size-adaptive input scale, defaults to ADAPTIVE_INPUT_SCALE
+  void set_adaptive_input_scale(const bool adaptive) { adaptive_input_scale_ = adaptive; }
+
+  // Switch between scoring every candidate with the exact head and the two stage scoring, defaults to CASCADE_SCORING.
+  // The two stages run on the host, so in GPU mode every candidate still goes through the exact head.
+  void set_cascade_scoring(const bool cascade) { cascade_scoring_ = cascade; }
+
+  const CascadeStats& cascade_stats() const { return cascade_stats_; }
+  void ResetCascadeStats() { cascade_stats_ = CascadeStats(); }
+
+  // Blobs of the layers after concat
+  virtual void GetHeadParams(std::vector<caffe::Blob<float>* > *params);
+
+  // pool6 of the target and pool6_c of every candidate (row-major, one row per candidate)
+  virtual void GetPooledFeatures(const cv::Mat& image_curr, const cv::Mat& target, 
+                       const std::vector<BoundingBox> &candidate_bboxes,
+                       std::vector<float> *target_feature,
+                       std::vector<float> *candidate_features);
 
   virtual void PredictFast(const cv::Mat& image_curr, const cv::Mat& image, const cv::Mat& target, 
                        const std::vector<BoundingBox> &candidate_bboxes, const BoundingBox & bbox_prev, 
@@ -71,6 +167,18 @@ class Regressor : public RegressorBase {
                        double sd_trans,
                        int cur_frame); // TODO: remove cur_frame after debugging
 
+  // PreForwardFast of all targets at once, the candidates of target t are rois pooled_begin_[t] onwards
+  virtual void PoolCandidates(const cv::Mat& image_curr, const std::vector<cv::Mat> &targets,
+                       const std::vector<const std::vector<BoundingBox>* > &candidate_bboxes);
+
+  virtual void PredictFastPooled(const int t, const std::vector<BoundingBox> &candidate_bboxes,
+                       const BoundingBox & bbox_prev,
+                       BoundingBox* bbox,
+                       std::vector<float> *return_probabilities, 
+                       std::vector<int> *return_sorted_indexes,
+                       double sd_trans,
+                       int cur_frame);
+
 protected:
   // Set the network inputs.
   void SetImages(const std::vector<cv::Mat>& images,
@@ -79,8 +187,12 @@ protected:
   // Set the candidates inputs at input[2]
   void SetCandidates(const std::vector<cv::Mat>& candidates);
 
-  // Set the rois
-  void set_rois(const std::vector<BoundingBox>& candidate_bboxes, const double scale, const int batch_id = 0);
+  // Set the rois, (offset_x, offset_y) is the origin of the part of image_curr fed to the candidate branch
+  void set_rois(const std::vector<BoundingBox>& candidate_bboxes, const double scale, const int batch_id = 0,
+                const double offset_x = 0, const double offset_y = 0);
+
+  void set_rois(const CandidateSet& candidates, const double scale, const int batch_id = 0,
+                const double offset_x = 0, const double offset_y = 0);
 
   // Get the features corresponding to the output of the network.
   virtual void GetOutput(std::vector<float>* output);
@@ -88,6 +200,9 @@ protected:
   // Get the softmax layer output
   virtual void GetProbOutput(std::vector<float> *output);
 
+  // Same into output, 2 floats per candidate
+  void GetProbOutput(float *output);
+
   // Reshape the image inputs to the network to match the expected size and number of images.
   virtual void ReshapeImageInputs(const size_t num_images);
 
@@ -99,6 +214,41 @@ protected:
                       const cv::Mat & image,
                       const cv::Mat & target);
 
+  // Same for num_targets targets in the target branch, pool6 row t for targets[t]; with several targets roi i
+  // belongs to target head_roi_target_[i]
+  void PreForwardFast(const cv::Mat image_curr, 
+                      const std::vector<BoundingBox> &candidate_bboxes,
+                      const cv::Mat* targets,
+                      const int num_targets);
+
+  // Score candidate_bboxes, the rois roi_begin onwards of the last PreForwardFast, against pool6 row target with
+  // the current head, then estimate as PredictFast
+  void PredictPooled(const int roi_begin, const int target,
+                     const std::vector<BoundingBox> &candidate_bboxes, const BoundingBox & bbox_prev, 
+                     BoundingBox* bbox,
+                     std::vector<float> *return_probabilities, 
+                     std::vector<int> *return_sorted_indexes,
+                     double sd_trans,
+                     int cur_frame);
+
+  // PreForwardFast for several frames at once: the rescaled frames are stacked (zero padded) in the candidate input,
+  // the targets in the target input, and the rois of frame f get batch id f. Fills head_roi_target_.
+  void PreForwardFastBatch(const std::vector<cv::Mat> &image_currs,
+                      const std::vector<std::vector<BoundingBox> > &candidate_bboxes,
+                      const std::vector<cv::Mat> &targets);
+
+  // Rescale frame f by scales[f] into image f of the candidate input, zero padded to the largest of them
+  void SetCandidateFrames(const std::vector<cv::Mat> &image_currs, const std::vector<double> &scales);
+
+  // Scale applied to image_curr before the candidate branch, min side to TARGET_SIZE, max side capped at MAX_SIZE,
+  // or with adaptive_input_scale_ the target (target_size_hint_) to ADAPTIVE_TARGET_SIZE
+  double GetImageScale(const cv::Mat &image_curr);
+
+  // Part of image_curr the candidate branch runs over: the whole frame, or with SEARCH_REGION_BACKBONE
+  // the box bounding all candidates plus SEARCH_REGION_MARGIN network input pixels, clipped to the frame
+  cv::Rect GetBackboneRegion(const cv::Mat &image_curr, const std::vector<BoundingBox> &candidate_bboxes,
+                             const double scale);
+
   // TODO: current wrap WrapOutputBlob is BUGGY!!! check how to copy out memory to cv Mat
   void WrapOutputBlob(const std::string & blob_name, std::vector<cv::Mat>* output_channels);
   
@@ -120,6 +270,21 @@ protected:
   // Find layer index by name, so that we could do forward from to
   int FindLayerIndexByName( const vector<string> & layer_names, const string & target);
 
+  // Copy the current parameters of net_ into pristine_params_
+  void SnapshotParams();
+
+  // Restore the parameters of net_ from pristine_params_ in place
+  void RestoreParams();
+
+  // Forget the conv feature map of the candidate branch, needed when its input or weights are changed elsewhere
+  void InvalidateConvCache();
+
+  // Resolve layer indices and blob pointers of net_ into plan_, must be called whenever net_ is rebuilt
+  void BuildExecutionPlan();
+
+  // Reshape the input blob only if its shape differs from shape, returns true if reshaped
+  bool ReshapeInputIfNeeded(caffe::Blob<float>* blob, const std::vector<int>& shape);
+
   // Batch ML candidate binary softmax estimation
   void Estimate(std::vector<cv::Mat> &images_flattened,
                            std::vector<cv::Mat> &targets_flattened,
@@ -136,6 +301,9 @@ protected:
   // Wrap input according to the given input index, just one image
   void WrapInputLayerGivenIndex(std::vector<cv::Mat>* channels, int input_idx);
 
+  // Wrap the top left size region of image n of the given input
+  void WrapInputLayerGivenIndex(std::vector<cv::Mat>* channels, int input_idx, int n, const cv::Size &size);
+
   // Wrap the input layer of the network in separate cv::Mat objects
   // (one per channel per image, for num_images images).
   void WrapInputLayer(const size_t num_images,
@@ -153,9 +321,44 @@ protected:
   void Preprocess(const std::vector<cv::Mat>& images,
                   std::vector<std::vector<cv::Mat> >* input_channels);
   
+  // Sample img to size (scales as cv::resize) and write it, mean subtracted, to the top left of image n of the
+  // given input, in one pass with input_preprocessor_. Formats it does not handle go through Preprocess.
+  void PreprocessInput(const cv::Mat& img, const cv::Size& size, const double inv_scale_x, const double inv_scale_y,
+                       const int input_idx, const int n);
+  void PreprocessInput(const cv::Mat& img, const cv::Size& size, const int input_idx, const int n);
+
   // Create batch number of copies and Set blob value
   void PreprocessDuplicateIn(std::vector<cv::Mat> &data_to_duplicate, std::vector<std::vector<cv::Mat> >* blob_channels);
 
+  // Forward the fc layers after concat up to end_layer_idx, the target pool6 row is broadcast to all candidates
+  // inside the first inner product instead of being duplicated per candidate. With several pool6 rows,
+  // candidate i uses row head_roi_target_[i]; with target >= 0 only the num_rois rois from roi_begin go through,
+  // all against pool6 row target.
+  void ForwardHeadBroadcast(const int end_layer_idx, const int roi_begin = 0, const int num_rois = -1,
+                            const int target = -1);
+
+  // Backward from start_layer_idx down to the first fc layer after concat, accumulating its weight diff
+  // against the shared target pool6 rows
+  void BackwardHeadBroadcast(const int start_layer_idx);
+
+  // ForwardHeadBroadcast of the num_rois rois from roi_begin against pool6 row target in two stages: every roi
+  // through the head with the first fc layer on the coarse grid of HeadCascade, then the survivors
+  // (HeadCascade::NumSurvivors on the coarse scores weighted by rank_weights, which may be NULL) through the exact
+  // head. probabilities gets the softmax of every roi, exact for the survivors; the others keep their coarse one,
+  // capped so that their weighted score stays below every survivor's. Leaves the head blobs holding the survivors
+  // only.
+  void ForwardHeadCascade(const int end_layer_idx, const int roi_begin, const int num_rois, const int target,
+                          const float *rank_weights, float *probabilities);
+
+  // W_target * pool6 + bias of the first fc layer into head_target_response_, one row per pool6 row
+  void ComputeHeadTargetResponse();
+
+  // head_roi_assign_ for num_rois rois and num_targets pool6 rows, from head_roi_target_ with several targets
+  void SetHeadRoiAssignment(const int num_rois, const int num_targets);
+
+  // At least n ones, on the host or the device following Caffe::mode()
+  const float* HeadOnes(const int n);
+
   // If the parameters of the network have been modified, reinitialize the parameters to their original values.
   virtual void Init();
 
@@ -165,6 +368,18 @@ protected:
   // lock the domain layers
   virtual void LockDomainLayers();
 
+  // Pre-resolved layer ranges and blobs of net_
+  ExecutionPlan plan_;
+
+  // pool6 row (frame) of every candidate when several targets go through the head at once
+  std::vector<int> head_roi_target_;
+
+  // first roi of every target of the last PoolCandidates and the total, empty once another pass ran
+  std::vector<int> pooled_begin_;
+
+  // the candidates of all targets of PoolCandidates, in roi order
+  std::vector<BoundingBox> pooled_bboxes_;
+
  private:
   // Set up a network with the architecture specified in deploy_proto,
   // with the model weights saved in caffe_model.
@@ -189,6 +404,9 @@ protected:
   // Mean image, used to make the input 0-mean.
   cv::Mat mean_;
 
+  // fused resize, mean subtraction and planar write of the network inputs, keeps its tables between calls
+  InputPreprocessor input_preprocessor_;
+
   // Folder containing the model parameters.
   std::string caffe_model_;
 
@@ -198,11 +416,67 @@ protected:
   // Whether the model weights has been modified.
   bool modified_params_;
 
+  // Parameters right after loading caffe_model_, flattened in net_->learnable_params() order
+  std::vector<float> pristine_params_;
+
   // Number of Domains
   int K_;
 
   // Timer.
   HighResTimer hrt_;
+
+  // W_target * pool6 + bias of the first fc layer, one row per target, shared by its candidates. The head blobs
+  // live where the network runs, so that the hand written first fc layer costs no host / device copies.
+  caffe::Blob<float> head_target_response_;
+
+  // one hot target of every roi (num_rois x num_targets), spreads the target responses over the rois and gathers
+  // their diffs back; with the roi count and targets it was built for
+  caffe::Blob<float> head_roi_assign_;
+  int head_roi_assign_rois_;
+  int head_roi_assign_targets_;
+  std::vector<int> head_roi_assign_target_;
+
+  // bias multiplier
+  caffe::Blob<float> head_ones_;
+
+  // candidate part of the first fc layer's weights summed over the blocks of the coarse grid, ForwardHeadCascade
+  std::vector<float> cascade_weight_;
+
+  // sum over the candidates of each target of the first fc layer's top diff
+  caffe::Blob<float> head_diff_sum_;
+
+  // see SetFrameId
+  int64_t current_frame_id_;
+
+  // Frames whose conv maps are currently held by the candidate branch (conv1_c until ROI pooling), frame f at batch
+  // index f, with its id, the scale it was computed at and the part of it that went through. A hit needs the id of
+  // the current frame and the same image, the Mats are kept referenced so that their buffers stay with them while
+  // cached. Empty when nothing is cached.
+  std::vector<cv::Mat> conv_cache_frames_;
+  std::vector<int64_t> conv_cache_frame_ids_;
+  std::vector<double> conv_cache_scales_;
+  std::vector<cv::Rect> conv_cache_regions_;
+
+  // see conv_cache_generation
+  int64_t conv_cache_generation_;
+
+  // scratch for set_rois and the distance penalty of PredictFast
+  CandidateSet candidate_set_;
+  std::vector<float> candidate_distances_;
+
+  // sqrt of the area of the target in image_curr pixels, 0 when unknown
+  double target_size_hint_;
+
+  // Whether GetImageScale follows target_size_hint_
+  bool adaptive_input_scale_;
+
+  // Whether PredictFast scores in two stages
+  bool cascade_scoring_;
+  CascadeStats cascade_stats_;
+
+  // per frame temporaries, taken from the tracker's arena when one is set, every use rewinds it when done
+  FrameArena frame_arena_own_;
+  FrameArena* frame_arena_;
 };
 
 #endif // REGRESSOR_H
@@ -1,5 +1,12 @@
 #include "regressor_base.h"
 
+#include <atomic>
+
 RegressorBase::RegressorBase()
 {
 }
+
+int64_t RegressorBase::NewFrameId() {
+  static std::atomic<int64_t> next_frame_id(0);
+  return next_frame_id++;
+}
@@ -6,10 +6,12 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <boost/shared_ptr.hpp>
 #include <vector>
+#include <stdint.h>
 
 #include <caffe/caffe.hpp>
 
 class BoundingBox;
+class FrameArena;
 
 // A neural network for the tracker must inherit from this class.
 class RegressorBase
@@ -31,8 +33,16 @@ public:
                        std::vector<float> *return_probabilities, 
                        std::vector<int> *return_sorted_indexes) = 0;
 
+  // ROI features used for bounding box regression, one row of BBOX_REGRESSION_FEATURE_LENGTH floats per candidate,
+  // written to features which must hold candidate_bboxes.size() rows
   virtual void GetBBoxConvFeatures(const cv::Mat& image_curr, const cv::Mat& image, const cv::Mat& target, 
-                       const std::vector<BoundingBox> &candidate_bboxes, std::vector <std::vector<float> > &features) = 0;
+                       const std::vector<BoundingBox> &candidate_bboxes, float *features) = 0;
+
+  // Pooled features fed to the fc head: the target's and one row per candidate, kept for head-only fine-tuning
+  virtual void GetPooledFeatures(const cv::Mat& image_curr, const cv::Mat& target, 
+                       const std::vector<BoundingBox> &candidate_bboxes,
+                       std::vector<float> *target_feature,
+                       std::vector<float> *candidate_features) = 0;
   
   // Predict faster, with ROI pooling
   virtual void PredictFast(const cv::Mat& image_curr, const cv::Mat& image, const cv::Mat& target, 
@@ -43,6 +53,48 @@ public:
                        double sd_trans,
                        int cur_frame) = 0;
 
+  // Several targets of one frame on one ROI pooling: the target branch runs on all of targets and the candidates of
+  // every target, candidate_bboxes[t] for targets[t], are pooled together. PredictFastPooled then scores the
+  // candidates of target t with the current head, as PredictFast would, until the next call that runs the network.
+  virtual void PoolCandidates(const cv::Mat& image_curr, const std::vector<cv::Mat> &targets,
+                       const std::vector<const std::vector<BoundingBox>* > &candidate_bboxes) = 0;
+
+  virtual void PredictFastPooled(const int t, const std::vector<BoundingBox> &candidate_bboxes,
+                       const BoundingBox & bbox_prev,
+                       BoundingBox* bbox,
+                       std::vector<float> *return_probabilities, 
+                       std::vector<int> *return_sorted_indexes,
+                       double sd_trans,
+                       int cur_frame) = 0;
+
+  // Learnable blobs of the fc head (fc6 onwards), the only weights changed by online fine tuning
+  virtual void GetHeadParams(std::vector<caffe::Blob<float>* > *params) = 0;
+
+  // Size of the target being tracked, networks whose input scale depends on it override this
+  virtual void SetTargetSizeHint(const BoundingBox &bbox) { }
+
+  // A process wide unique id for a frame about to be handed to the network, see SetFrameId
+  static int64_t NewFrameId();
+
+  // Frame the image_curr of the following calls belongs to. Networks may reuse per frame work (e.g. the conv map)
+  // between calls made with the same id, so a new frame needs a new id even if it lands in the buffer of an old one;
+  // -1 reuses nothing.
+  virtual void SetFrameId(const int64_t frame_id) { }
+
+  // Run the backbone of several frames (e.g. of independent sequences) as one batch ahead of scoring them one by
+  // one, frame f has id frame_ids[f] and size_hints[f] is its target. Networks without a shared backbone cache
+  // ignore it.
+  virtual void ForwardBackboneBatch(const std::vector<cv::Mat> &image_currs, const std::vector<int64_t> &frame_ids,
+                                    const std::vector<BoundingBox> &size_hints) { }
+
+  // Number of backbone passes that refilled the conv cache so far, 0 for networks without one. Callers of
+  // ForwardBackboneBatch check with it that their frames were scored from the batch.
+  virtual int64_t conv_cache_generation() const { return 0; }
+
+  // Scratch memory of the frame being tracked, reset by the tracker at the end of the frame; NULL for the
+  // network's own. Networks that take their per frame temporaries from an arena override this.
+  virtual void SetFrameArena(FrameArena* arena) { }
+
   // Called at the beginning of tracking a new object to initialize the network.
   virtual void Init() { }
 
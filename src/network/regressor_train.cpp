@@ -2,6 +2,7 @@
 #include <iostream>
 #include <fstream>
 #include <unordered_set>
+#include <algorithm>
 
 const int kNumInputs = 4;
 const bool kDoTrain = true;
@@ -26,6 +27,7 @@ RegressorTrain::RegressorTrain(const std::string& deploy_proto,
     loss_save_path_("")
 {
   solver_.set_net(net_);
+  solver_.snapshot_history();
 }
 
 
@@ -39,6 +41,7 @@ RegressorTrain::RegressorTrain(const std::string& deploy_proto,
     loss_save_path_("")
 {
   solver_.set_net(net_);
+  solver_.snapshot_history();
 }
 
 RegressorTrain::RegressorTrain(const std::string& deploy_proto,
@@ -50,6 +53,7 @@ RegressorTrain::RegressorTrain(const std::string& deploy_proto,
     loss_save_path_("")
 {
   solver_.set_net(net_);
+  solver_.snapshot_history();
 }
 
 RegressorTrain::RegressorTrain(const std::string& deploy_proto,
@@ -63,15 +67,27 @@ RegressorTrain::RegressorTrain(const std::string& deploy_proto,
     loss_save_path_(loss_save_path)
 {
   solver_.set_net(net_);
+  solver_.snapshot_history();
 }
 
 void RegressorTrain::ResetSolverNet() {
-  // TODO: if reload a new solver and assign to solver_ makes memory go down, but need to change solver_ to be a shared_ptr
-
-  // free the memory pointed in solver_.net_ 
-  solver_.reset_net();
+  // net_ is restored in place by Reset(), so the solver keeps pointing at it, only the momentum goes back
   solver_.set_net(net_);
+  solver_.restore_history();
+}
 
+void RegressorTrain::GetHeadHistory(std::vector<caffe::Blob<float>* > *history) {
+  std::vector<Blob<float>* > head_params;
+  GetHeadParams(&head_params);
+
+  // the solver keeps one history blob per learnable param, in the same order
+  const vector<Blob<float>* > & params = net_->learnable_params();
+  history->clear();
+  for (int i = 0; i < head_params.size(); i++) {
+    const int idx = std::find(params.begin(), params.end(), head_params[i]) - params.begin();
+    CHECK_LT(idx, params.size()) << "head blob " << i << " is not a learnable param";
+    history->push_back(solver_.history()[idx].get());
+  }
 }
 
 void RegressorTrain::set_test_net(const std::string& test_proto) {
@@ -112,14 +128,12 @@ void RegressorTrain::set_bboxes_gt(const std::vector<BoundingBox>& bboxes_gt) {
 void RegressorTrain::set_labels(const std::vector<double>  &labels_flattened) {
   assert(net_->phase() == caffe::TRAIN);
 
-  Blob<float> * input_label_blob = net_->input_blobs()[LABEL_NETWORK_INPUT_IDX];
+  Blob<float> * input_label_blob = plan_.input_label;
   const size_t num_labels = labels_flattened.size();
 
   // reshape to (|R|, 1)
-  std::vector<int> shape;
-  shape.push_back(num_labels);
-  shape.push_back(1);
-  input_label_blob->Reshape(shape);
+  plan_.label_shape[0] = num_labels;
+  ReshapeInputIfNeeded(input_label_blob, plan_.label_shape);
   
   // get a pointer to the label input blob memory.
   float* input_label_data = input_label_blob->mutable_cpu_data();
@@ -163,15 +177,26 @@ void RegressorTrain::TrainBatchFast(const std::vector<cv::Mat>& image_currs,
                            const std::vector<std::vector<double> > &labels,
                            int k,
                            int inner_batch_size,
-                           int num_nohem) {
+                           int num_nohem,
+                           int frames_per_batch) {
     // make sure same number of inputs, images.size() is kBatchSize
     assert (images.size() == image_currs.size());
     assert (images.size() == targets.size());
     assert (images.size() == candidate_bboxes.size());
     assert (images.size() == labels.size());
 
+    if (frames_per_batch > 1) {
+      TrainBatchFastMultiFrame(image_currs, targets, candidate_bboxes, labels, k, inner_batch_size, num_nohem, frames_per_batch);
+      return;
+    }
+
+    // without a frame id from the caller, the inner batches of each image still share its conv map
+    const int64_t frame_id = this->frame_id();
     for (int i = 0; i< candidate_bboxes.size(); i++) {
       assert (candidate_bboxes[i].size() == labels[i].size());
+      if (frame_id < 0) {
+        SetFrameId(NewFrameId());
+      }
       const std::vector<BoundingBox> &this_image_candidates = candidate_bboxes[i];
       const std::vector<double> &this_image_labels = labels[i];
       const cv::Mat &this_image = images[i];
@@ -194,6 +219,160 @@ void RegressorTrain::TrainBatchFast(const std::vector<cv::Mat>& image_currs,
                           num_nohem);
         }
     }
+    SetFrameId(frame_id);
+}
+
+void RegressorTrain::TrainBatchFastMultiFrame(const std::vector<cv::Mat>& image_currs,
+                           const std::vector<cv::Mat>& targets,
+                           const std::vector<std::vector<BoundingBox> > &candidate_bboxes,
+                           const std::vector<std::vector<double> > &labels,
+                           int k,
+                           int inner_batch_size,
+                           int num_nohem,
+                           int frames_per_batch) {
+    // inner batch j of frames_per_batch consecutive frames goes through one forward/backward and one solver step
+    for (int first = 0; first < candidate_bboxes.size(); first += frames_per_batch) {
+      const int last = std::min(first + frames_per_batch, (int)candidate_bboxes.size());
+
+      int max_inner_batches = 0;
+      for (int i = first; i < last; i++) {
+        assert (candidate_bboxes[i].size() == labels[i].size());
+        max_inner_batches = std::max(max_inner_batches, (int)candidate_bboxes[i].size() / inner_batch_size);
+      }
+
+      for (int j = 0; j < max_inner_batches; j ++) {
+        std::vector<cv::Mat> this_image_currs;
+        std::vector<cv::Mat> this_targets;
+        std::vector<std::vector<BoundingBox> > this_candidates;
+        std::vector<double> this_labels_flattened;
+
+        // frames with fewer candidates simply sit out the last inner batches
+        for (int i = first; i < last; i++) {
+          if ((j + 1) * inner_batch_size > candidate_bboxes[i].size()) {
+            continue;
+          }
+          this_image_currs.push_back(image_currs[i]);
+          this_targets.push_back(targets[i]);
+          this_candidates.push_back(std::vector<BoundingBox>(candidate_bboxes[i].begin() + j*inner_batch_size, 
+                                                              candidate_bboxes[i].begin() + (j+1)*inner_batch_size));
+          this_labels_flattened.insert(this_labels_flattened.end(), labels[i].begin() + j*inner_batch_size, 
+                                       labels[i].begin() + (j+1)*inner_batch_size);
+        }
+
+        // hard negatives are mined over the whole mini batch, num_nohem of them per frame
+        TrainForwardBackwardBatch(this_image_currs,
+                          this_candidates,
+                          this_labels_flattened,
+                          this_targets,
+                          k,
+                          num_nohem == -1 ? -1 : num_nohem * (int)this_image_currs.size());
+      }
+    }
+}
+
+void RegressorTrain::TrainBatchFromFeatures(const std::vector<const float*> &target_features,
+                           const std::vector<std::vector<const float*> > &candidate_features,
+                           const std::vector<std::vector<double> > &labels,
+                           int inner_batch_size,
+                           int frames_per_batch) {
+    assert (target_features.size() == candidate_features.size());
+    assert (target_features.size() == labels.size());
+
+    // inner batch j of frames_per_batch consecutive frames makes one step, 
+    // same batching as TrainBatchFast, trailing candidates that do not fill an inner batch are dropped
+    for (int first = 0; first < candidate_features.size(); first += frames_per_batch) {
+      const int last = std::min(first + frames_per_batch, (int)candidate_features.size());
+
+      int max_inner_batches = 0;
+      for (int i = first; i < last; i++) {
+        assert (candidate_features[i].size() == labels[i].size());
+        max_inner_batches = std::max(max_inner_batches, (int)candidate_features[i].size() / inner_batch_size);
+      }
+
+      for (int j = 0; j < max_inner_batches; j ++) {
+        std::vector<const float*> this_targets;
+        std::vector<const float*> this_candidates;
+        std::vector<int> this_candidate_targets;
+        std::vector<double> this_labels;
+
+        for (int i = first; i < last; i++) {
+          if ((j + 1) * inner_batch_size > candidate_features[i].size()) {
+            continue;
+          }
+          this_candidates.insert(this_candidates.end(), candidate_features[i].begin() + j*inner_batch_size,
+                                 candidate_features[i].begin() + (j+1)*inner_batch_size);
+          this_labels.insert(this_labels.end(), labels[i].begin() + j*inner_batch_size, 
+                             labels[i].begin() + (j+1)*inner_batch_size);
+          this_candidate_targets.insert(this_candidate_targets.end(), inner_batch_size, (int)this_targets.size());
+          this_targets.push_back(target_features[i]);
+        }
+
+        TrainHeadForwardBackward(this_targets, this_candidates, this_candidate_targets, this_labels);
+      }
+    }
+}
+
+void RegressorTrain::TrainHeadForwardBackward(const std::vector<const float*> &target_features,
+                           const std::vector<const float*> &candidate_features,
+                           const std::vector<int> &candidate_targets,
+                           const std::vector<double> &labels) {
+  const int num_rois = candidate_features.size();
+  const int num_targets = target_features.size();
+  assert(num_rois == labels.size());
+  assert(num_rois == candidate_targets.size());
+
+  net_->ClearParamDiffs();
+
+  Blob<float>* pool6 = plan_.pool6;
+  Blob<float>* pool6_c = plan_.pool6_c;
+  const int dim_target = pool6->count(1);
+  const int dim_candidate = pool6_c->count(1);
+
+  std::vector<int> shape_pool6_c = pool6_c->shape();
+  shape_pool6_c[0] = num_rois;
+  pool6_c->Reshape(shape_pool6_c);
+  float* pool6_c_data = pool6_c->mutable_cpu_data();
+  for (int i = 0; i < num_rois; i++) {
+    caffe::caffe_copy(dim_candidate, candidate_features[i], pool6_c_data + i * dim_candidate);
+  }
+
+  set_labels(labels);
+
+#ifdef BROADCAST_TARGET_FEATURE
+  std::vector<int> shape_pool6 = pool6->shape();
+  shape_pool6[0] = num_targets;
+  pool6->Reshape(shape_pool6);
+  float* pool6_data = pool6->mutable_cpu_data();
+  for (int t = 0; t < num_targets; t++) {
+    caffe::caffe_copy(dim_target, target_features[t], pool6_data + t * dim_target);
+  }
+  head_roi_target_ = candidate_targets;
+
+  ForwardHeadBroadcast(plan_.last_idx);
+  BackwardHeadBroadcast(plan_.last_idx);
+#else
+  std::vector<int> shape_pool6 = pool6->shape();
+  shape_pool6[0] = num_rois;
+  pool6->Reshape(shape_pool6);
+  float* pool6_data = pool6->mutable_cpu_data();
+  for (int i = 0; i < num_rois; i++) {
+    caffe::caffe_copy(dim_target, target_features[candidate_targets[i]], pool6_data + i * dim_target);
+  }
+
+  net_->ForwardFrom(plan_.concat_idx);
+  net_->BackwardTo(plan_.concat_idx);
+#endif
+
+  solver_.apply_update();
+  solver_.increment_iter_save_snapshot();
+
+  if (loss_save_path_.length() != 0) {
+    std::vector<float> this_loss_output;
+    GetFeatures("loss", &this_loss_output);
+    loss_history_.push_back(this_loss_output[0]);
+  }
+
+  InvokeSaveLossIfNeeded();
 }
 
 void RegressorTrain::TrainForwardBackwardWorker(const cv::Mat & image_curr,
@@ -211,12 +390,9 @@ void RegressorTrain::TrainForwardBackwardWorker(const cv::Mat & image_curr,
   
   net_->ClearParamDiffs(); // clear the previous param diff
 
-  // forward until concat and prepare duplicated images and targets for keep forwarding
+  // forward until concat, target pool6 is either broadcast in the head or duplicated for keep forwarding
   PreForwardFast(image_curr, candidates_bboxes, image, target);
 
-  // now put the labels ready
-  set_labels(labels);
-
 #ifdef DEBUG_ROI_POOL_INPUT
   std::vector<cv::Mat> image_curr_scaled_splitted;
   WrapOutputBlob("candidate", &image_curr_scaled_splitted);
@@ -269,6 +445,26 @@ void RegressorTrain::TrainForwardBackwardWorker(const cv::Mat & image_curr,
   cv::imshow("rois on scaled image:", image_curr_scale_origin);
   cv::waitKey(0);
 #endif
+
+  TrainHeadWorker(labels, num_nohem);
+}
+
+void RegressorTrain::TrainForwardBackwardBatchWorker(const std::vector<cv::Mat> &image_currs,
+                          const std::vector<std::vector<BoundingBox> > &candidates_bboxes, 
+                          const std::vector<double> &labels_flattened,
+                          const std::vector<cv::Mat> &targets,
+                          int num_nohem) {
+  net_->ClearParamDiffs(); // clear the previous param diff
+
+  // forward all frames until concat in one pass, rois tagged with their frame
+  PreForwardFastBatch(image_currs, candidates_bboxes, targets);
+
+  TrainHeadWorker(labels_flattened, num_nohem);
+}
+
+void RegressorTrain::TrainHeadWorker(const std::vector<double> &labels, int num_nohem) {
+  // now put the labels ready
+  set_labels(labels);
   
   // // TODO: check if just put in will be faster as the following instead of calling set_labels
   // Blob<float> * input_label_blob = net_->input_blobs()[3];
@@ -278,26 +474,29 @@ void RegressorTrain::TrainForwardBackwardWorker(const cv::Mat & image_curr,
   //   input_label_data[i] = labels[i];
   // }
 
-  const std::vector<string> & layer_names = net_->layer_names();
-  int layer_pool5_concat_idx = FindLayerIndexByName(layer_names, "concat");
-  int layer_loss_idx = FindLayerIndexByName(layer_names, "loss");
-  int layer_fc8_idx = FindLayerIndexByName(layer_names, "fc8");
+  const int layer_pool5_concat_idx = plan_.concat_idx;
+  const int layer_loss_idx = plan_.loss_idx;
+  const int layer_fc8_idx = plan_.fc8_idx;
+  const int layer_last_idx = plan_.last_idx;
   
   if (num_nohem != -1) {
+#ifdef BROADCAST_TARGET_FEATURE
+    ForwardHeadBroadcast(layer_last_idx);
+#else
     net_->ForwardFrom(layer_pool5_concat_idx);
+#endif
     
     // record probs
     std::vector<float> probs;
     GetProbOutput(&probs);
     std::vector<float> positive_probs;
-    for (int i = 0; i < candidates_bboxes.size(); i ++) {
+    for (int i = 0; i < labels.size(); i ++) {
       positive_probs.push_back(probs[2*i + 1]);
     }
     net_->BackwardFromTo(layer_loss_idx, layer_loss_idx);
 
     // conduct online hard example mining
-    string fc8_blob_name = "fc8";
-    const boost::shared_ptr<Blob<float> > blob_to_set_diff = net_->blob_by_name(fc8_blob_name.c_str());
+    Blob<float>* blob_to_set_diff = plan_.fc8;
     float * diff_begin = blob_to_set_diff->mutable_cpu_diff();
     float * diff_end = diff_begin + blob_to_set_diff->count();
     std::vector<float> loss_diff_val(diff_begin, diff_end);
@@ -305,7 +504,7 @@ void RegressorTrain::TrainForwardBackwardWorker(const cv::Mat & image_curr,
     std::vector<int> neg_bag;
     std::vector<float> neg_probs;
     unordered_set<int> backprop_idxes;
-    for (int i = 0; i < candidates_bboxes.size(); i ++) {
+    for (int i = 0; i < labels.size(); i ++) {
       if (labels[i] == POS_LABEL) {
         // back prop all the positive ones
         backprop_idxes.insert(i);
@@ -328,7 +527,7 @@ void RegressorTrain::TrainForwardBackwardWorker(const cv::Mat & image_curr,
     }
     
     // set the mutable diff blob data
-    for (int i = 0; i < candidates_bboxes.size(); i ++) {
+    for (int i = 0; i < labels.size(); i ++) {
       // back prop only for hard examples
       if (backprop_idxes.find(i) == backprop_idxes.end()) {
         // set the gradients to be zero for non hard examples
@@ -336,11 +535,20 @@ void RegressorTrain::TrainForwardBackwardWorker(const cv::Mat & image_curr,
         diff_begin[2*i + 1] = 0;
       }
     }
+#ifdef BROADCAST_TARGET_FEATURE
+    BackwardHeadBroadcast(layer_fc8_idx);
+#else
     net_->BackwardFromTo(layer_fc8_idx, layer_pool5_concat_idx);
+#endif
   }
   else {
+#ifdef BROADCAST_TARGET_FEATURE
+    ForwardHeadBroadcast(layer_last_idx);
+    BackwardHeadBroadcast(layer_last_idx);
+#else
     net_->ForwardFrom(layer_pool5_concat_idx);
     net_->BackwardTo(layer_pool5_concat_idx);
+#endif
   }
 
   
@@ -350,6 +558,18 @@ void RegressorTrain::TrainForwardBackwardWorker(const cv::Mat & image_curr,
   solver_.increment_iter_save_snapshot();
 }
 
+void RegressorTrain::SetDomainLayerPropagateDown(int k, bool propagate_down) {
+  string this_layer_name = FREEZE_LAYER_PREFIX + std::to_string(k);
+  const boost::shared_ptr<Layer<float> > layer_pt = net_->layer_by_name(this_layer_name);
+
+  if (layer_pt->param_propagate_down(0) != propagate_down) {
+    layer_pt->set_param_propagate_down(0, propagate_down);
+  }
+  if (layer_pt->param_propagate_down(1) != propagate_down) {
+    layer_pt->set_param_propagate_down(1, propagate_down);
+  }
+}
+
 void RegressorTrain::TrainForwardBackward( const cv::Mat & image_curr,
                           const std::vector<BoundingBox> &candidates_bboxes, 
                           const std::vector<double> &labels_flattened,
@@ -360,40 +580,15 @@ void RegressorTrain::TrainForwardBackward( const cv::Mat & image_curr,
     assert(candidates_bboxes.size() == labels_flattened.size());
     
     if (k != -1) {
-      // Usual Training, need to freeze layers
-      string this_layer_name = FREEZE_LAYER_PREFIX + std::to_string(k);
-
-      // unlock this layer
-      const boost::shared_ptr<Layer<float> > layer_pt = net_->layer_by_name(this_layer_name);
-
-      if (!layer_pt->param_propagate_down(0)) {
-        layer_pt->set_param_propagate_down(0, true);
-      }
-      if (!layer_pt->param_propagate_down(1)) {
-        layer_pt->set_param_propagate_down(1, true);
-      }
+      // Usual Training, need to freeze layers, unlock this layer
+      SetDomainLayerPropagateDown(k, true);
       
       TrainForwardBackwardWorker(image_curr, candidates_bboxes, labels_flattened, image, target, k, num_nohem);
 
       //lock this layer back
-      // cout << this_layer_name << " freeze back" << endl;
-      if (layer_pt->param_propagate_down(0)) {
-        layer_pt->set_param_propagate_down(0, false);
-      }
-      if (layer_pt->param_propagate_down(1)) {
-        layer_pt->set_param_propagate_down(1, false);
-      }
+      SetDomainLayerPropagateDown(k, false);
     }
     else {
-      // // make sure that weights are actually updated
-      // const std::vector<boost::shared_ptr<Blob<float> > > & net_params = net_->params();
-      // cout << "net_params.size():" << net_params.size() << endl;
-      // std::vector<float> fc6_gmd_weights_before;
-      // Blob<float> *ptr = net_params[36].get();
-      // const float* begin = ptr->cpu_data();
-      // const float* end = begin + ptr->count();
-      // fc6_gmd_weights_before = std::vector<float>(begin, end);
-      
       TrainForwardBackwardWorker(image_curr, candidates_bboxes, labels_flattened, image, target, k, num_nohem);
 
       if (loss_save_path_.length() != 0) {
@@ -406,6 +601,30 @@ void RegressorTrain::TrainForwardBackward( const cv::Mat & image_curr,
     }
 }
 
+void RegressorTrain::TrainForwardBackwardBatch(const std::vector<cv::Mat> &image_currs,
+                          const std::vector<std::vector<BoundingBox> > &candidates_bboxes, 
+                          const std::vector<double> &labels_flattened,
+                          const std::vector<cv::Mat> &targets,
+                          int k,
+                          int num_nohem) {
+    if (k != -1) {
+      SetDomainLayerPropagateDown(k, true);
+      TrainForwardBackwardBatchWorker(image_currs, candidates_bboxes, labels_flattened, targets, num_nohem);
+      SetDomainLayerPropagateDown(k, false);
+    }
+    else {
+      TrainForwardBackwardBatchWorker(image_currs, candidates_bboxes, labels_flattened, targets, num_nohem);
+
+      if (loss_save_path_.length() != 0) {
+        std::vector<float> this_loss_output;
+        GetFeatures("loss", &this_loss_output);
+        loss_history_.push_back(this_loss_output[0]);
+      }
+
+      InvokeSaveLossIfNeeded();
+    }
+}
+
 void RegressorTrain::TrainBatch(const std::vector<cv::Mat>& images,
                            const std::vector<cv::Mat>& targets,
                            const std::vector<BoundingBox>& bboxes_gt,
@@ -60,6 +60,20 @@ public:
                           const cv::Mat & target,
                           int k,
                           int num_nohem);
+
+  // Several frames in one forward/backward and one solver step, candidates_bboxes[f] belong to image_currs[f]
+  void TrainForwardBackwardBatch(const std::vector<cv::Mat> &image_currs,
+                          const std::vector<std::vector<BoundingBox> > &candidates_bboxes, 
+                          const std::vector<double> &labels_flattened,
+                          const std::vector<cv::Mat> &targets,
+                          int k,
+                          int num_nohem);
+
+  void TrainForwardBackwardBatchWorker(const std::vector<cv::Mat> &image_currs,
+                          const std::vector<std::vector<BoundingBox> > &candidates_bboxes, 
+                          const std::vector<double> &labels_flattened,
+                          const std::vector<cv::Mat> &targets,
+                          int num_nohem);
   
   // Forward and Backward. TODO: add Online Hard Example Mining
   void TrainBatchFast(const std::vector<cv::Mat>& image_currs,
@@ -70,7 +84,32 @@ public:
                            const std::vector<std::vector<double> > &labels,
                            int k,
                            int inner_batch_size = INNER_BATCH_SIZE,
-                           int num_nohem = -1);
+                           int num_nohem = -1,
+                           int frames_per_batch = 1);
+
+  // TrainBatchFast with frames_per_batch > 1, inner batch j of a group of frames is one step
+  void TrainBatchFastMultiFrame(const std::vector<cv::Mat>& image_currs,
+                           const std::vector<cv::Mat>& targets,
+                           const std::vector<std::vector<BoundingBox> > &candidate_bboxes,
+                           const std::vector<std::vector<double> > &labels,
+                           int k,
+                           int inner_batch_size,
+                           int num_nohem,
+                           int frames_per_batch);
+
+  // Head-only fine tuning from pooled features, one step per inner batch of each group of frames_per_batch frames
+  void TrainBatchFromFeatures(const std::vector<const float*> &target_features,
+                           const std::vector<std::vector<const float*> > &candidate_features,
+                           const std::vector<std::vector<double> > &labels,
+                           int inner_batch_size = INNER_BATCH_SIZE,
+                           int frames_per_batch = 1);
+
+  // Put the pooled features in pool6/pool6_c, then forward and backward the fc head and apply the update,
+  // candidate i is paired with target_features[candidate_targets[i]]
+  void TrainHeadForwardBackward(const std::vector<const float*> &target_features,
+                           const std::vector<const float*> &candidate_features,
+                           const std::vector<int> &candidate_targets,
+                           const std::vector<double> &labels);
 
   // Implementing the TrainBatch Interface
   void TrainBatch(const std::vector<cv::Mat>& images,
@@ -94,10 +133,20 @@ public:
   // Reset the solver's net to this->net_ initialised from regressor 
   void ResetSolverNet();
 
+  // Implementing the head momentum Interface
+  void GetHeadHistory(std::vector<caffe::Blob<float>* > *history);
+
 private:
   // Train the network.
   void Step();
 
+  // set_labels, forward and backward the head from the pooled features already in place, with online hard
+  // example mining if num_nohem != -1, then apply the update
+  void TrainHeadWorker(const std::vector<double> &labels, int num_nohem);
+
+  // Unlock (true) or lock back (false) the domain specific layer of domain k
+  void SetDomainLayerPropagateDown(int k, bool propagate_down);
+
   // Set the ground-truth bounding boxes (for training).
   void set_bboxes_gt(const std::vector<BoundingBox>& bboxes_gt);
 
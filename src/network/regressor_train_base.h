@@ -10,6 +10,7 @@
 
 #include <caffe/caffe.hpp>
 #include <caffe/sgd_solvers.hpp>
+#include <caffe/util/math_functions.hpp>
 
 #include "helper/bounding_box.h"
 #include "network/regressor_base.h"
@@ -57,6 +58,30 @@ public:
   void reset_net() {
     net_.reset(); // decrease reference count to have the memory deallocated
   }
+
+  // Keep a copy of the momentum history, restore_history() puts it back without rebuilding the solver
+  void snapshot_history() {
+    history_snapshot_.resize(history_.size());
+    for (int i = 0; i < history_.size(); i++) {
+      const float* begin = history_[i]->cpu_data();
+      history_snapshot_[i].assign(begin, begin + history_[i]->count());
+    }
+  }
+
+  // Momentum of each of the net's learnable params, in net_->learnable_params() order
+  const std::vector<boost::shared_ptr<caffe::Blob<float> > >& history() const {
+    return history_;
+  }
+
+  void restore_history() {
+    CHECK_EQ(history_snapshot_.size(), history_.size());
+    for (int i = 0; i < history_.size(); i++) {
+      caffe::caffe_copy(history_[i]->count(), history_snapshot_[i].data(), history_[i]->mutable_cpu_data());
+    }
+  }
+
+private:
+  std::vector<std::vector<float> > history_snapshot_;
 };
 
 // The class used to train the tracker should inherit from this class.
@@ -70,7 +95,7 @@ public:
              const std::vector<cv::Mat>& targets,
              const std::vector<BoundingBox>& bboxes_gt) = 0;
   
-  // Use forward and backward
+  // Use forward and backward, frames_per_batch > 1 stacks that many frames into one step via roi batch ids
   virtual void TrainBatchFast(const std::vector<cv::Mat>& image_currs,
                            const std::vector<cv::Mat>& images,
                            const std::vector<cv::Mat>& targets,
@@ -79,7 +104,17 @@ public:
                            const std::vector<std::vector<double> > &labels,
                            int k,
                            int inner_batch_size = INNER_BATCH_SIZE,
-                           int num_nohem = -1) = 0;
+                           int num_nohem = -1,
+                           int frames_per_batch = 1) = 0;
+
+  // Fine tune only the fc head from pooled features (see RegressorBase::GetPooledFeatures), 
+  // candidate_features[i] are pointers to the rows of frame i, sharing target_features[i].
+  // frames_per_batch frames go into each solver step.
+  virtual void TrainBatchFromFeatures(const std::vector<const float*> &target_features,
+                           const std::vector<std::vector<const float*> > &candidate_features,
+                           const std::vector<std::vector<double> > &labels,
+                           int inner_batch_size = INNER_BATCH_SIZE,
+                           int frames_per_batch = 1) = 0;
 
   // Train the tracker, GOTURN, MDNet, k = -1 indicating Fine Tuning
   virtual void TrainBatch(const std::vector<cv::Mat>& images,
@@ -97,6 +132,9 @@ public:
   // Interface to reset solver's net
   virtual void ResetSolverNet() = 0;
 
+  // Solver momentum of the blobs of RegressorBase::GetHeadParams, in the same order
+  virtual void GetHeadHistory(std::vector<caffe::Blob<float>* > *history) = 0;
+
 protected:
   MySolver solver_;
 
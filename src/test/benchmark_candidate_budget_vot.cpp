@@ -0,0 +1,103 @@
+// Compare the fixed and the confidence-adaptive candidate budget of TrackerGMD (ADAPTIVE_CANDIDATE_BUDGET) on VOT:
+// candidates scored per frame, fps, and the mean IOU / success rate delta.
+
+#include <string>
+#include <caffe/caffe.hpp>
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "network/regressor.h"
+#include "loader/loader_vot.h"
+#include "tracker/tracker.h"
+#include "tracker/tracker_gmd.h"
+#include "tracker/tracker_manager.h"
+
+// for fine tuning
+#include "network/regressor_train.h"
+#include "train/example_generator.h"
+
+using std::string;
+
+struct PassResult {
+  BenchmarkTotals totals;
+  CandidateBudgetStats stats;
+};
+
+// Track all videos with the given candidate budget
+PassResult RunPass(const CandidateBudget& budget, const std::vector<Video>& videos, const BenchmarkSetup& setup) {
+  PassResult result;
+  const string description = budget.adaptive ? "candidate budget: adaptive" : "candidate budget: fixed";
+  result.totals = RunBenchmarkPass(videos, setup, description,
+                                   [&budget](RegressorTrain* regressor_train, TrackerGMD* tracker_gmd) {
+                                     tracker_gmd->set_candidate_budget(budget);
+                                   },
+                                   [&result](const RegressorTrain& regressor_train, const TrackerGMD& tracker_gmd) {
+                                     result.stats = tracker_gmd.candidate_budget_stats();
+                                   });
+  return result;
+}
+
+int main (int argc, char *argv[]) {
+  if (argc < 9) {
+    std::cerr << "Usage: " << argv[0]
+              << " deploy.prototxt network.caffemodel solver_file videos_folder LAMBDA_SHIFT LAMBDA_SCALE MIN_SCALE MAX_SCALE"
+              << " [gpu_id] [min_candidates] [max_candidates] [log_frames(0/1)]" << std::endl;
+    return 1;
+  }
+
+  ::google::InitGoogleLogging(argv[0]);
+
+  BenchmarkSetup setup;
+  setup.model_file   = argv[1];
+  setup.trained_file = argv[2];
+  setup.solver_file  = argv[3];
+  const string& videos_folder = argv[4];
+  setup.lambda_shift = atof(argv[5]);
+  setup.lambda_scale = atof(argv[6]);
+  setup.min_scale    = atof(argv[7]);
+  setup.max_scale    = atof(argv[8]);
+
+  setup.gpu_id = 0;
+  if (argc >= 10) {
+    setup.gpu_id = atoi(argv[9]);
+  }
+
+  CandidateBudget adaptive;
+  adaptive.adaptive = true;
+  if (argc >= 11) {
+    adaptive.min_candidates = atoi(argv[10]);
+  }
+  if (argc >= 12) {
+    adaptive.max_candidates = atoi(argv[11]);
+  }
+  if (argc >= 13) {
+    adaptive.log = atoi(argv[12]) != 0;
+  }
+  CandidateBudget fixed(adaptive);
+  fixed.adaptive = false;
+
+  LoaderVOT loader(videos_folder);
+  std::vector<Video> videos = loader.get_videos();
+
+  const PassResult fixed_result = RunPass(fixed, videos, setup);
+  const PassResult adaptive_result = RunPass(adaptive, videos, setup);
+
+  const PassResult* results[2] = {&fixed_result, &adaptive_result};
+  const char* names[2] = {"fixed", "adaptive"};
+  printf("%-10s %8s %11s %8s %8s %9s %9s\n", "budget", "frames", "candidates", "rounds", "fps", "mean IOU", "success");
+  for (int i = 0; i < 2; i++) {
+    const PassResult &r = *results[i];
+    const int frames = std::max(r.stats.frames, 1);
+    printf("%-10s %8d %11.1lf %8.2lf %8.2lf %9.3lf %9.3lf\n", names[i], r.totals.frames,
+           double(r.stats.candidates) / frames, double(r.stats.rounds) / frames, r.totals.fps, r.totals.mean_iou,
+           r.totals.success);
+  }
+  const BenchmarkTotals &fixed_totals = fixed_result.totals;
+  const BenchmarkTotals &adaptive_totals = adaptive_result.totals;
+  printf("delta: mean IOU %+.4lf, success %+.4lf, fps x%.2lf\n", adaptive_totals.mean_iou - fixed_totals.mean_iou,
+         adaptive_totals.success - fixed_totals.success, fixed_totals.fps > 0 ? adaptive_totals.fps / fixed_totals.fps : 0);
+
+  return 0;
+}
@@ -0,0 +1,80 @@
+// Compare scoring every candidate with the exact head and the two stage scoring (CASCADE_SCORING) on VOT:
+// first fc layer multiply-adds saved, fps, and the mean IOU / success rate delta.
+
+#include <string>
+#include <caffe/caffe.hpp>
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "network/regressor.h"
+#include "loader/loader_vot.h"
+#include "tracker/tracker.h"
+#include "tracker/tracker_gmd.h"
+#include "tracker/tracker_manager.h"
+
+// for fine tuning
+#include "network/regressor_train.h"
+#include "train/example_generator.h"
+
+using std::string;
+
+// Track all videos with the exact head or with the two stage scoring, the cascade statistics of the pass into stats
+BenchmarkTotals RunPass(const bool cascade, const std::vector<Video>& videos, const BenchmarkSetup& setup,
+                        CascadeStats* stats) {
+  return RunBenchmarkPass(videos, setup, cascade ? "scoring: two stage" : "scoring: exact",
+                          [cascade](RegressorTrain* regressor_train, TrackerGMD* tracker_gmd) {
+                            regressor_train->set_cascade_scoring(cascade);
+                          },
+                          [stats](const RegressorTrain& regressor_train, const TrackerGMD& tracker_gmd) {
+                            *stats = regressor_train.cascade_stats();
+                          });
+}
+
+int main (int argc, char *argv[]) {
+  if (argc < 9) {
+    std::cerr << "Usage: " << argv[0]
+              << " deploy.prototxt network.caffemodel solver_file videos_folder LAMBDA_SHIFT LAMBDA_SCALE MIN_SCALE MAX_SCALE"
+              << " [gpu_id]" << std::endl;
+    return 1;
+  }
+
+  ::google::InitGoogleLogging(argv[0]);
+
+  BenchmarkSetup setup;
+  setup.model_file   = argv[1];
+  setup.trained_file = argv[2];
+  setup.solver_file  = argv[3];
+  const string& videos_folder = argv[4];
+  setup.lambda_shift = atof(argv[5]);
+  setup.lambda_scale = atof(argv[6]);
+  setup.min_scale    = atof(argv[7]);
+  setup.max_scale    = atof(argv[8]);
+
+  setup.gpu_id = 0;
+  if (argc >= 10) {
+    setup.gpu_id = atoi(argv[9]);
+  }
+
+  LoaderVOT loader(videos_folder);
+  std::vector<Video> videos = loader.get_videos();
+
+  CascadeStats exact_stats;
+  CascadeStats stats;
+  const BenchmarkTotals exact = RunPass(false, videos, setup, &exact_stats);
+  const BenchmarkTotals cascade = RunPass(true, videos, setup, &stats);
+
+  printf("%-10s %8s %8s %9s %9s\n", "scoring", "frames", "fps", "mean IOU", "success");
+  printf("%-10s %8d %8.2lf %9.3lf %9.3lf\n", "exact", exact.frames, exact.fps, exact.mean_iou, exact.success);
+  printf("%-10s %8d %8.2lf %9.3lf %9.3lf\n", "two stage", cascade.frames, cascade.fps, cascade.mean_iou, cascade.success);
+  printf("delta: mean IOU %+.4lf, success %+.4lf, fps x%.2lf\n", cascade.mean_iou - exact.mean_iou,
+         cascade.success - exact.success, exact.fps > 0 ? cascade.fps / exact.fps : 0);
+  if (stats.frames > 0) {
+    printf("survivors: %.1lf of %.1lf candidates per frame, first fc layer multiply-adds: %.1lf%% of the exact head\n",
+           double(stats.survivors) / stats.frames, double(stats.candidates) / stats.frames,
+           100.0 * stats.macs_cascade / stats.macs_exact);
+  }
+
+  return 0;
+}
@@ -0,0 +1,151 @@
+// Per call cost of the first fc layer after concat on the host: the duplicating path (target pool6 copied into every
+// candidate row of the concat, then one GEMM over [target | candidate]) against BROADCAST_TARGET_FEATURE (the
+// target part computed once, only the candidate part per roi), on the weights of a trained network.
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <random>
+#include <vector>
+#include <caffe/caffe.hpp>
+#include <caffe/util/math_functions.hpp>
+
+#include "helper/high_res_timer.h"
+#include "helper/Constants.h"
+
+using std::string;
+using std::vector;
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::Net;
+
+// concat of the target row and every candidate row, then the full weight, as Concat + InnerProduct do
+void HeadDuplicating(const float *target, const float *candidates, const int num_rois, const int dim_target,
+                     const int dim_candidate, const float *weight, const float *bias, const int num_output,
+                     float *concat, float *out) {
+  const int dim = dim_target + dim_candidate;
+  for (int i = 0; i < num_rois; i++) {
+    caffe::caffe_copy(dim_target, target, concat + i * dim);
+    caffe::caffe_copy(dim_candidate, candidates + i * dim_candidate, concat + i * dim + dim_target);
+  }
+  for (int i = 0; i < num_rois; i++) {
+    caffe::caffe_copy(num_output, bias, out + i * num_output);
+  }
+  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, num_rois, num_output, dim, 1.0f,
+              concat, dim, weight, dim, 1.0f, out, num_output);
+}
+
+// W_target * target + bias once, then W_candidate * candidate per roi on top of it
+void HeadBroadcast(const float *target, const float *candidates, const int num_rois, const int dim_target,
+                   const int dim_candidate, const float *weight, const float *bias, const int num_output,
+                   float *response, float *out) {
+  const int dim = dim_target + dim_candidate;
+  caffe::caffe_copy(num_output, bias, response);
+  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, 1, num_output, dim_target, 1.0f,
+              target, dim_target, weight, dim, 1.0f, response, num_output);
+  for (int i = 0; i < num_rois; i++) {
+    caffe::caffe_copy(num_output, response, out + i * num_output);
+  }
+  cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, num_rois, num_output, dim_candidate, 1.0f,
+              candidates, dim_candidate, weight + dim_target, dim, 1.0f, out, num_output);
+}
+
+int main (int argc, char *argv[]) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0]
+              << " deploy.prototxt network.caffemodel [num_candidates] [iterations]" << std::endl;
+    return 1;
+  }
+
+  ::google::InitGoogleLogging(argv[0]);
+
+  const string& model_file   = argv[1];
+  const string& trained_file = argv[2];
+  int num_rois = SAMPLE_CANDIDATES;
+  if (argc >= 4) {
+    num_rois = atoi(argv[3]);
+  }
+  int iterations = 200;
+  if (argc >= 5) {
+    iterations = atoi(argv[4]);
+  }
+
+  Caffe::set_mode(Caffe::CPU);
+  Net<float> net(model_file, caffe::TEST);
+  net.CopyTrainedLayersFrom(trained_file);
+
+  const vector<string> &layer_names = net.layer_names();
+  const int concat_idx = std::find(layer_names.begin(), layer_names.end(), "concat") - layer_names.begin();
+  CHECK_LT(concat_idx + 1, (int)layer_names.size()) << "network has no concat layer followed by an fc layer";
+  const caffe::Layer<float> *fc6_layer = net.layers()[concat_idx + 1].get();
+  CHECK_EQ(string(fc6_layer->type()), "InnerProduct");
+
+  const Blob<float> *weight = fc6_layer->blobs()[0].get();
+  const int num_output = weight->shape(0);
+  const int dim_target = net.blob_by_name("pool6")->count(1);
+  const int dim_candidate = net.blob_by_name("pool6_c")->count(1);
+  CHECK_EQ(weight->shape(1), dim_target + dim_candidate);
+  std::vector<float> bias(num_output, 0.0f);
+  if (fc6_layer->blobs().size() > 1) {
+    caffe::caffe_copy(num_output, fc6_layer->blobs()[1]->cpu_data(), bias.data());
+  }
+
+  // pool6 outputs are post ReLU, so non negative
+  std::mt19937 engine(SEED_RNG_TRACKER);
+  std::uniform_real_distribution<float> value(0.0f, 1.0f);
+  std::vector<float> target(dim_target);
+  for (size_t i = 0; i < target.size(); i++) {
+    target[i] = value(engine);
+  }
+  std::vector<float> candidates(num_rois * dim_candidate);
+  for (size_t i = 0; i < candidates.size(); i++) {
+    candidates[i] = value(engine);
+  }
+
+  std::vector<float> concat(num_rois * (dim_target + dim_candidate));
+  std::vector<float> response(num_output);
+  std::vector<float> out_duplicating(num_rois * num_output);
+  std::vector<float> out_broadcast(num_rois * num_output);
+
+  // one untimed call each, so that the first touch of the buffers is not measured
+  HeadDuplicating(target.data(), candidates.data(), num_rois, dim_target, dim_candidate, weight->cpu_data(),
+                  bias.data(), num_output, concat.data(), out_duplicating.data());
+  HeadBroadcast(target.data(), candidates.data(), num_rois, dim_target, dim_candidate, weight->cpu_data(),
+                bias.data(), num_output, response.data(), out_broadcast.data());
+  float max_diff = 0;
+  for (size_t i = 0; i < out_broadcast.size(); i++) {
+    max_diff = std::max(max_diff, std::abs(out_broadcast[i] - out_duplicating[i]));
+  }
+
+  HighResTimer hrt("duplicating", CLOCK_MONOTONIC);
+  hrt.start();
+  for (int it = 0; it < iterations; it++) {
+    HeadDuplicating(target.data(), candidates.data(), num_rois, dim_target, dim_candidate, weight->cpu_data(),
+                    bias.data(), num_output, concat.data(), out_duplicating.data());
+  }
+  hrt.stop();
+  const double ms_duplicating = hrt.getMilliseconds() / iterations;
+
+  hrt.reset("broadcast");
+  hrt.start();
+  for (int it = 0; it < iterations; it++) {
+    HeadBroadcast(target.data(), candidates.data(), num_rois, dim_target, dim_candidate, weight->cpu_data(),
+                  bias.data(), num_output, response.data(), out_broadcast.data());
+  }
+  hrt.stop();
+  const double ms_broadcast = hrt.getMilliseconds() / iterations;
+
+  printf("first fc layer: %d rois, %d outputs, target %d + candidate %d inputs, %d calls\n",
+         num_rois, num_output, dim_target, dim_candidate, iterations);
+  printf("%-12s %10s %12s %14s\n", "path", "ms / call", "MMACs / call", "KB copied");
+  printf("%-12s %10.3lf %12.1lf %14.1lf\n", "duplicating", ms_duplicating,
+         1e-6 * num_rois * num_output * (dim_target + dim_candidate),
+         sizeof(float) * num_rois * (double)(dim_target + dim_candidate) / 1024);
+  printf("%-12s %10.3lf %12.1lf %14.1lf\n", "broadcast", ms_broadcast,
+         1e-6 * num_output * (dim_target + (double)num_rois * dim_candidate),
+         sizeof(float) * num_rois * (double)num_output / 1024);
+  printf("broadcast: x%.2lf faster, max output difference %g\n",
+         ms_broadcast > 0 ? ms_duplicating / ms_broadcast : 0, max_diff);
+
+  return 0;
+}
@@ -0,0 +1,61 @@
+// Compare the fixed and the target-size-adaptive input scale (ADAPTIVE_INPUT_SCALE) on VOT:
+// fps, mean IOU and success rate per target size bucket.
+
+#include <string>
+#include <caffe/caffe.hpp>
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "network/regressor.h"
+#include "loader/loader_vot.h"
+#include "tracker/tracker.h"
+#include "tracker/tracker_gmd.h"
+#include "tracker/tracker_manager.h"
+
+// for fine tuning
+#include "network/regressor_train.h"
+#include "train/example_generator.h"
+
+using std::string;
+
+int main (int argc, char *argv[]) {
+  if (argc < 10) {
+    std::cerr << "Usage: " << argv[0]
+              << " deploy.prototxt network.caffemodel solver_file videos_folder LAMBDA_SHIFT LAMBDA_SCALE MIN_SCALE MAX_SCALE"
+              << " adaptive_scale(0/1) [gpu_id]" << std::endl;
+    return 1;
+  }
+
+  ::google::InitGoogleLogging(argv[0]);
+
+  BenchmarkSetup setup;
+  setup.model_file   = argv[1];
+  setup.trained_file = argv[2];
+  setup.solver_file  = argv[3];
+  const string& videos_folder = argv[4];
+  setup.lambda_shift = atof(argv[5]);
+  setup.lambda_scale = atof(argv[6]);
+  setup.min_scale    = atof(argv[7]);
+  setup.max_scale    = atof(argv[8]);
+  const bool adaptive_scale = atoi(argv[9]) != 0;
+
+  setup.gpu_id = 0;
+  if (argc >= 11) {
+    setup.gpu_id = atoi(argv[10]);
+  }
+
+  // Get videos.
+  LoaderVOT loader(videos_folder);
+  std::vector<Video> videos = loader.get_videos();
+
+  // the pass is seeded, so that the fixed and adaptive runs draw the same candidates and only the input scale differs
+  RunBenchmarkPass(videos, setup, adaptive_scale ? "input scale: adaptive" : "input scale: fixed",
+                   [adaptive_scale](RegressorTrain* regressor_train, TrackerGMD* tracker_gmd) {
+                     regressor_train->set_adaptive_input_scale(adaptive_scale);
+                   },
+                   nullptr);
+
+  return 0;
+}
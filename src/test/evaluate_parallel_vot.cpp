@@ -0,0 +1,180 @@
+// Run the fine tuning tracker over VOT with the videos sharded across worker processes. Each worker has its own
+// network, solver and tracker state, a fixed number of BLAS and frame decode threads and its own log, and writes the
+// same per video outputs as a TrackerFineTune run over all videos.
+
+#include <string>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <caffe/caffe.hpp>
+#include <boost/filesystem.hpp>
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "network/regressor.h"
+#include "loader/loader_vot.h"
+#include "tracker/tracker.h"
+#include "tracker/tracker_gmd.h"
+#include "tracker/tracker_manager.h"
+#include "helper/high_res_timer.h"
+
+// for fine tuning
+#include "network/regressor_train.h"
+#include "train/example_generator.h"
+
+using std::string;
+
+const bool show_intermediate_output = false;
+
+// thread count setters of the BLAS libraries Caffe may be linked against, NULL for the ones that are not
+extern "C" void openblas_set_num_threads(int num_threads) __attribute__((weak));
+extern "C" void mkl_set_num_threads(int num_threads) __attribute__((weak));
+
+// The BLAS library is loaded before main, so its environment variables are read too early to be set per worker
+void SetBlasThreads(const int num_threads) {
+  if (openblas_set_num_threads != NULL) {
+    openblas_set_num_threads(num_threads);
+  }
+  if (mkl_set_num_threads != NULL) {
+    mkl_set_num_threads(num_threads);
+  }
+}
+
+int main (int argc, char *argv[]) {
+  if (argc < 10) {
+    std::cerr << "Usage: " << argv[0]
+              << " deploy.prototxt network.caffemodel solver_file videos_folder LAMBDA_SHIFT LAMBDA_SCALE MIN_SCALE MAX_SCALE"
+              << " num_workers [blas_threads] [gpu_id] [output_folder] [save_videos] [prefetch_threads]" << std::endl;
+    return 1;
+  }
+
+  ::google::InitGoogleLogging(argv[0]);
+
+  const string& model_file   = argv[1];
+  const string& trained_file = argv[2];
+  const string& solver_file = argv[3];
+  const string& videos_folder = argv[4];
+  const double lambda_shift   = atof(argv[5]);
+  const double lambda_scale   = atof(argv[6]);
+  const double min_scale      = atof(argv[7]);
+  const double max_scale      = atof(argv[8]);
+  const int num_workers       = std::max(atoi(argv[9]), 1);
+
+  int blas_threads = 1;
+  if (argc >= 11) {
+    blas_threads = std::max(atoi(argv[10]), 1);
+  }
+
+  int gpu_id = 0;
+  if (argc >= 12) {
+    gpu_id = atoi(argv[11]);
+  }
+
+  string output_folder = "nets/tracker_output/GOTURN_MDNet";
+  if (argc >= 13) {
+    output_folder = argv[12];
+  }
+  boost::filesystem::create_directories(output_folder);
+
+  bool save_videos = true;
+  if (argc >= 14) {
+    save_videos = atoi(argv[13]) != 0;
+  }
+
+  // frame decode threads of each worker, on top of its BLAS threads; 0 loads every frame right before tracking it
+  int prefetch_threads = 1;
+  if (argc >= 15) {
+    prefetch_threads = std::max(atoi(argv[14]), 0);
+  }
+
+  // Get videos, every worker sees the whole list so that the video indexes in the outputs are the global ones
+  LoaderVOT loader(videos_folder);
+  std::vector<Video> videos = loader.get_videos();
+  const std::vector<std::vector<size_t> > shards = TrackerManager::ShardVideos(videos, num_workers);
+
+  HighResTimer hrt("evaluate_parallel_vot", CLOCK_MONOTONIC);
+  hrt.start();
+
+  // processes rather than threads: Caffe keeps its mode and device per thread, and BLAS threads per process
+  std::vector<pid_t> workers;
+  for (int worker = 0; worker < num_workers; worker++) {
+    size_t worker_frames = 0;
+    for (size_t i = 0; i < shards[worker].size(); i++) {
+      worker_frames += videos[shards[worker][i]].all_frames.size();
+    }
+    printf("Worker %d: %zu videos, %zu frames\n", worker, shards[worker].size(), worker_frames);
+    fflush(stdout);
+
+    const pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      return 1;
+    }
+    if (pid > 0) {
+      workers.push_back(pid);
+      continue;
+    }
+
+    // worker: own log, network, solver and tracker; glog was set up before the fork and writes to stderr, so
+    // that goes to the worker's log too
+    const string log_file = output_folder + "/worker_" + std::to_string(worker) + ".log";
+    if (freopen(log_file.c_str(), "w", stdout) == NULL) {
+      perror(log_file.c_str());
+      _exit(1);
+    }
+    // one open file for both, so that their lines interleave instead of overwriting each other
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if (dup2(fileno(stdout), fileno(stderr)) < 0) {
+      perror(log_file.c_str());
+      _exit(1);
+    }
+    SetBlasThreads(blas_threads);
+
+    // scoped, so that the video writer and the prefetch threads are closed before _exit
+    {
+      const bool do_train = true;
+      RegressorTrain regressor_train(model_file,
+                                   trained_file,
+                                   gpu_id,
+                                   solver_file,
+                                   3,
+                                   do_train);
+      ExampleGenerator example_generator(lambda_shift, lambda_scale,
+                                        min_scale, max_scale);
+      TrackerGMD tracker_gmd(show_intermediate_output, &example_generator, &regressor_train);
+
+      const bool show_result = false;
+      TrackerFineTune tracker_fine_tune(videos, &regressor_train, &tracker_gmd, save_videos, output_folder, show_result);
+      if (prefetch_threads > 0) {
+        tracker_fine_tune.SetPrefetch(PREFETCH_DEPTH, prefetch_threads);
+      }
+      tracker_fine_tune.SetVideoSubset(shards[worker]);
+      tracker_fine_tune.TrackAll();
+    }
+
+    fflush(stdout);
+    _exit(0);
+  }
+
+  int failed = 0;
+  for (int worker = 0; worker < workers.size(); worker++) {
+    int status = 0;
+    waitpid(workers[worker], &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      printf("Worker %d failed, see %s/worker_%d.log\n", worker, output_folder.c_str(), worker);
+      failed++;
+    }
+  }
+  hrt.stop();
+
+  size_t total_frames = 0;
+  for (size_t i = 0; i < videos.size(); i++) {
+    total_frames += videos[i].all_frames.size();
+  }
+  printf("%zu videos, %zu frames on %d workers with %d BLAS threads: %lf s, %lf fps\n", videos.size(), total_frames,
+         num_workers, blas_threads, hrt.getSeconds(), total_frames / hrt.getSeconds());
+
+  return failed == 0 ? 0 : 1;
+}
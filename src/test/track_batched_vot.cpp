@@ -0,0 +1,62 @@
+// Track all VOT videos with the fine tuning tracker, num_streams videos at a time, the backbones of their current
+// frames running as one batch. Outputs are the per video files of TrackerFineTune, without the videos.
+
+#include <string>
+#include <caffe/caffe.hpp>
+#include <boost/filesystem.hpp>
+
+#include "network/regressor.h"
+#include "network/regressor_train.h"
+#include "loader/loader_vot.h"
+#include "tracker/tracker_batch_scheduler.h"
+
+using std::string;
+
+int main (int argc, char *argv[]) {
+  if (argc < 10) {
+    std::cerr << "Usage: " << argv[0]
+              << " deploy.prototxt network.caffemodel solver_file videos_folder LAMBDA_SHIFT LAMBDA_SCALE MIN_SCALE MAX_SCALE"
+              << " num_streams [gpu_id] [output_folder]" << std::endl;
+    return 1;
+  }
+
+  ::google::InitGoogleLogging(argv[0]);
+
+  const string& model_file   = argv[1];
+  const string& trained_file = argv[2];
+  const string& solver_file = argv[3];
+  const string& videos_folder = argv[4];
+  const double lambda_shift   = atof(argv[5]);
+  const double lambda_scale   = atof(argv[6]);
+  const double min_scale      = atof(argv[7]);
+  const double max_scale      = atof(argv[8]);
+  const int num_streams       = std::max(atoi(argv[9]), 1);
+
+  int gpu_id = 0;
+  if (argc >= 11) {
+    gpu_id = atoi(argv[10]);
+  }
+
+  string output_folder = "nets/tracker_output/GOTURN_MDNet_batched";
+  if (argc >= 12) {
+    output_folder = argv[11];
+  }
+  boost::filesystem::create_directories(output_folder);
+
+  LoaderVOT loader(videos_folder);
+  std::vector<Video> videos = loader.get_videos();
+
+  const bool do_train = true;
+  RegressorTrain regressor_train(model_file,
+                               trained_file,
+                               gpu_id,
+                               solver_file,
+                               3,
+                               do_train);
+
+  TrackerBatchScheduler scheduler(videos, &regressor_train, &regressor_train, num_streams,
+                                  lambda_shift, lambda_scale, min_scale, max_scale);
+  scheduler.TrackAll(output_folder);
+
+  return 0;
+}
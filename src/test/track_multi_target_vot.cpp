@@ -0,0 +1,133 @@
+// Track several targets per VOT video with TrackerMultiTarget, one backbone pass and one ROI pooling per frame for
+// all of them. Besides the annotated target, every video gets targets of the same size elsewhere in the first
+// frame. Prints the cost per frame against the number of targets (and so of pooled rois), then tracks again with
+// the check that every head scores its pooled rows as it scores its candidates alone.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <caffe/caffe.hpp>
+
+#include <opencv/cv.h>
+#include <opencv2/core/core.hpp>
+
+#include "network/regressor_train.h"
+#include "loader/loader_vot.h"
+#include "helper/high_res_timer.h"
+#include "helper/Constants.h"
+#include "tracker/tracker_multi_target.h"
+
+using std::string;
+using std::vector;
+
+// the annotated box, then boxes of its size shifted by one, two, ... widths to alternating sides, kept in the frame
+void MakeTargets(const BoundingBox &bbox_gt, const int W, const int num_targets,
+                 vector<BoundingBox> *targets) {
+  const double width = bbox_gt.get_width();
+  targets->clear();
+  targets->push_back(bbox_gt);
+  for (int k = 1; k < num_targets; k++) {
+    const double shift = ((k + 1) / 2) * width * (k % 2 == 1 ? 1 : -1);
+    BoundingBox bbox(bbox_gt);
+    bbox.x1_ = std::min(std::max(bbox_gt.x1_ + shift, 0.0), std::max(W - 1 - width, 0.0));
+    bbox.x2_ = bbox.x1_ + width;
+    targets->push_back(bbox);
+  }
+}
+
+// Track the first max_frames frames of every video with num_targets targets, returns the frames tracked
+int TrackPass(const vector<Video> &videos, const int num_targets, const int max_frames,
+              TrackerMultiTarget *tracker, RegressorTrain *regressor_train, HighResTimer *hrt) {
+  int frames = 0;
+  for (int v = 0; v < videos.size(); v++) {
+    const Video &video = videos[v];
+    int first_frame;
+    cv::Mat image;
+    BoundingBox bbox_gt;
+    video.LoadFirstAnnotation(&first_frame, &image, &bbox_gt);
+
+    vector<BoundingBox> targets;
+    MakeTargets(bbox_gt, image.cols, num_targets, &targets);
+    tracker->Init(image, targets, regressor_train);
+
+    const int last_frame = std::min((int)video.all_frames.size(), first_frame + 1 + max_frames);
+    vector<BoundingBox> estimates;
+    for (int frame_num = first_frame + 1; frame_num < last_frame; frame_num++) {
+      BoundingBox bbox;
+      video.LoadFrame(frame_num, false, false, &image, &bbox);
+
+      hrt->start();
+      tracker->Track(image, regressor_train, &estimates);
+      hrt->stop();
+      tracker->UpdateState(image, estimates, regressor_train, frame_num == last_frame - 1);
+      frames++;
+    }
+    tracker->Reset(regressor_train);
+  }
+  return frames;
+}
+
+int main (int argc, char *argv[]) {
+  if (argc < 9) {
+    std::cerr << "Usage: " << argv[0]
+              << " deploy.prototxt network.caffemodel solver_file videos_folder LAMBDA_SHIFT LAMBDA_SCALE MIN_SCALE MAX_SCALE"
+              << " [max_targets] [max_frames] [gpu_id]" << std::endl;
+    return 1;
+  }
+
+  ::google::InitGoogleLogging(argv[0]);
+
+  const string& model_file   = argv[1];
+  const string& trained_file = argv[2];
+  const string& solver_file = argv[3];
+  const string& videos_folder = argv[4];
+  const double lambda_shift   = atof(argv[5]);
+  const double lambda_scale   = atof(argv[6]);
+  const double min_scale      = atof(argv[7]);
+  const double max_scale      = atof(argv[8]);
+
+  int max_targets = 3;
+  if (argc >= 10) {
+    max_targets = std::max(atoi(argv[9]), 2);
+  }
+  int max_frames = 50;
+  if (argc >= 11) {
+    max_frames = atoi(argv[10]);
+  }
+  int gpu_id = 0;
+  if (argc >= 12) {
+    gpu_id = atoi(argv[11]);
+  }
+
+  LoaderVOT loader(videos_folder);
+  std::vector<Video> videos = loader.get_videos();
+
+  const bool do_train = true;
+  RegressorTrain regressor_train(model_file,
+                               trained_file,
+                               gpu_id,
+                               solver_file,
+                               3,
+                               do_train);
+
+  const bool show_tracking = false;
+  TrackerMultiTarget tracker(show_tracking, lambda_shift, lambda_scale, min_scale, max_scale, &regressor_train);
+
+  printf("%-8s %10s %12s %12s %14s\n", "targets", "frames", "rois/frame", "ms/frame", "ms/target");
+  for (int num_targets = 1; num_targets <= max_targets; num_targets++) {
+    HighResTimer hrt("track", CLOCK_MONOTONIC);
+    const int frames = TrackPass(videos, num_targets, max_frames, &tracker, &regressor_train, &hrt);
+    const double ms_frame = frames > 0 ? hrt.getMilliseconds() / frames : 0;
+    printf("%-8d %10d %12d %12.2lf %14.2lf\n", num_targets, frames, num_targets * SAMPLE_CANDIDATES,
+           ms_frame, ms_frame / num_targets);
+  }
+
+  // CheckPooled fails on the first head whose pooled scores are off
+  tracker.set_check_pooled(true);
+  HighResTimer hrt("check", CLOCK_MONOTONIC);
+  const int frames = TrackPass(videos, max_targets, max_frames, &tracker, &regressor_train, &hrt);
+  printf("%d targets on %d frames: pooled and alone scores of every head agree, max difference %g\n",
+         max_targets, frames, tracker.pooled_max_difference());
+
+  return 0;
+}
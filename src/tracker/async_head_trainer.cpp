@@ -0,0 +1,200 @@
+#include "async_head_trainer.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <caffe/util/math_functions.hpp>
+
+using caffe::Blob;
+
+void FineTuneJob::clear() {
+  frames.clear();
+  target_features.clear();
+  candidate_features.clear();
+  labels.clear();
+  frames_per_batch = 1;
+}
+
+AsyncHeadTrainer::AsyncHeadTrainer(RegressorBase* shadow, RegressorTrainBase* shadow_train, const int gpu_id):
+  shadow_(shadow),
+  shadow_train_(shadow_train),
+  gpu_id_(gpu_id),
+  mode_(caffe::Caffe::mode()),
+  front_(0),
+  busy_(false),
+  has_pending_(false),
+  update_ready_(false),
+  stop_(false),
+  num_submitted_(0),
+  num_replaced_(0),
+  num_published_(0)
+{
+  shadow_->GetHeadParams(&shadow_params_);
+  worker_ = std::thread(&AsyncHeadTrainer::WorkerLoop, this);
+}
+
+AsyncHeadTrainer::~AsyncHeadTrainer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_job_.notify_one();
+  worker_.join();
+}
+
+void AsyncHeadTrainer::SyncFromTracking(RegressorBase* tracking) {
+  WaitIdle();
+
+  if (tracking_params_.empty()) {
+    tracking->GetHeadParams(&tracking_params_);
+    CHECK_EQ(tracking_params_.size(), shadow_params_.size()) << "shadow network has a different head";
+
+    // tracking keeps its blobs, only their data is pointed at buffers_[front_]
+    for (int b = 0; b < 2; b++) {
+      buffers_[b].resize(tracking_params_.size());
+      for (int i = 0; i < tracking_params_.size(); i++) {
+        buffers_[b][i].reset(new Blob<float>(tracking_params_[i]->shape()));
+      }
+    }
+    front_ = 0;
+    for (int i = 0; i < tracking_params_.size(); i++) {
+      caffe::caffe_copy(tracking_params_[i]->count(), tracking_params_[i]->cpu_data(),
+                        buffers_[front_][i]->mutable_cpu_data());
+      tracking_params_[i]->ShareData(*buffers_[front_][i]);
+    }
+  }
+
+  for (int i = 0; i < tracking_params_.size(); i++) {
+    CHECK_EQ(tracking_params_[i]->count(), shadow_params_[i]->count());
+    caffe::caffe_copy(tracking_params_[i]->count(), tracking_params_[i]->cpu_data(),
+                      shadow_params_[i]->mutable_cpu_data());
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  update_ready_ = false;
+  pending_.clear();
+  has_pending_ = false;
+}
+
+bool AsyncHeadTrainer::Submit(FineTuneJob &job) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  num_submitted_ ++;
+  if (busy_) {
+    // the newest samples are the ones worth training on once the worker is free
+    if (has_pending_) {
+      num_replaced_ ++;
+    }
+    std::swap(pending_, job);
+    job.clear();
+    has_pending_ = true;
+    return false;
+  }
+
+  StartLocked(job);
+  return true;
+}
+
+void AsyncHeadTrainer::StartLocked(FineTuneJob &job) {
+  // the back buffer is about to be overwritten, publish what it holds first
+  PublishLocked();
+
+  std::swap(job_, job);
+  job.clear();
+  busy_ = true;
+  cond_job_.notify_one();
+}
+
+bool AsyncHeadTrainer::PublishIfReady() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const bool published = PublishLocked();
+  if (!busy_ && has_pending_) {
+    has_pending_ = false;
+    StartLocked(pending_);
+  }
+  return published;
+}
+
+bool AsyncHeadTrainer::PublishLocked() {
+  if (!update_ready_ || busy_) {
+    return false;
+  }
+
+  front_ = 1 - front_;
+  for (int i = 0; i < tracking_params_.size(); i++) {
+    tracking_params_[i]->ShareData(*buffers_[front_][i]);
+  }
+  update_ready_ = false;
+  num_published_ ++;
+  return true;
+}
+
+void AsyncHeadTrainer::WaitIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_idle_.wait(lock, [this] { return !busy_; });
+}
+
+void AsyncHeadTrainer::Reset() {
+  WaitIdle();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    printf("AsyncHeadTrainer: %d updates submitted, %d replaced by a newer one while pending, %d published\n",
+           num_submitted_, num_replaced_, num_published_);
+    update_ready_ = false;
+    pending_.clear();
+    has_pending_ = false;
+    num_submitted_ = 0;
+    num_replaced_ = 0;
+    num_published_ = 0;
+  }
+
+  // the tracking head is reset by its own regressor, SyncFromTracking copies it over after the first frame
+  shadow_->Reset();
+  shadow_train_->ResetSolverNet();
+}
+
+void AsyncHeadTrainer::WorkerLoop() {
+  // caffe keeps the mode and device per thread
+  caffe::Caffe::set_mode(mode_);
+#ifndef CPU_ONLY
+  if (mode_ == caffe::Caffe::GPU) {
+    caffe::Caffe::SetDevice(gpu_id_);
+  }
+#endif
+#ifdef REPRODUCIBLE_RNG
+  caffe::Caffe::set_random_seed(SEED_RNG_CAFFE);
+#endif
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cond_job_.wait(lock, [this] { return stop_ || busy_; });
+    if (stop_) {
+      break;
+    }
+
+    // front_ does not change while busy_
+    const int back = 1 - front_;
+    lock.unlock();
+
+    shadow_train_->TrainBatchFromFeatures(job_.target_features,
+                                          job_.candidate_features,
+                                          job_.labels,
+                                          INNER_BATCH_SIZE,
+                                          job_.frames_per_batch);
+    CopyShadowToBack(back);
+
+    lock.lock();
+    job_.clear();
+    busy_ = false;
+    update_ready_ = true;
+    cond_idle_.notify_all();
+  }
+}
+
+void AsyncHeadTrainer::CopyShadowToBack(const int back) {
+  // through host memory, so the shadow may live on another device than tracking,
+  // tracking uploads the new head lazily on its next forward
+  for (int i = 0; i < shadow_params_.size(); i++) {
+    caffe::caffe_copy(shadow_params_[i]->count(), shadow_params_[i]->cpu_data(),
+                      buffers_[back][i]->mutable_cpu_data());
+  }
+}
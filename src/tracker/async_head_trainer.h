@@ -0,0 +1,103 @@
+#ifndef ASYNC_HEAD_TRAINER_H
+#define ASYNC_HEAD_TRAINER_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <boost/shared_ptr.hpp>
+#include <caffe/caffe.hpp>
+
+#include "network/regressor_base.h"
+#include "network/regressor_train_base.h"
+#include "tracker/frame_feature_store.h"
+
+// One head fine tune request, the row pointers point into the frames held by frames
+struct FineTuneJob {
+  std::vector<boost::shared_ptr<const FrameFeatures> > frames;
+  std::vector<const float*> target_features;
+  std::vector<std::vector<const float*> > candidate_features;
+  std::vector<std::vector<double> > labels;
+  int frames_per_batch;
+
+  FineTuneJob(): frames_per_batch(1) { }
+
+  bool empty() const { return target_features.empty(); }
+  void clear();
+};
+
+// Runs head fine tuning on a worker thread against a shadow network, so that tracking is not blocked.
+// Tracking keeps using the last published head weights, a finished update is published by swapping 
+// the tracking net's head blobs onto the other of two buffers, O(1) per blob.
+class AsyncHeadTrainer {
+public:
+  // shadow is a separate network of the same model, only its head is trained
+  AsyncHeadTrainer(RegressorBase* shadow, RegressorTrainBase* shadow_train, const int gpu_id);
+
+  ~AsyncHeadTrainer();
+
+  // Copy the head of tracking into the shadow network, e.g. after the first frame fine tune.
+  // The first call also binds the head blobs of tracking to the double buffers.
+  void SyncFromTracking(RegressorBase* tracking);
+
+  // Hand a job to the worker, returns true if it starts right away. While the worker is busy the job is kept as
+  // the pending one instead, replacing an older pending job, and started by PublishIfReady once the worker is done.
+  bool Submit(FineTuneJob &job);
+
+  // Called by the tracking thread between frames, swap in the newest head weights if an update finished, then
+  // start the pending job if any
+  bool PublishIfReady();
+
+  // Block until the worker has finished the current job
+  void WaitIdle();
+
+  // Wait for the worker, drop any pending job and unpublished update and restore the shadow solver, for the next video
+  void Reset();
+
+private:
+  void WorkerLoop();
+
+  // Swap tracking onto the back buffer if a finished update waits there, mutex_ must be held
+  bool PublishLocked();
+
+  // Hand job to the idle worker, mutex_ must be held
+  void StartLocked(FineTuneJob &job);
+
+  // Copy the shadow head into the buffer not used by tracking
+  void CopyShadowToBack(const int back);
+
+  RegressorBase* shadow_;
+  RegressorTrainBase* shadow_train_;
+  int gpu_id_;
+  caffe::Caffe::Brew mode_;
+
+  // head blobs of the shadow and of the tracking network
+  std::vector<caffe::Blob<float>* > shadow_params_;
+  std::vector<caffe::Blob<float>* > tracking_params_;
+
+  // double buffers of the head weights, tracking_params_ share the data of buffers_[front_]
+  std::vector<boost::shared_ptr<caffe::Blob<float> > > buffers_[2];
+  int front_;
+
+  std::thread worker_;
+  std::mutex mutex_;
+  std::condition_variable cond_job_;
+  std::condition_variable cond_idle_;
+
+  FineTuneJob job_;
+  bool busy_;
+
+  // newest job submitted while busy_, started after the running one is published
+  FineTuneJob pending_;
+  bool has_pending_;
+
+  bool update_ready_;
+  bool stop_;
+
+  // counters for the current video
+  int num_submitted_;
+  int num_replaced_;
+  int num_published_;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "frame_feature_store.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+FrameFeatureStore::FrameFeatureStore(const int capacity)
+{
+  slots_.reserve(capacity);
+  for (int i = 0; i < capacity; i++) {
+    slots_.push_back(boost::shared_ptr<FrameFeatures>(new FrameFeatures()));
+  }
+  free_slots_.reserve(capacity);
+  Clear();
+}
+
+int FrameFeatureStore::Acquire(const int frame) {
+  if (free_slots_.empty()) {
+    printf("FrameFeatureStore has no free slot out of %d, frame %d\n", capacity(), frame);
+    exit(-1);
+  }
+
+  // take the oldest released slot first, so that slots are used round robin
+  int slot = free_slots_.front();
+  free_slots_.erase(free_slots_.begin());
+
+  // still referred to by someone else, leave the old features to them
+  if (slots_[slot].use_count() > 1) {
+    slots_[slot].reset(new FrameFeatures());
+  }
+
+  FrameFeatures &this_features = *slots_[slot];
+  this_features.frame = frame;
+  this_features.num_pos = 0;
+  this_features.num_neg = 0;
+  this_features.dim = 0;
+  // clear() keeps the capacity, the buffers are reused
+  this_features.target.clear();
+  this_features.candidates.clear();
+
+  return slot;
+}
+
+void FrameFeatureStore::Release(const int slot) {
+  assert(slot >= 0 && slot < capacity());
+  slots_[slot]->frame = -1;
+  free_slots_.push_back(slot);
+}
+
+void FrameFeatureStore::Clear() {
+  free_slots_.clear();
+  for (size_t i = 0; i < slots_.size(); i++) {
+    slots_[i]->frame = -1;
+    free_slots_.push_back(i);
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef FRAME_FEATURE_STORE_H
+#define FRAME_FEATURE_STORE_H
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+// Pooled features kept for one frame to fine tune the fc head online, instead of the raw frames
+struct FrameFeatures {
+  FrameFeatures():
+    frame(-1),
+    num_pos(0),
+    num_neg(0),
+    dim(0)
+  { }
+
+  // index of the frame in the sequence these features come from
+  int frame;
+
+  // pool6 of the target
+  std::vector<float> target;
+
+  // pool6_c of the candidates, num_pos positive rows followed by num_neg negative rows, each of dim floats
+  std::vector<float> candidates;
+
+  int num_pos;
+  int num_neg;
+  int dim;
+};
+
+// Fixed number of FrameFeatures slots, indexed by the short/long term bags. 
+// Released slots are reused by later frames together with their buffers, so memory stays flat on long sequences.
+// A slot still held through handle() (e.g. by a background fine tune job) gets fresh buffers when reused instead.
+class FrameFeatureStore {
+public:
+  FrameFeatureStore(const int capacity);
+
+  // Get a free slot for a new frame, the slot keeps the buffers of its previous frame to be overwritten
+  int Acquire(const int frame);
+
+  // Give back a slot once no bag refers to it anymore
+  void Release(const int slot);
+
+  // Release all slots, for the next video, buffers are kept
+  void Clear();
+
+  FrameFeatures& at(const int slot) { return *slots_[slot]; }
+  const FrameFeatures& at(const int slot) const { return *slots_[slot]; }
+
+  // Shared handle keeping the features of this slot alive after the slot is reused
+  boost::shared_ptr<const FrameFeatures> handle(const int slot) const { return slots_[slot]; }
+
+  int capacity() const { return slots_.size(); }
+  int num_free() const { return free_slots_.size(); }
+
+private:
+  std::vector<boost::shared_ptr<FrameFeatures> > slots_;
+
+  // free slot indexes, the least recently released one in the front
+  std::vector<int> free_slots_;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#include "head_bank.h"
+
+#include <caffe/util/math_functions.hpp>
+
+using caffe::Blob;
+
+namespace {
+
+// num_copies copies of blobs, with their current data
+void CopyBlobs(const std::vector<Blob<float>* > &blobs, const int num_copies,
+               std::vector<std::vector<boost::shared_ptr<Blob<float> > > > *copies) {
+  copies->resize(num_copies);
+  for (int t = 0; t < num_copies; t++) {
+    (*copies)[t].resize(blobs.size());
+    for (int i = 0; i < blobs.size(); i++) {
+      (*copies)[t][i].reset(new Blob<float>(blobs[i]->shape()));
+      caffe::caffe_copy(blobs[i]->count(), blobs[i]->cpu_data(), (*copies)[t][i]->mutable_cpu_data());
+    }
+  }
+}
+
+} // namespace
+
+HeadBank::HeadBank(RegressorBase* regressor, RegressorTrainBase* regressor_train, const int num_targets):
+  bound_(-1)
+{
+  regressor->GetHeadParams(&net_params_);
+  regressor_train->GetHeadHistory(&net_history_);
+  CHECK_EQ(net_params_.size(), net_history_.size()) << "every head blob needs its solver history";
+
+  CopyBlobs(net_params_, num_targets, &params_);
+  CopyBlobs(net_history_, num_targets, &history_);
+}
+
+void HeadBank::Bind(const int target) {
+  if (target == bound_) {
+    return;
+  }
+  for (int i = 0; i < net_params_.size(); i++) {
+    net_params_[i]->ShareData(*params_[target][i]);
+    net_history_[i]->ShareData(*history_[target][i]);
+  }
+  bound_ = target;
+}
@@ -0,0 +1,38 @@
+#ifndef HEAD_BANK_H
+#define HEAD_BANK_H
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <caffe/caffe.hpp>
+
+#include "network/regressor_base.h"
+#include "network/regressor_train_base.h"
+
+// One copy of the fc head weights and of their solver momentum per target, so that several targets share the
+// network (and its backbone pass) while each keeps its own online fine tuned head. Bind points the head blobs of
+// the network and of its solver at a target's copy with Blob::ShareData, O(1) per blob; everything that writes
+// the head in place (fine tuning, Regressor::Reset, ResetSolverNet) then writes that target's copy.
+class HeadBank {
+public:
+  // The copies start from the current head and momentum of regressor
+  HeadBank(RegressorBase* regressor, RegressorTrainBase* regressor_train, const int num_targets);
+
+  // Make target's head the one used by regressor and regressor_train
+  void Bind(const int target);
+
+  int num_targets() const { return params_.size(); }
+
+private:
+  // copies of the blobs of GetHeadParams and of GetHeadHistory, per target
+  std::vector<std::vector<boost::shared_ptr<caffe::Blob<float> > > > params_;
+  std::vector<std::vector<boost::shared_ptr<caffe::Blob<float> > > > history_;
+
+  // the blobs of the network and of the solver
+  std::vector<caffe::Blob<float>* > net_params_;
+  std::vector<caffe::Blob<float>* > net_history_;
+
+  // target bound last, -1 before the first Bind
+  int bound_;
+};
+
+#endif // HEAD_BANK_H
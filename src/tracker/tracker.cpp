@@ -48,13 +48,13 @@ void Tracker::Track(const cv::Mat& image_curr, RegressorBase* regressor,
                     BoundingBox* bbox_estimate_uncentered) {
   // Get target from previous image.
   cv::Mat target_pad;
-  CropPadImage(bbox_prev_tight_, image_prev_, &target_pad);
+  CropPadImage(bbox_prev_tight_, image_prev_, &target_crop_, &target_pad);
 
   // Crop the current image based on predicted prior location of target.
   cv::Mat curr_search_region;
   BoundingBox search_location;
   double edge_spacing_x, edge_spacing_y;
-  CropPadImage(bbox_curr_prior_tight_, image_curr, &curr_search_region, &search_location, &edge_spacing_x, &edge_spacing_y);
+  CropPadImage(bbox_curr_prior_tight_, image_curr, &search_crop_, &curr_search_region, &search_location, &edge_spacing_x, &edge_spacing_y);
 
   // Estimate the bounding box location of the target, centered and scaled relative to the cropped image.
   BoundingBox bbox_estimate;
@@ -6,6 +6,7 @@
 #include <opencv2/highgui/highgui.hpp>
 
 #include "helper/bounding_box.h"
+#include "helper/image_proc.h"
 #include "train/example_generator.h"
 #include "network/regressor.h"
 #include "network/regressor_train_base.h"
@@ -37,7 +38,8 @@ public:
                                 RegressorTrainBase* regressor_train, bool success_frame, bool is_last_frame);
   
   // Create and Enqueue Training Samples given already set up example_generator
-  virtual void EnqueueOnlineTraningSamples(ExampleGenerator* example_generator, const cv::Mat &image_curr, const BoundingBox &estimate,  bool success_frame) { }
+  virtual void EnqueueOnlineTraningSamples(ExampleGenerator* example_generator, RegressorBase* regressor, 
+                                           const cv::Mat &image_curr, const BoundingBox &estimate,  bool success_frame) { }
 
   // check if the current estimate is success, needed as flag to pass to EnqueueOnlineTraningSamples
   virtual bool IsSuccessEstimate() { return true; }
@@ -70,6 +72,10 @@ protected:
   // Full previous image.
   cv::Mat image_prev_;
 
+  // reused by the target and search region crops of Track, which only live for the call
+  CropBuffer target_crop_;
+  CropBuffer search_crop_;
+
   // Whether to visualize the tracking results
   bool show_tracking_;
 
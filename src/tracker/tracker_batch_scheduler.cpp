@@ -0,0 +1,155 @@
+#include "tracker_batch_scheduler.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include <algorithm>
+
+#include "helper/helper.h"
+#include "helper/high_res_timer.h"
+
+TrackerBatchScheduler::TrackerBatchScheduler(const std::vector<Video>& videos, RegressorBase* regressor,
+                                             RegressorTrainBase* regressor_train, const int num_streams,
+                                             const double lambda_shift, const double lambda_scale,
+                                             const double min_scale, const double max_scale) :
+  videos_(videos),
+  regressor_(regressor),
+  regressor_train_(regressor_train),
+  streams_(num_streams),
+  heads_(regressor, regressor_train, num_streams),
+  next_video_(0)
+{
+#ifdef REPRODUCIBLE_RNG
+  const uint64_t seed = SEED_RNG_TRACKER;
+#else
+  const uint64_t seed = time(NULL);
+#endif
+
+  for (int s = 0; s < num_streams; s++) {
+    Stream &stream = streams_[s];
+    stream.example_generator.reset(new ExampleGenerator(lambda_shift, lambda_scale, min_scale, max_scale));
+    stream.tracker.reset(new TrackerGMD(false, stream.example_generator.get(), regressor_train_));
+    stream.tracker->Seed(seed + s);
+    stream.example_generator->Seed(seed + s);
+    stream.prefetcher.reset(new FramePrefetcher(PREFETCH_DEPTH, 1));
+  }
+}
+
+void TrackerBatchScheduler::StartVideo(const int s, const int video_num, const std::string& output_folder) {
+  Stream &stream = streams_[s];
+  const Video& video = videos_[video_num];
+
+  int first_frame;
+  cv::Mat image_curr;
+  BoundingBox bbox_gt;
+  video.LoadFirstAnnotation(&first_frame, &image_curr, &bbox_gt);
+
+  heads_.Bind(s);
+  stream.tracker->Init(image_curr, bbox_gt, regressor_);
+
+  stream.video_num = video_num;
+  stream.frame_num = first_frame + 1;
+  stream.prefetcher->Start(&video, stream.frame_num, video.all_frames.size());
+
+  if (!output_folder.empty()) {
+    const std::string output_file = output_folder + "/" + num2str(video_num);
+    stream.output_file = fopen(output_file.c_str(), "w");
+  }
+}
+
+void TrackerBatchScheduler::FinishVideo(const int s) {
+  Stream &stream = streams_[s];
+  if (stream.output_file != NULL) {
+    fclose(stream.output_file);
+    stream.output_file = NULL;
+  }
+
+  heads_.Bind(s);
+  stream.tracker->Reset(regressor_);
+  stream.video_num = -1;
+}
+
+void TrackerBatchScheduler::Advance(const int s, const std::string& output_folder) {
+  Stream &stream = streams_[s];
+  while (stream.video_num < 0 || stream.frame_num >= videos_[stream.video_num].all_frames.size()) {
+    if (stream.video_num >= 0) {
+      FinishVideo(s);
+    }
+    if (next_video_ >= videos_.size()) {
+      return;
+    }
+    StartVideo(s, next_video_++, output_folder);
+  }
+}
+
+void TrackerBatchScheduler::TrackAll(const std::string& output_folder) {
+  HighResTimer hrt("TrackerBatchScheduler", CLOCK_MONOTONIC);
+  hrt.start();
+  int num_frames = 0;
+
+  for (int s = 0; s < streams_.size(); s++) {
+    Advance(s, output_folder);
+  }
+
+  std::vector<int> active;
+  std::vector<cv::Mat> image_currs;
+  std::vector<int64_t> frame_ids;
+  std::vector<BoundingBox> size_hints;
+  while (true) {
+    // the current frame of every stream still tracking
+    active.clear();
+    image_currs.clear();
+    frame_ids.clear();
+    size_hints.clear();
+    for (int s = 0; s < streams_.size(); s++) {
+      Stream &stream = streams_[s];
+      if (stream.video_num < 0) {
+        continue;
+      }
+      cv::Mat image_curr;
+      BoundingBox bbox_gt;
+      stream.prefetcher->Get(stream.frame_num, &image_curr, &bbox_gt);
+      active.push_back(s);
+      image_currs.push_back(image_curr);
+      frame_ids.push_back(RegressorBase::NewFrameId());
+      size_hints.push_back(stream.tracker->GetBBoxPrev());
+    }
+    if (active.empty()) {
+      break;
+    }
+
+    // one backbone pass for all streams, then every stream pools its rois from its own slot
+    regressor_->ForwardBackboneBatch(image_currs, frame_ids, size_hints);
+    const int64_t batch_generation = regressor_->conv_cache_generation();
+    for (int i = 0; i < active.size(); i++) {
+      Stream &stream = streams_[active[i]];
+      const bool is_last_frame = stream.frame_num == videos_[stream.video_num].all_frames.size() - 1;
+
+      heads_.Bind(active[i]);
+      BoundingBox bbox_estimate;
+      stream.tracker->set_frame_id(frame_ids[i]);
+      stream.tracker->Track(image_currs[i], regressor_, &bbox_estimate);
+      stream.tracker->UpdateState(image_currs[i], bbox_estimate, regressor_, is_last_frame);
+      // a miss would silently fall back to a backbone pass per stream
+      CHECK_EQ(regressor_->conv_cache_generation(), batch_generation)
+        << "stream " << active[i] << " frame " << stream.frame_num << " missed the batched conv maps";
+
+      if (stream.output_file != NULL) {
+        fprintf(stream.output_file, "%d %lf %lf %lf %lf\n", stream.frame_num + 1,
+                std::min(bbox_estimate.x1_, bbox_estimate.x2_), std::min(bbox_estimate.y1_, bbox_estimate.y2_),
+                fabs(bbox_estimate.get_width()), fabs(bbox_estimate.get_height()));
+      }
+      stream.frame_num++;
+      num_frames++;
+    }
+
+    // after the whole step: Init and Reset run the full network and drop the batched conv maps
+    for (int i = 0; i < active.size(); i++) {
+      Advance(active[i], output_folder);
+    }
+  }
+
+  hrt.stop();
+  printf("Tracked %zu videos, %d frames on %zu streams: %lf s, %lf fps\n", videos_.size(), num_frames,
+         streams_.size(), hrt.getSeconds(), num_frames / hrt.getSeconds());
+}
@@ -0,0 +1,64 @@
+#ifndef TRACKER_BATCH_SCHEDULER_H
+#define TRACKER_BATCH_SCHEDULER_H
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include "loader/video.h"
+#include "loader/frame_prefetcher.h"
+#include "network/regressor_base.h"
+#include "network/regressor_train_base.h"
+#include "train/example_generator.h"
+#include "tracker/tracker_gmd.h"
+#include "tracker/head_bank.h"
+
+// Offline tracking of many independent videos for throughput: num_streams videos are tracked in lockstep on one
+// network. Every step takes the current frame of each stream and runs their backbones as one batch
+// (RegressorBase::ForwardBackboneBatch); then each stream's tracker scores its candidates, enqueues its samples and
+// fine tunes its own head (HeadBank) against its slot of the batched conv map. A stream moves on to the next
+// untracked video when its video ends.
+class TrackerBatchScheduler
+{
+public:
+  TrackerBatchScheduler(const std::vector<Video>& videos, RegressorBase* regressor,
+                        RegressorTrainBase* regressor_train, const int num_streams,
+                        const double lambda_shift, const double lambda_scale,
+                        const double min_scale, const double max_scale);
+
+  // Track all videos, writing "frame x y w h" per frame of video i to output_folder/i when output_folder is not
+  // empty, and report the frames per second of the whole run
+  void TrackAll(const std::string& output_folder = "");
+
+private:
+  // Per stream: the video being tracked and the state of its target
+  struct Stream {
+    Stream(): video_num(-1), frame_num(0), output_file(NULL) { }
+    int video_num;
+    int frame_num;
+    FILE* output_file;
+    boost::shared_ptr<ExampleGenerator> example_generator;
+    boost::shared_ptr<TrackerGMD> tracker;
+    boost::shared_ptr<FramePrefetcher> prefetcher;
+  };
+
+  // Start stream s on video_num from its first annotation, fine tuning head s
+  void StartVideo(const int s, const int video_num, const std::string& output_folder);
+
+  // Close the output of stream s and restore head s
+  void FinishVideo(const int s);
+
+  // Move stream s on to the next untracked video once its video has no frame left
+  void Advance(const int s, const std::string& output_folder);
+
+  const std::vector<Video>& videos_;
+  RegressorBase* regressor_;
+  RegressorTrainBase* regressor_train_;
+  std::vector<Stream> streams_;
+  HeadBank heads_;
+
+  // first video no stream has taken yet
+  int next_video_;
+};
+
+#endif // TRACKER_BATCH_SCHEDULER_H
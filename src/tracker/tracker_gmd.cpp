@@ -7,49 +7,109 @@
 #include "helper/high_res_timer.h"
 #include "helper/image_proc.h"
 #include <algorithm>    // std::min
+#include <numeric>
+#include <cfloat>
 
 // #define DEBUG_SHOW_CANDIDATES
 // // #define DEBUG_FINETUNE_WORKER
 // #define FISRT_FRAME_PAUSE
 // // #define VISUALIZE_FIRST_FRAME_SAMPLES
 // #define DEBUG_LOG
+
+// #define LOG_FRAME_ALLOCATIONS
+
+#ifdef ADAPTIVE_CANDIDATE_BUDGET
+const bool kAdaptiveCandidateBudget = true;
+#else
+const bool kAdaptiveCandidateBudget = false;
+#endif
+
+#ifdef BBOX_REGRESSION_VALIDATION
+const bool kBboxRegressionValidation = true;
+#else
+const bool kBboxRegressionValidation = false;
+#endif
+
+CandidateBudget::CandidateBudget() :
+    adaptive(kAdaptiveCandidateBudget),
+    min_candidates(CANDIDATE_BUDGET_MIN),
+    max_candidates(CANDIDATE_BUDGET_MAX),
+    max_rounds(CANDIDATE_BUDGET_MAX_ROUNDS),
+    confident_prob(CANDIDATE_BUDGET_CONFIDENT_PROB),
+    small_motion(CANDIDATE_BUDGET_SMALL_MOTION),
+    log(false)
+{
+}
 // // #define LOG_TIME
 
-TrackerGMD::TrackerGMD(const bool show_tracking, ExampleGenerator* example_generator,  RegressorTrainBase* regressor_train) :
+TrackerGMD::TrackerGMD(const bool show_tracking, ExampleGenerator* example_generator,  RegressorTrainBase* regressor_train,
+                       AsyncHeadTrainer* async_trainer) :
     Tracker(show_tracking),
     example_generator_(example_generator),
     regressor_train_(regressor_train),
-    hrt_("TrackerGMD")
+    async_trainer_(async_trainer),
+    sampler_(NULL),
+    features_finetune_(LONG_TERM_BAG_SIZE + 1),
+    hrt_("TrackerGMD"),
+    own_size_hint_(true),
+    last_confidence_(-1),
+    last_motion_(0),
+    frame_id_(-1),
+    next_frame_id_(-1)
 {
-    gsl_rng_env_setup();
-    rng_ = gsl_rng_alloc(gsl_rng_mt19937);
-    gsl_rng_set(rng_, time(NULL));
-    // gsl_rng_set(rng_, SEED_RNG_TRACKER); // to reproduce
-    engine_.seed(time(NULL));
-    // engine_.seed(SEED_ENGINE);
+#ifdef REPRODUCIBLE_RNG
+    Seed(SEED_RNG_TRACKER);
+#else
+    Seed(time(NULL));
+#endif
+    sampler_ = CandidateSampler(&rng_);
+
+    // the crops of the example generator are consumed before the next Reset, no need for new images every time
+    if (example_generator_ != NULL) {
+        example_generator_->set_reuse_crops(true);
+    }
 
     sd_trans_ = SD_X;
     sd_scale_ = SD_SCALE;
     sd_ap_ = SD_AP;
+
+    bbox_finetuner_.setDebugValidation(kBboxRegressionValidation);
 }
 
 // Estimate the location of the target object in the current image.
 void TrackerGMD::Track(const cv::Mat& image_curr, RegressorBase* regressor, BoundingBox* bbox_estimate_uncentered) {
+    PrepareTrack(image_curr, regressor);
+
+    // Estimate the bounding box location as the ML estimate of the candidate_bboxes
+    regressor->PredictFast(image_curr, search_region_, target_tight_, candidates_bboxes_, bbox_prev_tight_, bbox_estimate_uncentered, &candidate_probabilities_, &sorted_idxes_, sd_trans_, cur_frame_);
+
+    FinishTrack(image_curr, regressor, bbox_estimate_uncentered);
+}
+
+void TrackerGMD::PrepareTrack(const cv::Mat& image_curr, RegressorBase* regressor) {
+    // pick up the head weights of a finished background fine tune, if any
+    if (async_trainer_ != NULL) {
+        async_trainer_->PublishIfReady();
+    }
+
+    // every call on the regressor about this frame, up to UpdateState, is made under one frame id
+    frame_id_ = next_frame_id_ >= 0 ? next_frame_id_ : RegressorBase::NewFrameId();
+    next_frame_id_ = -1;
+    regressor->SetFrameId(frame_id_);
+
     // Get target from previous image.
     cv::Mat target_pad;
-    CropPadImage(bbox_prev_tight_, image_prev_, &target_pad);
+    CropPadImage(bbox_prev_tight_, image_prev_, &target_crop_, &target_pad);
 
     // Crop the current image based on predicted prior location of target.
-    cv::Mat curr_search_region;
     BoundingBox search_location;
     double edge_spacing_x, edge_spacing_y;
-    CropPadImage(bbox_curr_prior_tight_, image_curr, &curr_search_region, &search_location, &edge_spacing_x, &edge_spacing_y);
+    CropPadImage(bbox_curr_prior_tight_, image_curr, &search_crop_, &search_region_, &search_location, &edge_spacing_x, &edge_spacing_y);
 
     // get target_tight
-    cv::Mat target_tight;
     BoundingBox bbox_prev_within(bbox_prev_tight_);
     bbox_prev_within.crop_against_width_height(image_prev_.size().width, image_prev_.size().height);
-    bbox_prev_within.CropBoundingBoxOutImage(image_prev_, &target_tight);
+    bbox_prev_within.CropBoundingBoxOutImage(image_prev_, &target_tight_);
 
     // Motion Model to get candidate_bboxes, use class attributes, record the scores and candidates
     candidates_bboxes_.clear();
@@ -58,7 +118,9 @@ void TrackerGMD::Track(const cv::Mat& image_curr, RegressorBase* regressor, Boun
     hrt_.reset();
     hrt_.start();
 #endif
-    GetCandidates(bbox_curr_prior_tight_, image_curr.size().width, image_curr.size().height, candidates_bboxes_);
+    const int W = image_curr.size().width;
+    const int H = image_curr.size().height;
+    GetCandidates(bbox_curr_prior_tight_, W, H, FirstRoundBudget(), candidates_bboxes_);
 #ifdef LOG_TIME
     hrt_.stop();
     cout << "time spent for genrating motion candiadates: " << hrt_.getMilliseconds() << " ms" << endl;
@@ -66,8 +128,59 @@ void TrackerGMD::Track(const cv::Mat& image_curr, RegressorBase* regressor, Boun
 
     candidate_probabilities_.clear();
     sorted_idxes_.clear(); // sorted indexes of candidates from highest positive prob to lowest
-    // Estimate the bounding box location as the ML estimate of the candidate_bboxes
-    regressor->PredictFast(image_curr, curr_search_region, target_tight, candidates_bboxes_, bbox_prev_tight_, bbox_estimate_uncentered, &candidate_probabilities_, &sorted_idxes_, sd_trans_, cur_frame_);
+    // the whole frame (scoring, sample generation, regression) is processed at the scale of the last estimate
+    if (own_size_hint_) {
+        regressor->SetTargetSizeHint(bbox_prev_tight_);
+    }
+    regressor->SetFrameArena(&frame_arena_);
+}
+
+void TrackerGMD::ScorePooled(const int t, RegressorBase* regressor, BoundingBox* bbox_estimate_uncentered) {
+    regressor->SetFrameArena(&frame_arena_);
+    regressor->PredictFastPooled(t, candidates_bboxes_, bbox_prev_tight_, bbox_estimate_uncentered, &candidate_probabilities_, &sorted_idxes_, sd_trans_, cur_frame_);
+}
+
+void TrackerGMD::ScoreAlone(const cv::Mat& image_curr, RegressorBase* regressor, std::vector<float>* probabilities) {
+    regressor->SetFrameId(frame_id_);
+    regressor->SetFrameArena(&frame_arena_);
+    probabilities->clear();
+    std::vector<int> sorted_idxes;
+    BoundingBox estimate;
+    regressor->PredictFast(image_curr, search_region_, target_tight_, candidates_bboxes_, bbox_prev_tight_, &estimate, probabilities, &sorted_idxes, sd_trans_, cur_frame_);
+}
+
+void TrackerGMD::FinishTrack(const cv::Mat& image_curr, RegressorBase* regressor, BoundingBox* bbox_estimate_uncentered) {
+    // other targets may have used the regressor since PrepareTrack
+    regressor->SetFrameId(frame_id_);
+    regressor->SetFrameArena(&frame_arena_);
+
+    // while the estimate stays uncertain, score more draws of the same motion model, the conv map is cached
+    const int W = image_curr.size().width;
+    const int H = image_curr.size().height;
+    int num_rounds = 1;
+    int budget = 0;
+    while (candidate_budget_.adaptive && num_rounds < candidate_budget_.max_rounds
+           && (budget = NextRoundBudget()) > (int)candidates_bboxes_.size()) {
+        round_bboxes_.clear();
+        // too few draws fall in the frame to move the top estimates, more rounds would not find more
+        if (GetCandidates(bbox_curr_prior_tight_, W, H, budget - (int)candidates_bboxes_.size(), round_bboxes_) < TOP_ESTIMATES) {
+            break;
+        }
+        round_probabilities_.clear();
+        round_sorted_idxes_.clear();
+        BoundingBox round_estimate;
+        regressor->PredictFast(image_curr, search_region_, target_tight_, round_bboxes_, bbox_prev_tight_, &round_estimate, &round_probabilities_, &round_sorted_idxes_, sd_trans_, cur_frame_);
+        MergeRound(bbox_estimate_uncentered);
+        num_rounds++;
+    }
+
+    candidate_budget_stats_.frames++;
+    candidate_budget_stats_.candidates += candidates_bboxes_.size();
+    candidate_budget_stats_.rounds += num_rounds;
+    if (candidate_budget_.log) {
+        printf("frame %d: %zu candidates in %d rounds, top %d average %.3lf\n", cur_frame_, candidates_bboxes_.size(),
+               num_rounds, TOP_ESTIMATES, TopEstimatesAverage());
+    }
 
 #ifdef DEBUG_SHOW_CANDIDATES
 
@@ -154,117 +267,83 @@ bool TrackerGMD::ValidCandidate(BoundingBox &candidate_bbox, int W, int H) {
     return true;
 }
 
-void TrackerGMD::GetCandidates(BoundingBox &cur_bbox, int W, int H, std::vector<BoundingBox> &candidate_bboxes) {
-    while(candidate_bboxes.size() < SAMPLE_CANDIDATES ) {
-        BoundingBox this_candidate_bbox = GenerateOneGaussianCandidate(W, H, cur_bbox, sd_trans_, sd_trans_, sd_scale_, sd_ap_);
-        // // crop against W, H so that fit in image
-        // this_candidate_bbox.crop_against_width_height(W, H);
-        // if at boarder, do not crop, to avoid really thin candidates being fed in -> correspond to cropping gt in training, instead of cropping pos/neg samples
-        if (this_candidate_bbox.valid_bbox_against_width_height(W, H)) {
-            candidate_bboxes.push_back(this_candidate_bbox);
-        }
-    }
-}
-
-BoundingBox TrackerGMD::GenerateOneGaussianCandidate(int W, int H, BoundingBox &bbox, double sd_x, double sd_y, double sd_scale, double sd_ap) {
-  double w = bbox.x2_ - bbox.x1_;
-  double h = bbox.y2_ - bbox.y1_;
-  double ap = h/w;
-  
-  double centre_x = bbox.x1_ + w/2.0;
-  double centre_y = bbox.y1_ + h/2.0;
-
-  double r = round((w+h)/2.0);
-
-  double moved_centre_x = centre_x + sd_x * r * std::max(-KEEP_SD, std::min(KEEP_SD, gsl_ran_gaussian(rng_, 1.0))); // keep the range in [-KEEP_SD* SD, KEEP_SD*SD]
-  double moved_centre_y = centre_y + sd_y * r * std::max(-KEEP_SD, std::min(KEEP_SD, gsl_ran_gaussian(rng_, 1.0))); 
-
-  double ds = pow(MOTION_SCALE_FACTOR, sd_scale * std::max(-KEEP_SD, std::min(KEEP_SD, gsl_ran_gaussian(rng_, 1.0))) );
-  double dap = pow(MOTION_AP_FACTOR, sd_ap * std::max(-KEEP_SD, std::min(KEEP_SD, gsl_ran_gaussian(rng_, 1.0))) );
-  double moved_w = w * ds;
-  double moved_h = moved_w * (ap * dap);
-
-  BoundingBox moved_bbox;
-  moved_bbox.x1_ = moved_centre_x - moved_w /2.0;
-  moved_bbox.y1_ = moved_centre_y - moved_h /2.0;
-  moved_bbox.x2_ = moved_centre_x + moved_w/2.0;
-  moved_bbox.y2_ = moved_centre_y + moved_h/2.0;
-  
-  return moved_bbox;
+int TrackerGMD::GetCandidates(BoundingBox &cur_bbox, int W, int H, const int num, std::vector<BoundingBox> &candidate_bboxes) {
+    // if at boarder, do not crop, to avoid really thin candidates being fed in -> correspond to cropping gt in training, instead of cropping pos/neg samples
+    candidate_draws_.clear();
+    const int count = sampler_.SampleAccepted(cur_bbox, num, W, H, SAMPLE_GAUSSIAN_AP,
+                                              SampleParams(POS_TRANS_RANGE, POS_SCALE_RANGE, sd_trans_, sd_trans_, sd_scale_, sd_ap_),
+                                              -FLT_MAX, FLT_MAX, &candidate_draws_);
+    candidate_draws_.AppendTo(&candidate_bboxes);
+    return count;
 }
 
 void TrackerGMD::FineTuneWorker(ExampleGenerator* example_generator,
                                 RegressorTrainBase* regressor_train,
                                 std::vector<int> &this_bag,
                                 const int pos_candidate_upper_bound, 
-                                const int neg_candidate_upper_bound) {
+                                const int neg_candidate_upper_bound,
+                                const int frames_per_batch) {
 
     std::vector<int> this_bag_permuted(this_bag);
-    std::shuffle(this_bag_permuted.begin(), this_bag_permuted.end(), engine_);
-
-    // Actually perform fine tuning, note that do not do data augmentation for GOTURN part here
-    std::vector<cv::Mat> image_currs;
-    std::vector<cv::Mat> images;
-    std::vector<cv::Mat> targets;
-    std::vector<BoundingBox> bboxes_gt_scaled;
-    std::vector<std::vector<BoundingBox> > candidates; 
-    std::vector<std::vector<double> >  labels;
+    std::shuffle(this_bag_permuted.begin(), this_bag_permuted.end(), rng_);
+
+    // Actually perform fine tuning on the fc head only, the conv layers are fixed so the stored pooled features are still valid
+    FineTuneJob job;
+    std::vector<const float*> &target_features = job.target_features;
+    std::vector<std::vector<const float*> > &candidate_features = job.candidate_features; 
+    std::vector<std::vector<double> > &labels = job.labels;
+    job.frames_per_batch = frames_per_batch;
     
     for (int i = 0; i< this_bag_permuted.size(); i ++) {
-        std::vector<pair<double, BoundingBox> > label_to_candidate;
+        std::vector<pair<double, const float*> > label_to_candidate;
         std::vector<double> this_frame_labels;
-        std::vector<BoundingBox> this_frame_candidates;
+        std::vector<const float*> this_frame_candidates;
         
-        int this_update_idx = this_bag_permuted[i];
-        for (int j = 0; j < std::min((int)(candidates_finetune_pos_[this_update_idx].size()), pos_candidate_upper_bound);j++) {
-            label_to_candidate.push_back(std::make_pair(POS_LABEL, candidates_finetune_pos_[this_update_idx][j]));
+        const FrameFeatures &this_features = features_finetune_.at(this_bag_permuted[i]);
+        const float* pos_begin = this_features.candidates.data();
+        const float* neg_begin = pos_begin + this_features.num_pos * this_features.dim;
+        for (int j = 0; j < std::min(this_features.num_pos, pos_candidate_upper_bound);j++) {
+            label_to_candidate.push_back(std::make_pair(POS_LABEL, pos_begin + j * this_features.dim));
         }
-        for (int j = 0; j < std::min((int)(candidates_finetune_neg_[this_update_idx].size()), neg_candidate_upper_bound);j++) {
-            label_to_candidate.push_back(std::make_pair(NEG_LABEL, candidates_finetune_neg_[this_update_idx][j]));
+        for (int j = 0; j < std::min(this_features.num_neg, neg_candidate_upper_bound);j++) {
+            label_to_candidate.push_back(std::make_pair(NEG_LABEL, neg_begin + j * this_features.dim));
         }
 
         // random shuffle
-        std::shuffle(std::begin(label_to_candidate), std::end(label_to_candidate), engine_);
+        std::shuffle(std::begin(label_to_candidate), std::end(label_to_candidate), rng_);
 
         for (int i = 0; i< label_to_candidate.size(); i++) {
             this_frame_candidates.push_back(label_to_candidate[i].second);
             this_frame_labels.push_back(label_to_candidate[i].first);
         }
 
-        image_currs.push_back(image_currs_[this_update_idx]);
-        images.push_back(images_finetune_[this_update_idx]);
-        targets.push_back(targets_finetune_[this_update_idx]);
-        bboxes_gt_scaled.push_back(gts_[this_update_idx]);
-        candidates.push_back(this_frame_candidates);
+        // keep the frame alive for a background job, its slot may be reused before the job runs
+        job.frames.push_back(features_finetune_.handle(this_bag_permuted[i]));
+        target_features.push_back(this_features.target.data());
+        candidate_features.push_back(this_frame_candidates);
         labels.push_back(this_frame_labels);
     }
 
 #ifdef DEBUG_FINETUNE_WORKER
     int count = 0;
-    for (int i = 0; i< candidates.size();i++) {
-        count += candidates[i].size();
+    for (int i = 0; i< candidate_features.size();i++) {
+        count += candidate_features[i].size();
     }
     cout << "Total number of candidates for fine tune: " << count << endl;
 #endif
 
-    // feed to network to train
-    // regressor_train->TrainBatchFast(image_currs,
-    //                         images,
-    //                         targets,
-    //                         bboxes_gt_scaled,
-    //                         candidates,
-    //                         labels,
-    //                         -1,
-    //                         pos_candidate_upper_bound + neg_candidate_upper_bound, 
-    //                         NOHEM_FINETUNE); // k == -1 indicating fine tuning
-    
-    regressor_train->TrainBatchFast(image_currs,
-                            images,
-                            targets,
-                            bboxes_gt_scaled,
-                            candidates,
+    if (async_trainer_ != NULL) {
+        // train the shadow head, queued as the pending update if the previous one is still running
+        async_trainer_->Submit(job);
+        return;
+    }
+
+    // feed to the fc head to train, no conv forward/backward needed
+    regressor_train->TrainBatchFromFeatures(target_features,
+                            candidate_features,
                             labels,
-                            -1); // k == -1 indicating fine tuning
+                            INNER_BATCH_SIZE,
+                            frames_per_batch);
 
 }
 
@@ -276,7 +355,7 @@ void TrackerGMD::FineTuneOnline(ExampleGenerator* example_generator,
 #ifdef DEBUG_LOG
         cout << "cur_frame_:" << cur_frame_ << ", about to start long term fine tune, frames to use:" << endl;
         for (int i = 0 ; i < long_term_bag_.size(); i ++ ) {
-            cout << long_term_bag_[i] << ", ";
+            cout << features_finetune_.at(long_term_bag_[i]).frame << ", ";
         }
         cout << endl;
 #endif
@@ -284,7 +363,8 @@ void TrackerGMD::FineTuneOnline(ExampleGenerator* example_generator,
                        regressor_train,
                        long_term_bag_,
                        LONG_TERM_POS_CANDIDATE_UPPER_BOUND, 
-                       LONG_TERM_NEG_CANDIDATE_UPPER_BOUND);
+                       LONG_TERM_NEG_CANDIDATE_UPPER_BOUND,
+                       LONG_TERM_FRAMES_PER_BATCH);
     }
     
 
@@ -294,7 +374,7 @@ void TrackerGMD::FineTuneOnline(ExampleGenerator* example_generator,
 #ifdef DEBUG_LOG
         cout << "cur_frame_:" << cur_frame_ << ", about to start short term fine tune, frames to use:" << endl;
         for (int i = 0 ; i < short_term_bag_.size(); i ++ ) {
-            cout << short_term_bag_[i] << ", ";
+            cout << features_finetune_.at(short_term_bag_[i]).frame << ", ";
         }
         cout << endl;
 #endif
@@ -306,10 +386,13 @@ void TrackerGMD::FineTuneOnline(ExampleGenerator* example_generator,
 }
 
 
-void TrackerGMD::EnqueueOnlineTraningSamples(ExampleGenerator* example_generator, const cv::Mat &image_curr, const BoundingBox &estimate,  bool success_frame) {
+void TrackerGMD::EnqueueOnlineTraningSamples(ExampleGenerator* example_generator, RegressorBase* regressor, 
+                                             const cv::Mat &image_curr, const BoundingBox &estimate,  bool success_frame) {
 
-    std::vector<BoundingBox> this_frame_candidates_pos;
-    std::vector<BoundingBox> this_frame_candidates_neg;
+    std::vector<BoundingBox> &this_frame_candidates_pos = enqueue_candidates_pos_;
+    std::vector<BoundingBox> &this_frame_candidates_neg = enqueue_candidates_neg_;
+    this_frame_candidates_pos.clear();
+    this_frame_candidates_neg.clear();
 
     cv::Mat image;
     cv::Mat target;
@@ -324,15 +407,28 @@ void TrackerGMD::EnqueueOnlineTraningSamples(ExampleGenerator* example_generator
 #ifdef DEBUG_LOG
         cout << "cur_frame_:" << cur_frame_<< " is success frame, enqueue pos and neg examples for later fine tuning" << endl;
 #endif
-        example_generator->MakeCandidatesPos(&this_frame_candidates_pos, POS_CANDIDATES_FINETUNE, "gaussian", POS_TRANS_RANGE, POS_SCALE_RANGE, 
+        example_generator->MakeCandidatesPos(&this_frame_candidates_pos, POS_CANDIDATES_FINETUNE, SAMPLE_GAUSSIAN, POS_TRANS_RANGE, POS_SCALE_RANGE, 
                                              0.05, 0.05, 2.5); // trans sd 0.05, scale sd 2.5
-        example_generator->MakeCandidatesNeg(&this_frame_candidates_neg, NEG_CANDIDATES_FINETUNE, "uniform", 1.0, 2.5); // trans range 1, scale range 2.5
-        // example_generator->MakeCandidatesNeg(&this_frame_candidates_neg, NEG_CANDIDATES_FINETUNE/2, "whole", NEG_TRANS_RANGE, 5.0);
+        example_generator->MakeCandidatesNeg(&this_frame_candidates_neg, NEG_CANDIDATES_FINETUNE, SAMPLE_UNIFORM, 1.0, 2.5); // trans range 1, scale range 2.5
+        // example_generator->MakeCandidatesNeg(&this_frame_candidates_neg, NEG_CANDIDATES_FINETUNE/2, SAMPLE_WHOLE, NEG_TRANS_RANGE, 5.0);
         example_generator->MakeTrueExampleTight(&image, &target, &bbox_gt_scaled);
 
-        // enqueue this frame index
-        short_term_bag_.push_back(cur_frame_);
-        long_term_bag_.push_back(cur_frame_);
+        // keep only the pooled features, positive candidates first
+        std::vector<BoundingBox> &this_frame_candidates = enqueue_candidates_;
+        this_frame_candidates.assign(this_frame_candidates_pos.begin(), this_frame_candidates_pos.end());
+        this_frame_candidates.insert(this_frame_candidates.end(), this_frame_candidates_neg.begin(), this_frame_candidates_neg.end());
+
+        int slot = features_finetune_.Acquire(cur_frame_);
+        FrameFeatures &this_features = features_finetune_.at(slot);
+        regressor->GetPooledFeatures(image_curr, target, this_frame_candidates, 
+                                     &this_features.target, &this_features.candidates);
+        this_features.num_pos = this_frame_candidates_pos.size();
+        this_features.num_neg = this_frame_candidates_neg.size();
+        this_features.dim = this_frame_candidates.empty() ? 0 : this_features.candidates.size() / this_frame_candidates.size();
+
+        // enqueue this frame slot
+        short_term_bag_.push_back(slot);
+        long_term_bag_.push_back(slot);
 
         // remove old frames kept for online update
         while(short_term_bag_.size() > SHORT_TERM_BAG_SIZE) {
@@ -341,21 +437,11 @@ void TrackerGMD::EnqueueOnlineTraningSamples(ExampleGenerator* example_generator
         }
 
         while(long_term_bag_.size() > LONG_TERM_BAG_SIZE) {
-            // remove from beginning
-            candidates_finetune_pos_[long_term_bag_[0]].clear();
-            candidates_finetune_neg_[long_term_bag_[0]].clear();
+            // remove from beginning, the slot is reused by later frames
+            features_finetune_.Release(long_term_bag_[0]);
             long_term_bag_.erase(long_term_bag_.begin());
         }
     }
-
-    // if not success, push back dummy values
-    candidates_finetune_pos_.push_back(this_frame_candidates_pos);
-    candidates_finetune_neg_.push_back(this_frame_candidates_neg); 
-
-    image_currs_.push_back(image_curr);
-    images_finetune_.push_back(image);
-    targets_finetune_.push_back(target);
-    gts_.push_back(bbox_gt_scaled);
 }
 
 struct MyGreater
@@ -365,16 +451,78 @@ struct MyGreater
 };
 
 
-bool TrackerGMD::IsSuccessEstimate() {
-
+double TrackerGMD::TopEstimatesAverage() const {
   double prob_sum = 0;
-  // get top 5 score average 
-  for (int i = 0 ; i< TOP_ESTIMATES; i ++) {
+  // get top 5 score average, fewer if fewer candidates were accepted
+  const int num_top = std::min(TOP_ESTIMATES, (int)sorted_idxes_.size());
+  for (int i = 0 ; i< num_top; i ++) {
     double this_prob = candidate_probabilities_[sorted_idxes_[i]];
     prob_sum += this_prob;
   }
+  return num_top > 0 ? prob_sum / num_top : 0;
+}
 
-  double avg_prob = prob_sum / TOP_ESTIMATES;
+int TrackerGMD::FirstRoundBudget() const {
+  if (!candidate_budget_.adaptive || last_confidence_ < 0) {
+    return SAMPLE_CANDIDATES;
+  }
+  if (last_confidence_ <= SHORT_TERM_FINE_TUNE_TH) {
+    // lost in the last frame, search wider at once
+    return candidate_budget_.max_candidates;
+  }
+  if (last_confidence_ >= candidate_budget_.confident_prob && last_motion_ <= candidate_budget_.small_motion) {
+    return candidate_budget_.min_candidates;
+  }
+  return SAMPLE_CANDIDATES;
+}
+
+int TrackerGMD::NextRoundBudget() const {
+  const double confidence = TopEstimatesAverage();
+  if (confidence <= SHORT_TERM_FINE_TUNE_TH) {
+    return candidate_budget_.max_candidates;
+  }
+  if (confidence < candidate_budget_.confident_prob) {
+    return std::min(SAMPLE_CANDIDATES, candidate_budget_.max_candidates);
+  }
+  return 0;
+}
+
+void TrackerGMD::MergeRound(BoundingBox* bbox_estimate_uncentered) {
+  candidates_bboxes_.insert(candidates_bboxes_.end(), round_bboxes_.begin(), round_bboxes_.end());
+  candidate_probabilities_.insert(candidate_probabilities_.end(), round_probabilities_.begin(), round_probabilities_.end());
+
+  sorted_idxes_.resize(candidates_bboxes_.size());
+  std::iota(sorted_idxes_.begin(), sorted_idxes_.end(), 0);
+  const std::vector<float> &probabilities = candidate_probabilities_;
+  std::sort(sorted_idxes_.begin(), sorted_idxes_.end(),
+            [&probabilities](int i1, int i2) { return probabilities[i1] > probabilities[i2]; });
+
+  // same estimate as Regressor::PredictFast, over the candidates of all rounds
+  double x1_weighted = 0;
+  double y1_weighted = 0;
+  double x2_weighted = 0;
+  double y2_weighted = 0;
+  double denominator = 0;
+  for (int i = 0; i < std::min(TOP_ESTIMATES, (int)sorted_idxes_.size()); i++) {
+    const BoundingBox &this_bbox = candidates_bboxes_[sorted_idxes_[i]];
+    const double this_prob = candidate_probabilities_[sorted_idxes_[i]];
+    x1_weighted += this_bbox.x1_ * this_prob;
+    y1_weighted += this_bbox.y1_ * this_prob;
+    x2_weighted += this_bbox.x2_ * this_prob;
+    y2_weighted += this_bbox.y2_ * this_prob;
+    denominator += this_prob;
+  }
+  if (denominator > 0) {
+    *bbox_estimate_uncentered = BoundingBox(x1_weighted / denominator, y1_weighted / denominator,
+                                            x2_weighted / denominator, y2_weighted / denominator);
+  } else {
+    // nothing to weight, keep the last estimate
+    *bbox_estimate_uncentered = bbox_prev_tight_;
+  }
+}
+
+bool TrackerGMD::IsSuccessEstimate() {
+  double avg_prob = TopEstimatesAverage();
 #ifdef DEBUG_LOG
   cout <<"cur_frame_:" << cur_frame_ << " avg_prob: " << avg_prob << endl;
 #endif
@@ -388,26 +536,32 @@ bool TrackerGMD::IsSuccessEstimate() {
 }
 
 void TrackerGMD::Reset(RegressorBase *regressor) {
+    // no background update may touch the heads from here on
+    if (async_trainer_ != NULL) {
+        async_trainer_->Reset();
+    }
+
     // Reset the fine-tuned net for next video
-    regressor->Reset(); // reinitialise net_ and load new weights
+    regressor->Reset(); // restore the pristine weights in place
 
-    regressor_train_->ResetSolverNet(); // release solver_'s net_ memory and re-assign net_ to solver_
+    regressor_train_->ResetSolverNet(); // restore the pristine solver momentum
+
+    // the regressor goes back to its own scratch, it may outlive this tracker
+    regressor->SetFrameArena(NULL);
+    frame_arena_.Reset();
 
     cur_frame_ = 0;
+    // room for every round of an adaptive budget
+    const int max_candidates = std::max(SAMPLE_CANDIDATES, candidate_budget_.max_candidates);
     candidate_probabilities_.clear();
-    candidate_probabilities_.reserve(SAMPLE_CANDIDATES);
+    candidate_probabilities_.reserve(max_candidates);
     candidates_bboxes_.clear();
-    candidates_bboxes_.reserve(SAMPLE_CANDIDATES);
+    candidates_bboxes_.reserve(max_candidates);
     sorted_idxes_.clear();
-    sorted_idxes_.reserve(SAMPLE_CANDIDATES);
+    sorted_idxes_.reserve(max_candidates);
 
-    // samples collected along each frame
-    gts_.clear();
-    image_currs_.clear();
-    images_finetune_.clear();
-    targets_finetune_.clear();
-    candidates_finetune_pos_.clear();
-    candidates_finetune_neg_.clear(); 
+    // features collected along each frame
+    features_finetune_.Clear();
 
     // long term and short term 
     short_term_bag_.clear();
@@ -420,6 +574,12 @@ void TrackerGMD::Init(const cv::Mat& image_curr, const BoundingBox& bbox_gt,
                       RegressorBase* regressor) {
     // Initialize the neural network.
     regressor->Init();
+    frame_id_ = next_frame_id_ >= 0 ? next_frame_id_ : RegressorBase::NewFrameId();
+    next_frame_id_ = -1;
+    regressor->SetFrameId(frame_id_);
+    if (own_size_hint_) {
+        regressor->SetTargetSizeHint(bbox_gt);
+    }
 
     // fine tune at cur_frame_ 0
     cur_frame_ = 0;
@@ -438,11 +598,11 @@ void TrackerGMD::Init(const cv::Mat& image_curr, const BoundingBox& bbox_gt,
     example_generator_->MakeTrueExampleTight(&image_regress, &target_regress, &bbox_gt_scaled_regress);
     // Get the bbox conv features for training
     std::vector<BoundingBox> regress_bboxes;
-    example_generator_->MakeCandidatesPos(&regress_bboxes, 1000, "uniform_ap", POS_TRANS_RANGE, POS_SCALE_RANGE, \
+    example_generator_->MakeCandidatesPos(&regress_bboxes, 1000, SAMPLE_UNIFORM_AP, POS_TRANS_RANGE, POS_SCALE_RANGE, \
                                            SD_X, SD_Y, SD_SCALE, 0.6);
-    std::vector<std::vector<float> > features;
-    regressor->GetBBoxConvFeatures(image_curr, image_regress, target_regress, regress_bboxes, features);
-    bbox_finetuner_.trainModelUsingInitialFrameBboxes(features, regress_bboxes, bbox_gt);
+    bbox_features_.resize(regress_bboxes.size() * BBOX_REGRESSION_FEATURE_LENGTH);
+    regressor->GetBBoxConvFeatures(image_curr, image_regress, target_regress, regress_bboxes, &bbox_features_[0]);
+    bbox_finetuner_.trainModelUsingInitialFrameBboxes(&bbox_features_[0], regress_bboxes, bbox_gt);
 #endif 
 
     printf("About to fine tune the first frame ...\n");
@@ -481,10 +641,10 @@ void TrackerGMD::Init(const cv::Mat& image_curr, const BoundingBox& bbox_gt,
 
         // generate candidates and push to this_frame_candidates and this_frame_labels
         // example_generator_->MakeCandidatesAndLabels(&this_frame_candidates, &this_frame_labels, FIRST_FRAME_POS_SAMPLES, FIRST_FRAME_NEG_SAMPLES);
-        example_generator_->MakeCandidatesPos(&this_frame_candidates_pos, FIRST_FRAME_POS_SAMPLES, "gaussian", POS_TRANS_RANGE, POS_SCALE_RANGE,
+        example_generator_->MakeCandidatesPos(&this_frame_candidates_pos, FIRST_FRAME_POS_SAMPLES, SAMPLE_GAUSSIAN, POS_TRANS_RANGE, POS_SCALE_RANGE,
                                               0.05, 0.05, 2.5); // 0.05, 2.5
-        example_generator_->MakeCandidatesNeg(&this_frame_candidates_neg, FIRST_FRAME_NEG_SAMPLES/2, "uniform", 0.5, 5); // 0.5, 5
-        example_generator_->MakeCandidatesNeg(&this_frame_candidates_neg, FIRST_FRAME_NEG_SAMPLES/2, "whole", NEG_TRANS_RANGE, 5.0);
+        example_generator_->MakeCandidatesNeg(&this_frame_candidates_neg, FIRST_FRAME_NEG_SAMPLES/2, SAMPLE_UNIFORM, 0.5, 5); // 0.5, 5
+        example_generator_->MakeCandidatesNeg(&this_frame_candidates_neg, FIRST_FRAME_NEG_SAMPLES/2, SAMPLE_WHOLE, NEG_TRANS_RANGE, 5.0);
 
         // shuffling
         std::vector<std::pair<double, BoundingBox> > label_to_candidate;
@@ -496,7 +656,7 @@ void TrackerGMD::Init(const cv::Mat& image_curr, const BoundingBox& bbox_gt,
         }
 
         // random shuffle
-        std::shuffle(std::begin(label_to_candidate), std::end(label_to_candidate), engine_);
+        std::shuffle(std::begin(label_to_candidate), std::end(label_to_candidate), rng_);
 
         for (int i = 0; i< label_to_candidate.size(); i++) {
             this_frame_candidates.push_back(label_to_candidate[i].second);
@@ -545,6 +705,11 @@ void TrackerGMD::Init(const cv::Mat& image_curr, const BoundingBox& bbox_gt,
     }
     printf("Fine tune the first frame completed!\n");
 
+    // later updates start from the first frame fine tuned head
+    if (async_trainer_ != NULL) {
+        async_trainer_->SyncFromTracking(regressor);
+    }
+
 #ifdef FISRT_FRAME_PAUSE
   cv::Mat image_curr_show = image_curr.clone();
   bbox_gt.DrawBoundingBox(&image_curr_show);
@@ -562,10 +727,12 @@ void TrackerGMD::Init(const cv::Mat& image_curr, const BoundingBox& bbox_gt,
     bbox_curr_prior_tight_ = bbox_gt;
 
     // enqueue short term online learning samples, 50 POS and 200 NEG
-    EnqueueOnlineTraningSamples(example_generator_, image_curr, bbox_gt, true); // TODO, if first frame add random purturbations like GOTURN to simulate frame -1 to frame 0
+    EnqueueOnlineTraningSamples(example_generator_, regressor, image_curr, bbox_gt, true); // TODO, if first frame add random purturbations like GOTURN to simulate frame -1 to frame 0
 
     // at this point of time, cur_frame_ should be 1, since we start on 2nd frame of the sequnce, 1st frame we have the ground truth
     cur_frame_ = 1;
+    last_confidence_ = -1;
+    last_motion_ = 0;
 }
 
 void TrackerGMD::Init(const std::string& image_curr_path, const VOTRegion& region, 
@@ -582,6 +749,14 @@ void TrackerGMD::UpdateState(const cv::Mat& image_curr, BoundingBox &bbox_estima
     // Post processing after this frame, fine tune, invoke tracker_ -> finetune
     bool is_this_frame_success = IsSuccessEstimate();
 
+    // other trackers may have used the regressor since Track, the samples are pooled from this frame
+    regressor->SetFrameId(frame_id_);
+
+    // confidence and motion of this frame pick the candidate budget of the next one
+    last_confidence_ = TopEstimatesAverage();
+    last_motion_ = bbox_estimate.compute_center_distance(bbox_prev_tight_)
+                   / std::max(1.0, (fabs(bbox_prev_tight_.get_width()) + fabs(bbox_prev_tight_.get_height())) / 2);
+
     // update sd_trans_ in case of failure
     if (!is_this_frame_success) {
         sd_trans_ = std::min(0.75, 1.1 * sd_trans_);
@@ -593,9 +768,7 @@ void TrackerGMD::UpdateState(const cv::Mat& image_curr, BoundingBox &bbox_estima
 #ifdef BOUNDING_BOX_REGRESSION
     if (is_this_frame_success) {
         // wrap in a vector to use get features API
-        std::vector<std::vector<float> > bbox_features;
-        std::vector<BoundingBox> wrap_this_bbox_estimate;
-        wrap_this_bbox_estimate.push_back(bbox_estimate);
+        std::vector<BoundingBox> wrap_this_bbox_estimate(1, bbox_estimate);
         
         // TODO: the following is actually not needed, here to just comply with the API for GetBBoxConvFeatures
         example_generator_->Reset(bbox_prev_tight_,
@@ -609,13 +782,16 @@ void TrackerGMD::UpdateState(const cv::Mat& image_curr, BoundingBox &bbox_estima
         BoundingBox bbox_gt_scaled_regress;
         example_generator_->MakeTrueExampleTight(&image_regress, &target_regress, &bbox_gt_scaled_regress);
         
-        regressor->GetBBoxConvFeatures(image_curr, image_regress, target_regress, wrap_this_bbox_estimate, bbox_features);
-        bbox_finetuner_.refineBoundingBox(bbox_estimate, bbox_features[0]);
+        // bbox_features_ keeps its capacity from the first frame, no allocation here
+        bbox_features_.resize(wrap_this_bbox_estimate.size() * BBOX_REGRESSION_FEATURE_LENGTH);
+        regressor->GetBBoxConvFeatures(image_curr, image_regress, target_regress, wrap_this_bbox_estimate, &bbox_features_[0]);
+        bbox_finetuner_.refineBoundingBoxes(&wrap_this_bbox_estimate, &bbox_features_[0]);
+        bbox_estimate = wrap_this_bbox_estimate[0];
     }
 #endif
 
     // generate examples, if not success, just dummy values pushed in
-    EnqueueOnlineTraningSamples(example_generator_, image_curr, bbox_estimate, is_this_frame_success);
+    EnqueueOnlineTraningSamples(example_generator_, regressor, image_curr, bbox_estimate, is_this_frame_success);
 
     // afte generate examples, check if need to fine tune, and acutally fine tune if needed 
     FineTuneOnline(example_generator_, regressor_train_, is_this_frame_success, is_last_frame);
@@ -639,6 +815,14 @@ void TrackerGMD::UpdateState(const cv::Mat& image_curr, BoundingBox &bbox_estima
     // internel frame counter
     cur_frame_ ++;
 
+    // the frame is done, its scratch can be handed out again
+    frame_arena_.Reset();
+#ifdef LOG_FRAME_ALLOCATIONS
+    const FrameArenaStats &arena_stats = frame_arena_.last_frame_stats();
+    cout << "frame arena: " << arena_stats.allocations << " allocations, " << arena_stats.bytes << " bytes, "
+         << arena_stats.heap_allocations << " from the heap" << endl;
+#endif
+
 #ifdef LOG_TIME
     hrt_.stop();
     cout << "time spent for update state (possibly finetune): " << hrt_.getMilliseconds() << " ms" << endl;
@@ -5,22 +5,72 @@
 
 #include <stdlib.h>     /* srand, rand */
 #include <time.h>       /* time */
-#include <gsl/gsl_rng.h> 
-#include <gsl/gsl_randist.h> /* GAUSSIAN*/
 #include "helper/Constants.h"
 #include <limits.h>
 #include "helper/high_res_timer.h"
 #include "helper/bounding_box_regressor.h"
+#include "helper/candidate_set.h"
+#include "helper/candidate_sampler.h"
+#include "helper/rng_stream.h"
+#include "helper/frame_arena.h"
+#include "tracker/frame_feature_store.h"
+#include "tracker/async_head_trainer.h"
+
+// How many candidates TrackerGMD scores per frame
+struct CandidateBudget {
+  // fixed: SAMPLE_CANDIDATES every frame, the default mode, adaptive: see ADAPTIVE_CANDIDATE_BUDGET
+  CandidateBudget();
+  bool adaptive;
+
+  // first round after a confident frame with little motion, and total over the rounds of an uncertain frame
+  int min_candidates;
+  int max_candidates;
+  int max_rounds;
+  double confident_prob;
+  double small_motion;
+
+  // print the candidates and rounds of every frame
+  bool log;
+};
+
+// Candidates scored since the tracker was built
+struct CandidateBudgetStats {
+  CandidateBudgetStats() : frames(0), candidates(0), rounds(0) { }
+  int frames;
+  long candidates;
+  long rounds;
+};
 
 class TrackerGMD : public Tracker {
 
 public:
-  TrackerGMD(const bool show_tracking, ExampleGenerator* example_generator,  RegressorTrainBase* regressor_train);
+  // With async_trainer, online fine tuning runs in the background and Track uses the last published head
+  TrackerGMD(const bool show_tracking, ExampleGenerator* example_generator,  RegressorTrainBase* regressor_train,
+             AsyncHeadTrainer* async_trainer = NULL);
 
   // Estimate the location of the target object in the current image.
   virtual void Track(const cv::Mat& image_curr, RegressorBase* regressor,
              BoundingBox* bbox_estimate_uncentered);
 
+  // Track in three steps, so that several targets can be scored on one ROI pooling (TrackerMultiTarget):
+  // PrepareTrack crops the target and draws the first round of candidates, the caller pools them together with the
+  // other targets' (RegressorBase::PoolCandidates), ScorePooled scores them as pooled target t, and FinishTrack runs
+  // the further rounds of an adaptive budget, which may run the network again.
+  void PrepareTrack(const cv::Mat& image_curr, RegressorBase* regressor);
+  void ScorePooled(const int t, RegressorBase* regressor, BoundingBox* bbox_estimate_uncentered);
+  void FinishTrack(const cv::Mat& image_curr, RegressorBase* regressor, BoundingBox* bbox_estimate_uncentered);
+
+  // Target crop and first round candidates of the frame being tracked, after PrepareTrack
+  const cv::Mat& GetTargetTight() const { return target_tight_; }
+  const std::vector<BoundingBox>& GetFirstRoundCandidates() const { return candidates_bboxes_; }
+
+  // Probabilities of the candidates scored so far in the frame being tracked, after ScorePooled only the first round
+  const std::vector<float>& GetCandidateProbabilities() const { return candidate_probabilities_; }
+
+  // Score the first round candidates on their own with the current head, as Track does, e.g. to check what
+  // ScorePooled read from the pooled rows; runs the network again but leaves the state of the frame alone
+  void ScoreAlone(const cv::Mat& image_curr, RegressorBase* regressor, std::vector<float>* probabilities);
+
   // After tracking for this frame, update internal state
   virtual void UpdateState(const cv::Mat& image_curr, BoundingBox &bbox_estimate, RegressorBase* regressor, bool is_last_frame);
 
@@ -40,29 +90,55 @@ public:
                                 RegressorTrainBase* regressor_train,
                                 std::vector<int> &this_bag,
                                 const int pos_candidate_upper_bound = INT_MAX, 
-                                const int neg_candidate_upper_bound = INT_MAX);
+                                const int neg_candidate_upper_bound = INT_MAX,
+                                const int frames_per_batch = 1);
 
-  // Motion Model around bbox_curr_prior_tight_
-  void GetCandidates(BoundingBox &cur_bbox, int W, int H, std::vector<BoundingBox> &candidate_bboxes);
+  // Motion Model around cur_bbox, appends up to num candidates inside the W x H frame and returns how many: fewer
+  // once the bounded draws of CandidateSampler::SampleAccepted run out, none e.g. for a box outside the frame
+  int GetCandidates(BoundingBox &cur_bbox, int W, int H, const int num, std::vector<BoundingBox> &candidate_bboxes);
 
   // Check if generated candidate is valid or not
   bool ValidCandidate(BoundingBox &candidate_bbox, int W, int H);
 
-  // Get one moved box, according to the Gaussian Motion Model
-  BoundingBox GenerateOneGaussianCandidate(int W, int H, BoundingBox &bbox, double sd_x = SD_X, double sd_y = SD_Y, 
-                                           double sd_scale = SD_SCALE, double sd_ap = SD_AP);
-
   // Create and Enqueue Training Samples given already set up example_generator
-  virtual void EnqueueOnlineTraningSamples(ExampleGenerator* example_generator, const cv::Mat &image_curr, const BoundingBox &estimate,  bool success_frame);
+  virtual void EnqueueOnlineTraningSamples(ExampleGenerator* example_generator, RegressorBase* regressor, 
+                                           const cv::Mat &image_curr, const BoundingBox &estimate,  bool success_frame);
 
   // check if the current estimate is success, needed as flag to pass to EnqueueOnlineTraningSamples
   virtual bool IsSuccessEstimate();
 
+  // Average probability of the TOP_ESTIMATES best candidates of the current frame
+  double TopEstimatesAverage() const;
+
   // clear all the related storage for tracking net video
   virtual void Reset(RegressorBase *regressor);
 
+  // Restart the random draws of this tracker, two trackers with the same seed draw the same candidates
+  void Seed(const uint64_t seed) { rng_.Seed(seed, RNG_STREAM_TRACKER); }
+
+  // Whether Track and Init set the regressor's target size hint (and so its input scale) from this target, off
+  // when several targets share one backbone pass and the hint is set for all of them
+  void set_own_size_hint(const bool own_size_hint) { own_size_hint_ = own_size_hint; }
+
+  // Switch between a fixed and a confidence-adaptive number of candidates, e.g. per stream to fit a CPU budget
+  void set_candidate_budget(const CandidateBudget& budget) { candidate_budget_ = budget; }
+  const CandidateBudgetStats& candidate_budget_stats() const { return candidate_budget_stats_; }
+
+  // Id (RegressorBase::NewFrameId) of the frame given to the next Track or Init, when the caller already handed
+  // that frame to the regressor, e.g. in ForwardBackboneBatch; a new one is drawn otherwise
+  void set_frame_id(const int64_t frame_id) { next_frame_id_ = frame_id; }
+
+  // What the regressor took from frame_arena_ in the last frame tracked
+  const FrameArenaStats& frame_arena_stats() const { return frame_arena_.last_frame_stats(); }
+
+  // Fine tune samples kept so far, bounded by LONG_TERM_BAG_SIZE frames however long the sequence
+  const FrameFeatureStore& features_finetune() const { return features_finetune_; }
+  int short_term_bag_size() const { return short_term_bag_.size(); }
+  int long_term_bag_size() const { return long_term_bag_.size(); }
+
 private:
-  gsl_rng *rng_;
+  // every random draw of this tracker, candidates and shuffles, comes from rng_
+  RngStream rng_;
 
   // Used to generate additional training examples through synthetic transformations.
   ExampleGenerator* example_generator_;
@@ -70,28 +146,29 @@ private:
   // Neural network.
   RegressorTrainBase* regressor_train_;
 
+  // Background fine tuning of a shadow head, NULL to fine tune synchronously with regressor_train_
+  AsyncHeadTrainer* async_trainer_;
 
   // this prediction scores for candidates
   std::vector<float> candidate_probabilities_;
   std::vector<BoundingBox> candidates_bboxes_;
+
+  // search region and tight target crop of the frame being tracked, from PrepareTrack
+  cv::Mat search_region_;
+  cv::Mat target_tight_;
+
+  // Gaussian motion model draws from rng_, and scratch for the accepted ones
+  CandidateSampler sampler_;
+  CandidateSet candidate_draws_;
   std::vector<int> sorted_idxes_; // the sorted indexes of probabilities from high to low
 
-  // samples collected along each frame
-  std::vector<BoundingBox> gts_;
-  std::vector<cv::Mat> image_currs_;
-  std::vector<cv::Mat> images_finetune_;
-  std::vector<cv::Mat> targets_finetune_;
-  std::vector<std::vector<BoundingBox> > candidates_finetune_pos_;
-  std::vector<std::vector<BoundingBox> > candidates_finetune_neg_; 
-  // std::vector<std::vector<double> > labels_finetune_pos_;
-  // std::vector<std::vector<double> > labels_finetune_neg_;
-
-  // long term and short term 
+  // pooled features of the success frames, one slot per frame in long_term_bag_
+  FrameFeatureStore features_finetune_;
+
+  // long term and short term, slot indexes in features_finetune_
   std::vector<int> short_term_bag_;
   std::vector<int> long_term_bag_;
 
-  std::mt19937 engine_;
-
   // for motion model candidates
   double sd_trans_;
   double sd_scale_;
@@ -103,6 +180,46 @@ private:
   // Bbox regressor
   BoundingBoxRegressor bbox_finetuner_;
 
+  // ROI features of the boxes given to bbox_finetuner_, one row per box, reused across frames
+  std::vector<float> bbox_features_;
+
+  // see set_own_size_hint
+  bool own_size_hint_;
+
+  // Candidates of the first round of the next frame, from the confidence and motion of the last one
+  int FirstRoundBudget() const;
+
+  // Candidates in total the current frame should have been scored with after the rounds so far
+  int NextRoundBudget() const;
+
+  // Merge a round of candidates scored on their own into candidates_bboxes_ and the probabilities, and re-estimate
+  void MergeRound(BoundingBox* bbox_estimate_uncentered);
+
+  CandidateBudget candidate_budget_;
+  CandidateBudgetStats candidate_budget_stats_;
+
+  // top TOP_ESTIMATES average (-1 before the first tracked frame) and center motion relative to the target size of
+  // the last frame
+  double last_confidence_;
+  double last_motion_;
+
+  // regressor frame id of the frame being tracked, from Track to UpdateState, and the one set for the next Track
+  int64_t frame_id_;
+  int64_t next_frame_id_;
+
+  // candidates of a round after the first one and their scores, reused across frames
+  std::vector<BoundingBox> round_bboxes_;
+  std::vector<float> round_probabilities_;
+  std::vector<int> round_sorted_idxes_;
+
+  // scratch of one frame of scoring, given back at the end of UpdateState
+  FrameArena frame_arena_;
+
+  // candidates drawn for a success frame, positive ones first in enqueue_candidates_, reused across frames
+  std::vector<BoundingBox> enqueue_candidates_pos_;
+  std::vector<BoundingBox> enqueue_candidates_neg_;
+  std::vector<BoundingBox> enqueue_candidates_;
+
 };
 
 #endif
\ No newline at end of file
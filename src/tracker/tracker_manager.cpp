@@ -3,8 +3,11 @@
 #include <string>
 
 #include "helper/helper.h"
+#include "network/regressor_train.h"
+#include "tracker/tracker_gmd.h"
 #include "train/tracker_trainer.h"
 #include <algorithm>
+#include <cfloat>
 
 using std::string;
 
@@ -12,17 +15,70 @@ TrackerManager::TrackerManager(const std::vector<Video>& videos,
                                RegressorBase* regressor, Tracker* tracker) :
   videos_(videos),
   regressor_(regressor),
-  tracker_(tracker)
+  tracker_(tracker),
+  prefetch_depth_(0)
 {
 }
 
+void TrackerManager::SetPrefetch(const int depth, const int num_threads) {
+  prefetch_depth_ = std::max(depth, 0);
+  if (prefetch_depth_ > 0) {
+    prefetcher_.reset(new FramePrefetcher(prefetch_depth_, num_threads));
+  }
+  else {
+    prefetcher_.reset();
+  }
+}
+
+void TrackerManager::SetVideoSubset(const std::vector<size_t>& video_nums) {
+  video_selected_.assign(videos_.size(), false);
+  for (size_t i = 0; i < video_nums.size(); i++) {
+    video_selected_[video_nums[i]] = true;
+  }
+}
+
+std::vector<std::vector<size_t> > TrackerManager::ShardVideos(const std::vector<Video>& videos, const int num_shards) {
+  std::vector<size_t> order(videos.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&videos](size_t a, size_t b) {
+    return videos[a].all_frames.size() > videos[b].all_frames.size();
+  });
+
+  std::vector<std::vector<size_t> > shards(num_shards);
+  std::vector<size_t> shard_frames(num_shards, 0);
+  for (size_t i = 0; i < order.size(); i++) {
+    const int shard = std::min_element(shard_frames.begin(), shard_frames.end()) - shard_frames.begin();
+    shards[shard].push_back(order[i]);
+    shard_frames[shard] += videos[order[i]].all_frames.size();
+  }
+
+  // each shard tracks its videos in the original order
+  for (int i = 0; i < num_shards; i++) {
+    std::sort(shards[i].begin(), shards[i].end());
+  }
+  return shards;
+}
+
 void TrackerManager::TrackAll() {
   TrackAll(0, 1);
 }
 
 void TrackerManager::TrackAll(const size_t start_video_num, const int pause_val) {
+  // end to end time, loading, tracking and the subclass processing, and the part of it spent waiting for frames
+  HighResTimer hrt_all("TrackAll", CLOCK_MONOTONIC);
+  HighResTimer hrt_load("TrackAll load", CLOCK_MONOTONIC);
+  double load_ms = 0;
+  int num_frames = 0;
+  hrt_all.start();
+
   // Iterate over all videos and track the target object in each.
   for (size_t video_num = start_video_num; video_num < videos_.size(); ++video_num) {
+    if (!video_selected_.empty() && !video_selected_[video_num]) {
+      continue;
+    }
+
     // Get the video.
     const Video& video = videos_[video_num];
 
@@ -38,6 +94,11 @@ void TrackerManager::TrackAll(const size_t start_video_num, const int pause_val)
     // Initialize the tracker.
     tracker_->Init(image_curr, bbox_gt, regressor_);
 
+    // the remaining frames are decoded in the background from here on
+    if (prefetcher_) {
+      prefetcher_->Start(&video, first_frame + 1, video.all_frames.size());
+    }
+
     // Iterate over the remaining frames of the video.
     for (size_t frame_num = first_frame + 1; frame_num < video.all_frames.size(); ++frame_num) {
 
@@ -47,10 +108,20 @@ void TrackerManager::TrackAll(const size_t start_video_num, const int pause_val)
       const bool load_only_annotation = false;
       cv::Mat image_curr;
       BoundingBox bbox_gt;
-      bool has_annotation = video.LoadFrame(frame_num,
-                                            draw_bounding_box,
-                                            load_only_annotation,
-                                            &image_curr, &bbox_gt);
+      bool has_annotation;
+      if (prefetcher_) {
+        has_annotation = prefetcher_->Get(frame_num, &image_curr, &bbox_gt);
+      }
+      else {
+        hrt_load.start();
+        has_annotation = video.LoadFrame(frame_num,
+                                         draw_bounding_box,
+                                         load_only_annotation,
+                                         &image_curr, &bbox_gt);
+        hrt_load.stop();
+      }
+      num_frames++;
+
       // Get ready to track the object.
       SetupEstimate();
 
@@ -68,8 +139,18 @@ void TrackerManager::TrackAll(const size_t start_video_num, const int pause_val)
                            bbox_estimate_uncentered, pause_val);
 
     }
+    if (prefetcher_) {
+      load_ms += prefetcher_->wait_ms();
+    }
     PostProcessVideo(video_num);
   }
+  hrt_all.stop();
+  load_ms += hrt_load.getMilliseconds();
+
+  if (num_frames > 0) {
+    printf("End to end: %d frames in %lf s, %lf fps, %lf ms per frame waiting for frames (prefetch depth %d)\n",
+           num_frames, hrt_all.getSeconds(), num_frames / hrt_all.getSeconds(), load_ms / num_frames, prefetch_depth_);
+  }
   PostProcessAll();
 }
 
@@ -118,7 +199,7 @@ TrackerFineTune::TrackerFineTune(const std::vector<Video>& videos,
   TrackerManager(videos, regressor, tracker),
   save_videos_(save_videos),
   output_folder_(output_folder),
-  hrt_("TrackerFineTune"),
+  hrt_("TrackerFineTune", CLOCK_MONOTONIC),
   total_ms_(0),
   num_frames_(0),
   fps_(20),
@@ -178,6 +259,7 @@ void TrackerFineTune::ProcessTrackOutput(
 
   // Increment number of frames tracked
   num_frames_ ++;
+  frame_ms_.push_back(ms);
 
   printf("Track frame %zu, time spent: %lf ms\n\n", frame_num, ms);
 
@@ -221,9 +303,42 @@ void TrackerFineTune::PostProcessVideo(size_t video_num) {
   const double mean_fps = num_frames_ / (total_ms_ / 1000.0);
   printf("Video %zu Mean fps: %lf ms\n", video_num, mean_fps);
 
+  ReportLatencyHistogram(video_num);
+
   // reset counters
   total_ms_ = 0;
   num_frames_ = 0;
+  frame_ms_.clear();
+}
+
+void TrackerFineTune::ReportLatencyHistogram(size_t video_num) {
+  if (frame_ms_.empty()) {
+    return;
+  }
+
+  std::vector<double> sorted_ms(frame_ms_);
+  std::sort(sorted_ms.begin(), sorted_ms.end());
+  const int n = sorted_ms.size();
+  printf("Video %zu frame latency: p50 %lf ms, p90 %lf ms, p99 %lf ms, max %lf ms\n", video_num,
+         sorted_ms[(n - 1) * 50 / 100], sorted_ms[(n - 1) * 90 / 100], sorted_ms[(n - 1) * 99 / 100], sorted_ms[n - 1]);
+
+  // power of two buckets, [0, 1) ms, [1, 2) ms, [2, 4) ms, ...
+  std::vector<int> buckets;
+  for (int i = 0; i < n; i++) {
+    int bucket = 0;
+    while (sorted_ms[i] >= (1 << bucket)) {
+      bucket ++;
+    }
+    if (bucket >= buckets.size()) {
+      buckets.resize(bucket + 1, 0);
+    }
+    buckets[bucket] ++;
+  }
+
+  for (int i = 0; i < buckets.size(); i++) {
+    const int lower = i == 0 ? 0 : (1 << (i - 1));
+    printf("  [%6d, %6d) ms: %6d %s\n", lower, 1 << i, buckets[i], std::string(buckets[i] * 50 / n, '#').c_str());
+  }
 }
 
 void TrackerFineTune::SetupEstimate() {
@@ -334,3 +449,133 @@ void TrackerTesterAlov::PostProcessAll() {
   const double mean_time_ms = total_ms_ / num_frames_;
   printf("Mean time: %lf ms\n", mean_time_ms);
 }
+
+TrackerSizeBenchmark::TrackerSizeBenchmark(const std::vector<Video>& videos,
+                                           RegressorBase* regressor, Tracker* tracker) :
+  TrackerManager(videos, regressor, tracker),
+  hrt_("TrackerSizeBenchmark", CLOCK_MONOTONIC)
+{
+  const double upper[] = {32, 64, 128, 256, DBL_MAX};
+  bucket_upper_.assign(upper, upper + sizeof(upper) / sizeof(upper[0]));
+  bucket_frames_.assign(bucket_upper_.size(), 0);
+  bucket_ms_.assign(bucket_upper_.size(), 0);
+  bucket_iou_.assign(bucket_upper_.size(), 0);
+  bucket_success_.assign(bucket_upper_.size(), 0);
+}
+
+void TrackerSizeBenchmark::VideoInit(const Video& video, const size_t video_num) {
+  total_num_frames_ = video.all_frames.size();
+  printf("Video: %zu\n", video_num);
+}
+
+void TrackerSizeBenchmark::SetupEstimate() {
+  hrt_.reset();
+  hrt_.start();
+}
+
+void TrackerSizeBenchmark::ProcessTrackOutput(
+    const size_t frame_num, const cv::Mat& image_curr, const bool has_annotation,
+    const BoundingBox& bbox_gt, const BoundingBox& bbox_estimate,
+    const int pause_val) {
+  hrt_.stop();
+  if (!has_annotation) {
+    return;
+  }
+
+  const int bucket = GetBucket(bbox_gt);
+  const double iou = bbox_estimate.compute_IOU(bbox_gt);
+  bucket_frames_[bucket]++;
+  bucket_ms_[bucket] += hrt_.getMilliseconds();
+  bucket_iou_[bucket] += iou;
+  if (iou > 0.5) {
+    bucket_success_[bucket]++;
+  }
+}
+
+void TrackerSizeBenchmark::PostProcessVideo(size_t video_num) {
+  tracker_->Reset(regressor_);
+}
+
+void TrackerSizeBenchmark::PostProcessAll() {
+  printf("%-14s %8s %8s %9s %9s\n", "target size", "frames", "fps", "mean IOU", "success");
+  double lower = 0;
+  for (int i = 0; i < bucket_upper_.size(); i++) {
+    char range[32];
+    if (bucket_upper_[i] == DBL_MAX) {
+      snprintf(range, sizeof(range), ">= %.0f", lower);
+    }
+    else {
+      snprintf(range, sizeof(range), "[%.0f, %.0f)", lower, bucket_upper_[i]);
+    }
+    lower = bucket_upper_[i];
+
+    const int n = bucket_frames_[i];
+    if (n == 0) {
+      printf("%-14s %8d %8s %9s %9s\n", range, 0, "-", "-", "-");
+      continue;
+    }
+    printf("%-14s %8d %8.2lf %9.3lf %9.3lf\n", range, n,
+           n / (bucket_ms_[i] / 1000.0), bucket_iou_[i] / n, double(bucket_success_[i]) / n);
+  }
+}
+
+void TrackerSizeBenchmark::GetTotals(int* frames, double* fps, double* mean_iou, double* success) const {
+  int n = 0;
+  double ms = 0;
+  double iou = 0;
+  int num_success = 0;
+  for (int i = 0; i < bucket_upper_.size(); i++) {
+    n += bucket_frames_[i];
+    ms += bucket_ms_[i];
+    iou += bucket_iou_[i];
+    num_success += bucket_success_[i];
+  }
+  *frames = n;
+  *fps = ms > 0 ? n / (ms / 1000.0) : 0;
+  *mean_iou = n > 0 ? iou / n : 0;
+  *success = n > 0 ? double(num_success) / n : 0;
+}
+
+int TrackerSizeBenchmark::GetBucket(const BoundingBox& bbox_gt) const {
+  const double size = sqrt(std::max(bbox_gt.compute_area(), 0.0));
+  int bucket = 0;
+  while (size >= bucket_upper_[bucket]) {
+    bucket++;
+  }
+  return bucket;
+}
+
+BenchmarkTotals RunBenchmarkPass(const std::vector<Video>& videos, const BenchmarkSetup& setup,
+                                 const std::string& description,
+                                 const std::function<void(RegressorTrain*, TrackerGMD*)>& configure,
+                                 const std::function<void(const RegressorTrain&, const TrackerGMD&)>& inspect) {
+  const bool do_train = true;
+  RegressorTrain regressor_train(setup.model_file,
+                               setup.trained_file,
+                               setup.gpu_id,
+                               setup.solver_file,
+                               3,
+                               do_train);
+
+  const bool show_tracking = false;
+  ExampleGenerator example_generator(setup.lambda_shift, setup.lambda_scale,
+                                    setup.min_scale, setup.max_scale);
+  TrackerGMD tracker_gmd(show_tracking, &example_generator, &regressor_train);
+  configure(&regressor_train, &tracker_gmd);
+
+  example_generator.Seed(SEED_RNG_EXAMPLE_GENERATOR);
+  tracker_gmd.Seed(SEED_RNG_TRACKER);
+  // Dropout of the fine tuned head
+  caffe::Caffe::set_random_seed(SEED_RNG_CAFFE);
+
+  printf("%s\n", description.c_str());
+  TrackerSizeBenchmark benchmark(videos, &regressor_train, &tracker_gmd);
+  benchmark.TrackAll();
+
+  BenchmarkTotals totals;
+  benchmark.GetTotals(&totals.frames, &totals.fps, &totals.mean_iou, &totals.success);
+  if (inspect) {
+    inspect(regressor_train, tracker_gmd);
+  }
+  return totals;
+}
@@ -4,12 +4,19 @@
 #include "network/regressor.h"
 #include "tracker/tracker.h"
 #include "loader/video.h"
+#include "loader/frame_prefetcher.h"
 #include "helper/high_res_timer.h"
+#include "helper/Constants.h"
+#include <boost/shared_ptr.hpp>
+#include <functional>
 
 // for fine tuning
 #include "train/example_generator.h"
 #include "network/regressor_train_base.h"
 
+class RegressorTrain;
+class TrackerGMD;
+
 // Manage the iteration over all videos and tracking the objects inside.
 class TrackerManager
 {
@@ -25,6 +32,19 @@ public:
   // pause_val is normally ignored.
   void TrackAll(const size_t start_video_num, const int pause_val);
 
+  // Decode up to depth frames ahead of tracking on num_threads threads, depth 0 (the default, no threads are
+  // started) loads every frame right before it is tracked. TrackAll reports the end to end fps, so that both can
+  // be compared.
+  void SetPrefetch(const int depth, const int num_threads = PREFETCH_THREADS);
+
+  // Track only the videos with these indexes into videos_, e.g. one shard of a parallel evaluation. The hooks
+  // still get the index into videos_, so that a shard writes the same output files as a run over all videos.
+  void SetVideoSubset(const std::vector<size_t>& video_nums);
+
+  // Split the videos into num_shards sets with about the same number of frames, longest video first onto the
+  // least loaded shard
+  static std::vector<std::vector<size_t> > ShardVideos(const std::vector<Video>& videos, const int num_shards);
+
   // Functions for subclasses that get called at appropriate times.
   virtual void VideoInit(const Video& video, const size_t video_num) {}
 
@@ -55,6 +75,13 @@ protected:
 
   // total number of frames
   int total_num_frames_;
+
+  // Background frame loading, NULL when frames are loaded synchronously
+  boost::shared_ptr<FramePrefetcher> prefetcher_;
+  int prefetch_depth_;
+
+  // Per video whether TrackAll tracks it, empty to track all
+  std::vector<bool> video_selected_;
 };
 
 // Track objects and visualize the tracker output.
@@ -100,6 +127,8 @@ public:
   virtual void SetupEstimate();
 
 private:
+  // Print percentiles and a histogram of frame_ms_ for this video
+  void ReportLatencyHistogram(size_t video_num);
 
   // Folder to save all tracking output.
   std::string output_folder_;
@@ -107,7 +136,7 @@ private:
   // File for saving tracking output coordinates (for evaluation).
   FILE* output_file_ptr_;
 
-  // Timer.
+  // Timer, wall clock so that time spent by a background fine tune thread is not counted.
   HighResTimer hrt_;
 
   // Total time used for tracking (Other time is used to save the tracking
@@ -117,6 +146,9 @@ private:
   // Number of frames tracked.
   int num_frames_;
 
+  // Tracking time of every frame of this video, Track and UpdateState
+  std::vector<double> frame_ms_;
+
   // Used to save tracking visualization data.
   cv::VideoWriter video_writer_;
 
@@ -184,5 +216,75 @@ private:
   bool save_videos_;
 };
 
+// Track without visualization and report speed and accuracy per target size bucket.
+class TrackerSizeBenchmark : public TrackerManager
+{
+public:
+  TrackerSizeBenchmark(const std::vector<Video>& videos,
+                       RegressorBase* regressor, Tracker* tracker);
+
+  virtual void VideoInit(const Video& video, const size_t video_num);
+
+  // Record the time before starting to track.
+  virtual void SetupEstimate();
+
+  // Add the frame's time and overlap with the ground truth to the bucket of the ground truth size.
+  virtual void ProcessTrackOutput(
+      const size_t frame_num, const cv::Mat& image_curr, const bool has_annotation,
+      const BoundingBox& bbox_gt, const BoundingBox& bbox_estimate,
+      const int pause_val);
+
+  virtual void PostProcessVideo(size_t video_num);
+
+  // Print fps, mean IOU and success rate of every bucket.
+  virtual void PostProcessAll();
+
+  // Same over all buckets
+  void GetTotals(int* frames, double* fps, double* mean_iou, double* success) const;
+
+private:
+  // Index into bucket_upper_ of a target with this ground truth box
+  int GetBucket(const BoundingBox& bbox_gt) const;
+
+  // Wall clock, background fine tuning is not counted.
+  HighResTimer hrt_;
+
+  // Upper bound of every bucket on sqrt of the ground truth area, in pixels
+  std::vector<double> bucket_upper_;
+
+  // Per bucket: frames, tracking time, sum of IOU, frames with IOU above 0.5
+  std::vector<int> bucket_frames_;
+  std::vector<double> bucket_ms_;
+  std::vector<double> bucket_iou_;
+  std::vector<int> bucket_success_;
+};
+
+// Network and tracker parameters of a VOT benchmark, every pass builds its network and tracker anew from them
+struct BenchmarkSetup {
+  std::string model_file;
+  std::string trained_file;
+  std::string solver_file;
+  int gpu_id;
+  double lambda_shift;
+  double lambda_scale;
+  double min_scale;
+  double max_scale;
+};
+
+// TrackerSizeBenchmark::GetTotals of one pass
+struct BenchmarkTotals {
+  int frames;
+  double fps;
+  double mean_iou;
+  double success;
+};
+
+// Track all videos with a TrackerSizeBenchmark, from freshly loaded weights and with the fixed seeds of the example
+// generator, the tracker and Caffe's dropout, so that passes only differ in what configure sets on the network and
+// tracker before tracking; inspect (may be empty) reads the statistics of the pass before they go
+BenchmarkTotals RunBenchmarkPass(const std::vector<Video>& videos, const BenchmarkSetup& setup,
+                                 const std::string& description,
+                                 const std::function<void(RegressorTrain*, TrackerGMD*)>& configure,
+                                 const std::function<void(const RegressorTrain&, const TrackerGMD&)>& inspect);
 
 #endif // TRACKER_MANAGER_H
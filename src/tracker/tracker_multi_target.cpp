@@ -0,0 +1,145 @@
+#include "tracker_multi_target.h"
+
+#include <algorithm>
+#include <cmath>
+#include <time.h>
+
+// pooled and alone scoring run the same layers on the same rows, only the batching of the GEMMs differs
+const float kPooledTolerance = 1e-4;
+
+TrackerMultiTarget::TrackerMultiTarget(const bool show_tracking, const double lambda_shift, const double lambda_scale,
+                                       const double min_scale, const double max_scale,
+                                       RegressorTrainBase* regressor_train) :
+  show_tracking_(show_tracking),
+  lambda_shift_(lambda_shift),
+  lambda_scale_(lambda_scale),
+  min_scale_(min_scale),
+  max_scale_(max_scale),
+  regressor_train_(regressor_train),
+  check_pooled_(false),
+  pooled_max_difference_(0)
+{
+#ifdef REPRODUCIBLE_RNG
+  seed_ = SEED_RNG_TRACKER;
+#else
+  seed_ = time(NULL);
+#endif
+}
+
+void TrackerMultiTarget::Init(const cv::Mat& image_curr, const std::vector<BoundingBox>& bboxes_gt,
+                              RegressorBase* regressor) {
+  const int num_targets = bboxes_gt.size();
+
+  // the trackers hold their generator, build both anew for the targets of this video; the regressor must not keep
+  // the frame arena of a tracker about to go
+  regressor->SetFrameArena(NULL);
+  example_generators_.clear();
+  trackers_.clear();
+  for (int k = 0; k < num_targets; k++) {
+    example_generators_.push_back(boost::shared_ptr<ExampleGenerator>(
+        new ExampleGenerator(lambda_shift_, lambda_scale_, min_scale_, max_scale_)));
+    trackers_.push_back(boost::shared_ptr<TrackerGMD>(
+        new TrackerGMD(show_tracking_, example_generators_[k].get(), regressor_train_)));
+    trackers_[k]->set_own_size_hint(false);
+    trackers_[k]->Seed(seed_ + k);
+    example_generators_[k]->Seed(seed_ + k);
+  }
+
+  // the head is pristine here, after the construction of the network or Reset, every target starts from it
+  if (!heads_ || heads_->num_targets() != num_targets) {
+    heads_.reset(new HeadBank(regressor, regressor_train_, num_targets));
+  }
+
+  bboxes_prev_ = bboxes_gt;
+  SetSharedSizeHint(regressor);
+  const int64_t frame_id = RegressorBase::NewFrameId();
+  for (int k = 0; k < num_targets; k++) {
+    heads_->Bind(k);
+    trackers_[k]->set_frame_id(frame_id);
+    trackers_[k]->Init(image_curr, bboxes_gt[k], regressor);
+  }
+}
+
+void TrackerMultiTarget::Track(const cv::Mat& image_curr, RegressorBase* regressor,
+                               std::vector<BoundingBox>* bbox_estimates) {
+  const int num_targets = trackers_.size();
+  bbox_estimates->resize(num_targets);
+
+  // one input scale and one frame id for all targets, so that they share one backbone pass
+  SetSharedSizeHint(regressor);
+  const int64_t frame_id = RegressorBase::NewFrameId();
+  targets_.resize(num_targets);
+  candidates_.resize(num_targets);
+  for (int k = 0; k < num_targets; k++) {
+    trackers_[k]->set_frame_id(frame_id);
+    trackers_[k]->PrepareTrack(image_curr, regressor);
+    targets_[k] = trackers_[k]->GetTargetTight();
+    candidates_[k] = &trackers_[k]->GetFirstRoundCandidates();
+  }
+
+  // the candidates of all targets through one ROI pooling, then each target's head on its own rows
+  regressor->PoolCandidates(image_curr, targets_, candidates_);
+  for (int k = 0; k < num_targets; k++) {
+    heads_->Bind(k);
+    trackers_[k]->ScorePooled(k, regressor, &(*bbox_estimates)[k]);
+  }
+  if (check_pooled_) {
+    CheckPooled(image_curr, regressor);
+  }
+
+  // the further rounds of an adaptive budget run the network again, only once every target read its pooled rows
+  for (int k = 0; k < num_targets; k++) {
+    heads_->Bind(k);
+    trackers_[k]->FinishTrack(image_curr, regressor, &(*bbox_estimates)[k]);
+  }
+}
+
+void TrackerMultiTarget::UpdateState(const cv::Mat& image_curr, std::vector<BoundingBox>& bbox_estimates,
+                                     RegressorBase* regressor, bool is_last_frame) {
+  // the training samples of every target are pooled from the same cached conv map, fine tuning only changes the
+  // bound head
+  for (int k = 0; k < trackers_.size(); k++) {
+    heads_->Bind(k);
+    trackers_[k]->UpdateState(image_curr, bbox_estimates[k], regressor, is_last_frame);
+  }
+  bboxes_prev_ = bbox_estimates;
+}
+
+void TrackerMultiTarget::Reset(RegressorBase* regressor) {
+  // each Reset restores the weights and momentum in place, i.e. the bound head
+  for (int k = 0; k < trackers_.size(); k++) {
+    heads_->Bind(k);
+    trackers_[k]->Reset(regressor);
+  }
+  bboxes_prev_.clear();
+}
+
+void TrackerMultiTarget::CheckPooled(const cv::Mat& image_curr, RegressorBase* regressor) {
+  for (int k = 0; k < trackers_.size(); k++) {
+    heads_->Bind(k);
+    trackers_[k]->ScoreAlone(image_curr, regressor, &alone_probabilities_);
+    const std::vector<float> &pooled_probabilities = trackers_[k]->GetCandidateProbabilities();
+    CHECK_EQ(alone_probabilities_.size(), pooled_probabilities.size()) << "target " << k;
+    float max_difference = 0;
+    for (int i = 0; i < alone_probabilities_.size(); i++) {
+      max_difference = std::max(max_difference, std::abs(alone_probabilities_[i] - pooled_probabilities[i]));
+    }
+    CHECK_LE(max_difference, kPooledTolerance) << "target " << k << " of " << trackers_.size()
+                                               << " scores differently pooled and alone";
+    pooled_max_difference_ = std::max(pooled_max_difference_, max_difference);
+  }
+}
+
+void TrackerMultiTarget::SetSharedSizeHint(RegressorBase* regressor) {
+  if (bboxes_prev_.empty()) {
+    return;
+  }
+
+  int smallest = 0;
+  for (int k = 1; k < bboxes_prev_.size(); k++) {
+    if (bboxes_prev_[k].compute_area() < bboxes_prev_[smallest].compute_area()) {
+      smallest = k;
+    }
+  }
+  regressor->SetTargetSizeHint(bboxes_prev_[smallest]);
+}
@@ -0,0 +1,90 @@
+#ifndef TRACKER_MULTI_TARGET_H
+#define TRACKER_MULTI_TARGET_H
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+
+#include "helper/bounding_box.h"
+#include "network/regressor_base.h"
+#include "network/regressor_train_base.h"
+#include "train/example_generator.h"
+#include "tracker/tracker_gmd.h"
+#include "tracker/head_bank.h"
+
+// Tracks several targets in the same video with one network. Every target keeps the state of a TrackerGMD (motion
+// model, fine tune bags, example generator) and its own fc head in a HeadBank, but the frame goes through the
+// backbone once and the first round candidates of all targets through one ROI pooling; each target then only adds
+// its head over its own rows of pool6_c.
+//
+// The shared pass needs one input scale for all targets, which SetSharedSizeHint takes from the smallest target:
+// with ADAPTIVE_INPUT_SCALE the frame is scaled as finely as that target needs, so a small target next to large
+// ones raises the backbone cost of the frame above what tracking the large ones alone would take.
+class TrackerMultiTarget
+{
+public:
+  // regressor_train is the training side of the regressor passed to the other calls; the example generators of
+  // the targets are built with these parameters
+  TrackerMultiTarget(const bool show_tracking, const double lambda_shift, const double lambda_scale,
+                     const double min_scale, const double max_scale, RegressorTrainBase* regressor_train);
+
+  // Start tracking the targets at bboxes_gt in the first frame, fine tunes one head per target
+  void Init(const cv::Mat& image_curr, const std::vector<BoundingBox>& bboxes_gt, RegressorBase* regressor);
+
+  // Estimate the location of every target in the current image
+  void Track(const cv::Mat& image_curr, RegressorBase* regressor, std::vector<BoundingBox>* bbox_estimates);
+
+  // After tracking this frame, update the state of every target, fine tuning its head when due
+  void UpdateState(const cv::Mat& image_curr, std::vector<BoundingBox>& bbox_estimates, RegressorBase* regressor,
+                   bool is_last_frame);
+
+  // Restore every head and clear all per target storage, for the next video
+  void Reset(RegressorBase* regressor);
+
+  // Seeds of the targets' random draws are seed, seed + 1, ..., applied by Init
+  void Seed(const uint64_t seed) { seed_ = seed; }
+
+  int num_targets() const { return trackers_.size(); }
+
+  // With check_pooled, Track also scores every target's first round on its own (TrackerGMD::ScoreAlone) and fails
+  // when a pooled probability is more than 1e-4 away from it; costs a second head pass per target
+  void set_check_pooled(const bool check_pooled) { check_pooled_ = check_pooled; }
+
+  // Largest difference between pooled and alone probabilities seen by the check so far
+  float pooled_max_difference() const { return pooled_max_difference_; }
+
+private:
+  // Score every target alone and compare with the pooled probabilities, between ScorePooled and FinishTrack
+  void CheckPooled(const cv::Mat& image_curr, RegressorBase* regressor);
+
+  // Size hint shared by all targets, so that they are scored at one input scale: the smallest target, which
+  // needs the finest scale, see the class comment for its cost
+  void SetSharedSizeHint(RegressorBase* regressor);
+
+  bool show_tracking_;
+  double lambda_shift_;
+  double lambda_scale_;
+  double min_scale_;
+  double max_scale_;
+  RegressorTrainBase* regressor_train_;
+  uint64_t seed_;
+
+  // per target, trackers_[k] draws its samples from example_generators_[k]
+  std::vector<boost::shared_ptr<ExampleGenerator> > example_generators_;
+  std::vector<boost::shared_ptr<TrackerGMD> > trackers_;
+
+  // head weights and momentum of every target
+  boost::shared_ptr<HeadBank> heads_;
+
+  // last estimate of every target
+  std::vector<BoundingBox> bboxes_prev_;
+
+  // target crops and first round candidates of every target handed to RegressorBase::PoolCandidates
+  std::vector<cv::Mat> targets_;
+  std::vector<const std::vector<BoundingBox>* > candidates_;
+
+  bool check_pooled_;
+  float pooled_max_difference_;
+  std::vector<float> alone_probabilities_;
+};
+
+#endif // TRACKER_MULTI_TARGET_H
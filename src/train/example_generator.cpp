@@ -10,7 +10,7 @@
 #include "helper/image_proc.h"
 #include <assert.h>
 #include <algorithm> // for shuffling
-#include <random>
+#include <cfloat>
 
 using std::string;
 
@@ -20,9 +20,6 @@ using std::string;
 // Choose whether to shift boxes using the motion model or using a uniform distribution.
 const bool shift_motion_model = true;
 
-std::mt19937 ExampleGenerator::engine_(time(NULL)); // static attributes declaration
-// std::mt19937 ExampleGenerator::engine_(SEED_ENGINE); // static attributes declaration
-
 ExampleGenerator::ExampleGenerator(const double lambda_shift,
                                    const double lambda_scale,
                                    const double min_scale,
@@ -30,13 +27,17 @@ ExampleGenerator::ExampleGenerator(const double lambda_shift,
   : lambda_shift_(lambda_shift),
     lambda_scale_(lambda_scale),
     min_scale_(min_scale),
-    max_scale_(max_scale)
+    max_scale_(max_scale),
+    reuse_crops_(false),
+    sampler_(NULL)
 {
 
-    gsl_rng_env_setup();
-    rng_ = gsl_rng_alloc(gsl_rng_mt19937);
-    gsl_rng_set(rng_, time(NULL));
-    // gsl_rng_set(rng_, SEED_RNG_EXAMPLE_GENERATOR); // to reproduce
+#ifdef REPRODUCIBLE_RNG
+    Seed(SEED_RNG_EXAMPLE_GENERATOR);
+#else
+    Seed(time(NULL));
+#endif
+    sampler_ = CandidateSampler(&rng_);
 }
 
 void ExampleGenerator::Reset(const BoundingBox& bbox_prev,
@@ -44,7 +45,7 @@ void ExampleGenerator::Reset(const BoundingBox& bbox_prev,
                              const cv::Mat& image_prev,
                              const cv::Mat& image_curr) {
   // Get padded target from previous image to feed the network.
-  CropPadImage(bbox_prev, image_prev, &target_pad_);
+  CropPadImage(bbox_prev, image_prev, crop_buffer(&target_crop_), &target_pad_);
 
   // bbox_prev might be out of boundary
   BoundingBox bbox_prev_within(bbox_prev);
@@ -81,95 +82,6 @@ void ExampleGenerator::MakeTrainingExamples(const int num_examples,
 }
 
 // Randomly generates a new moved BoundingBox from bbox as candidate
-BoundingBox ExampleGenerator::GenerateOneRandomCandidate(BoundingBox &bbox, gsl_rng* rng, int W, int H,
-                                                         const string method, const double trans_range, const double scale_range, 
-                                                         const double sd_x, const double sd_y, const double sd_scale) {
-  double w = bbox.x2_ - bbox.x1_;
-  double h = bbox.y2_ - bbox.y1_;
-  
-  double centre_x = bbox.x1_ + w/2.0;
-  double centre_y = bbox.y1_ + h/2.0;
-  BoundingBox moved_bbox;
-  if (method.compare("uniform") == 0) {
-
-    double dx = (gsl_rng_uniform(rng) * 2.0 - 1.0) * w * trans_range;
-    double dy = (gsl_rng_uniform(rng) * 2.0 - 1.0) * h * trans_range;
-
-    double moved_centre_x = centre_x + dx;
-    double moved_centre_y = centre_y + dy;
-
-    double ds = pow(SCALE_FACTOR, (gsl_rng_uniform(rng) * 2.0 - 1.0) * scale_range);
-    double moved_w = w * ds;
-    double moved_h = h * ds;
-
-    moved_bbox.x1_ = moved_centre_x - moved_w /2.0;
-    moved_bbox.y1_ = moved_centre_y - moved_h /2.0;
-    moved_bbox.x2_ = moved_centre_x + moved_w/2.0;
-    moved_bbox.y2_ = moved_centre_y + moved_h/2.0;
-  }
-  else if (method.compare("uniform_ap") == 0) {
-    double dx = (gsl_rng_uniform(rng) * 2.0 - 1.0) * w * trans_range;
-    double dy = (gsl_rng_uniform(rng) * 2.0 - 1.0) * h * trans_range;
-
-    double moved_centre_x = centre_x + dx;
-    double moved_centre_y = centre_y + dy;
-
-    double ds_w = pow(SCALE_FACTOR, (gsl_rng_uniform(rng) * 2.0 - 1.0) * scale_range);
-    double ds_h = pow(SCALE_FACTOR, (gsl_rng_uniform(rng) * 2.0 - 1.0) * scale_range);
-    double moved_w = w * ds_w;
-    double moved_h = h * ds_h;
-
-    moved_bbox.x1_ = moved_centre_x - moved_w /2.0;
-    moved_bbox.y1_ = moved_centre_y - moved_h /2.0;
-    moved_bbox.x2_ = moved_centre_x + moved_w/2.0;
-    moved_bbox.y2_ = moved_centre_y + moved_h/2.0;
-  }
-  else if (method.compare("gaussian") == 0) {
-
-    double r = round((w+h)/2.0);
-
-    double moved_centre_x = centre_x + sd_x * r * std::max(-KEEP_SD, std::min(KEEP_SD, gsl_ran_gaussian(rng, 1.0))); // keep the range in [-KEEP_SD* SD, KEEP_SD*SD]
-    double moved_centre_y = centre_y + sd_y * r * std::max(-KEEP_SD, std::min(KEEP_SD, gsl_ran_gaussian(rng, 1.0))); 
-
-    double ds = pow(MOTION_SCALE_FACTOR, sd_scale * std::max(-KEEP_SD, std::min(KEEP_SD, gsl_ran_gaussian(rng, 1.0))) );
-    double moved_w = w * ds;
-    double moved_h = h * ds;
-
-    moved_bbox.x1_ = moved_centre_x - moved_w /2.0;
-    moved_bbox.y1_ = moved_centre_y - moved_h /2.0;
-    moved_bbox.x2_ = moved_centre_x + moved_w/2.0;
-    moved_bbox.y2_ = moved_centre_y + moved_h/2.0;
-  }
-  else if (method.compare("whole") == 0) {
-    // randomly choose from the entire frame
-
-    double min_x = w/2;
-    double min_y = h/2;
-    double max_x = W - 1 - w/2; // image_w - 1 to be safe, in case of ceiling later
-    double max_y = H - 1 - h/2;
-
-    double new_centre_x = gsl_rng_uniform(rng) * (max_x - min_x) + min_x;
-    double new_centre_y = gsl_rng_uniform(rng) * (max_y - min_y) + min_y;
-
-    double ds = pow(SCALE_FACTOR, (gsl_rng_uniform(rng) * 2.0 - 1.0) * scale_range);
-    double new_w = w * ds;
-    double new_h = h * ds;
-
-    moved_bbox.x1_ = new_centre_x - new_w /2.0;
-    moved_bbox.y1_ = new_centre_y - new_h /2.0;
-    moved_bbox.x2_ = new_centre_x + new_w /2.0;
-    moved_bbox.y2_ = new_centre_y + new_h /2.0;
-
-  }
-  else {
-    // exit on Unknown sampling method
-    cout << "Unknown sampling method! :" << method << endl;
-    exit(-1);
-  }
-  
-  return moved_bbox;
-}
-
 void ExampleGenerator::MakeCandidatesAndLabels(vector<Mat> *candidates, vector<double> *labels, 
                                                const int num_pos,
                                                const int num_neg) {
@@ -223,33 +135,22 @@ void ExampleGenerator::MakeCandidatesAndLabelsBBox(vector<BoundingBox> *candidat
   BoundingBox gt_bbox_cropped(bbox_curr_gt_); // copy
   gt_bbox_cropped.crop_against_image(image_curr_); // crop if the gt is out of boundary
   
-  // generate positive examples
-  while (label_candidates.size() < num_pos) {
-    BoundingBox this_box = ExampleGenerator::GenerateOneRandomCandidate(gt_bbox_cropped, rng_, image_curr_.size().width, image_curr_.size().height);
-    if (gt_bbox_cropped.compute_IOU(this_box) >= POS_IOU_TH) {
-      // enqueue this bbox and label
-      // this_box.crop_against_image(image_curr_); // make sure within image, note here, only crop and check boundary after checking IOU as sometimes the gt bbox could be out of boundary
-      if (this_box.valid_bbox_against_width_height(image_curr_.size().width, image_curr_.size().height)) { // make sure valid
-        label_candidates.push_back(std::make_pair(POS_LABEL, this_box));
-      }
-    }
+  // generate positive examples, only boundary checked, not cropped, as sometimes the gt bbox could be out of boundary
+  vector<BoundingBox> pos_bboxes;
+  DrawCandidatesInIOURange(gt_bbox_cropped, num_pos, POS_IOU_TH, FLT_MAX, &pos_bboxes);
+  for (int i = 0; i < pos_bboxes.size(); i++) {
+    label_candidates.push_back(std::make_pair(POS_LABEL, pos_bboxes[i]));
   }
 
-
   // generate negative examples
-  while (label_candidates.size() < num_pos + num_neg) {
-    BoundingBox this_box = ExampleGenerator::GenerateOneRandomCandidate(gt_bbox_cropped, rng_, image_curr_.size().width, image_curr_.size().height, "uniform",  NEG_TRANS_RANGE, NEG_SCALE_RANGE);
-    if (gt_bbox_cropped.compute_IOU(this_box) <= NEG_IOU_TH) {
-      // enqueue this bbox and label
-      // this_box.crop_against_image(image_curr_); // make sure within image
-      if (this_box.valid_bbox_against_width_height(image_curr_.size().width, image_curr_.size().height)) { // make sure valid
-        label_candidates.push_back(std::make_pair(NEG_LABEL, this_box));
-      }
-    }
+  vector<BoundingBox> neg_bboxes;
+  DrawCandidatesInIOURange(gt_bbox_cropped, num_neg, -FLT_MAX, NEG_IOU_TH, &neg_bboxes, SAMPLE_UNIFORM, NEG_TRANS_RANGE, NEG_SCALE_RANGE);
+  for (int i = 0; i < neg_bboxes.size(); i++) {
+    label_candidates.push_back(std::make_pair(NEG_LABEL, neg_bboxes[i]));
   }
   
   // random shuffle
-  std::shuffle(std::begin(label_candidates), std::end(label_candidates), engine_);
+  std::shuffle(std::begin(label_candidates), std::end(label_candidates), rng_);
 
   for (int i = 0; i< label_candidates.size(); i++) {
     candidate_bboxes->push_back(label_candidates[i].second);
@@ -259,61 +160,58 @@ void ExampleGenerator::MakeCandidatesAndLabelsBBox(vector<BoundingBox> *candidat
   assert (candidate_bboxes->size() == labels->size());
 }
 
+void ExampleGenerator::DrawCandidatesInIOURange(BoundingBox &bbox, const int num, const double min_iou, const double max_iou,
+                                                vector<BoundingBox> *candidates,
+                                                const SampleMethod method, const double trans_range, const double scale_range,
+                                                const double sd_x, const double sd_y, const double sd_scale) {
+  accepted_.clear();
+  sampler_.SampleAccepted(bbox, num, image_curr_.size().width, image_curr_.size().height, method, 
+                          SampleParams(trans_range, scale_range, sd_x, sd_y, sd_scale), min_iou, max_iou, &accepted_);
+  accepted_.AppendTo(candidates);
+}
+
 void ExampleGenerator::MakeCandidatesPos(vector<BoundingBox> *candidates, const int num,
-                                const string method, const double trans_range, const double scale_range,
+                                const SampleMethod method, const double trans_range, const double scale_range,
                                 const double sd_x, const double sd_y, const double sd_scale, const double pos_iou_th
                                 ) {
 #ifdef VISUALIZE_FINETUNE_SAMPLES
   Mat canvas = image_curr_.clone();
+  const int first = candidates->size();
 #endif
-  int count = 0;
-  while (count < num) {
-    BoundingBox this_box = ExampleGenerator::GenerateOneRandomCandidate(bbox_curr_gt_, rng_, image_curr_.size().width, image_curr_.size().height, 
-                                                                        method, trans_range, scale_range, 
-                                                                        sd_x, sd_y, sd_scale);
-    // no need to crop as the bbox_curr_gt_ is the current estimate, which will never go out of boundary
-    if (this_box.valid_bbox_against_width_height(image_curr_.size().width, image_curr_.size().height) && bbox_curr_gt_.compute_IOU(this_box) >= pos_iou_th) {
-      // enqueue
-      candidates->push_back(this_box);
-      count ++;
+  // no need to crop as the bbox_curr_gt_ is the current estimate, which will never go out of boundary
+  DrawCandidatesInIOURange(bbox_curr_gt_, num, pos_iou_th, FLT_MAX, candidates, 
+                           method, trans_range, scale_range, sd_x, sd_y, sd_scale);
 #ifdef VISUALIZE_FINETUNE_SAMPLES
-      this_box.Draw(255, 0, 0, &canvas);
-#endif
-    }
+  for (int i = first; i < candidates->size(); i++) {
+    (*candidates)[i].Draw(255, 0, 0, &canvas);
   }
+#endif
 
 #ifdef VISUALIZE_FINETUNE_SAMPLES
-  string window_name = "pos_samples_" + method + "_" +std::to_string(sd_x) + "_" + std::to_string(sd_scale);
+  string window_name = "pos_samples_" + std::to_string(method) + "_" +std::to_string(sd_x) + "_" + std::to_string(sd_scale);
   cv::imshow(window_name, canvas);
   cv::waitKey(10);
 #endif     
 }
 
 void ExampleGenerator::MakeCandidatesNeg(vector<BoundingBox> *candidates, const int num,
-                                         const string method, const double trans_range, const double scale_range,
+                                         const SampleMethod method, const double trans_range, const double scale_range,
                                          const double sd_x, const double sd_y, const double sd_scale) {
-  int count = 0;
 #ifdef VISUALIZE_FINETUNE_SAMPLES
   Mat canvas = image_curr_.clone();
+  const int first = candidates->size();
 #endif
-  while (count < num) {
-    BoundingBox this_box = ExampleGenerator::GenerateOneRandomCandidate(bbox_curr_gt_, rng_, image_curr_.size().width, image_curr_.size().height, 
-                                                                        method, trans_range, scale_range,
-                                                                        sd_x, sd_y, sd_scale);
-    // no need to crop as the bbox_curr_gt_ is the current estimate, which will never go out of boundary
-    if (this_box.valid_bbox_against_width_height(image_curr_.size().width, image_curr_.size().height) && bbox_curr_gt_.compute_IOU(this_box) <= NEG_IOU_TH) {
-      // enqueue
-      candidates->push_back(this_box);
-      count ++;
-
+  // no need to crop as the bbox_curr_gt_ is the current estimate, which will never go out of boundary
+  DrawCandidatesInIOURange(bbox_curr_gt_, num, -FLT_MAX, NEG_IOU_TH, candidates, 
+                           method, trans_range, scale_range, sd_x, sd_y, sd_scale);
 #ifdef VISUALIZE_FINETUNE_SAMPLES
-      this_box.Draw(0, 0, 255, &canvas);
-#endif
-    }
+  for (int i = first; i < candidates->size(); i++) {
+    (*candidates)[i].Draw(0, 0, 255, &canvas);
   }
+#endif
 
 #ifdef VISUALIZE_FINETUNE_SAMPLES
-  string window_name = "neg_samples_" + method + "_" +std::to_string(trans_range) + "_" + std::to_string(scale_range);
+  string window_name = "neg_samples_" + std::to_string(method) + "_" +std::to_string(trans_range) + "_" + std::to_string(scale_range);
   cv::imshow(window_name, canvas);
   cv::waitKey(10);
 #endif                     
@@ -333,7 +231,7 @@ void ExampleGenerator::MakeTrueExample(cv::Mat* curr_search_region,
   // to define a search region within the current image.
   BoundingBox curr_search_location;
   double edge_spacing_x, edge_spacing_y;
-  CropPadImage(curr_prior_tight, image_curr_, curr_search_region, &curr_search_location, &edge_spacing_x, &edge_spacing_y);
+  CropPadImage(curr_prior_tight, image_curr_, crop_buffer(&search_crop_), curr_search_region, &curr_search_location, &edge_spacing_x, &edge_spacing_y);
 
   // Recenter the ground-truth bbox relative to the search location.
   BoundingBox bbox_gt_recentered;
@@ -357,7 +255,7 @@ void ExampleGenerator::MakeTrueExampleTight(cv::Mat* curr_search_region, cv::Mat
   // to define a search region within the current image.
   BoundingBox curr_search_location;
   double edge_spacing_x, edge_spacing_y;
-  CropPadImage(curr_prior_tight, image_curr_, curr_search_region, &curr_search_location, &edge_spacing_x, &edge_spacing_y);
+  CropPadImage(curr_prior_tight, image_curr_, crop_buffer(&search_crop_), curr_search_region, &curr_search_location, &edge_spacing_x, &edge_spacing_y);
 
   // Recenter the ground-truth bbox relative to the search location.
   BoundingBox bbox_gt_recentered;
@@ -415,13 +313,13 @@ void ExampleGenerator::MakeTrainingExampleBBShift(const bool visualize_example,
   BoundingBox bbox_curr_shift;
   bbox_curr_gt_.Shift(image_curr_, bbparams.lambda_scale, bbparams.lambda_shift,
                       bbparams.min_scale, bbparams.max_scale,
-                      shift_motion_model,
+                      shift_motion_model, &rng_,
                       &bbox_curr_shift);
 
   // Crop the image based at the new location (after applying translation and scale changes).
   double edge_spacing_x, edge_spacing_y;
   BoundingBox rand_search_location;
-  CropPadImage(bbox_curr_shift, image_curr_, rand_search_region, &rand_search_location,
+  CropPadImage(bbox_curr_shift, image_curr_, crop_buffer(&search_crop_), rand_search_region, &rand_search_location,
                &edge_spacing_x, &edge_spacing_y);
 
   // Find the shifted ground-truth bounding box location relative to the image crop.
@@ -6,6 +6,10 @@
 #include <opencv2/highgui/highgui.hpp>
 
 #include "helper/bounding_box.h"
+#include "helper/candidate_set.h"
+#include "helper/candidate_sampler.h"
+#include "helper/image_proc.h"
+#include "helper/rng_stream.h"
 #include "loader/loader_imagenet_det.h"
 #include "loader/video.h"
 #include "helper/Common.h"
@@ -14,8 +18,6 @@
 
 #include <stdlib.h>     /* srand, rand */
 #include <time.h>       /* time */
-#include <gsl/gsl_rng.h> 
-#include <gsl/gsl_randist.h> /* GAUSSIAN*/
 
 struct BBParams {
   double lambda_shift;
@@ -58,12 +60,6 @@ public:
                             std::vector<cv::Mat>* targets,
                             std::vector<BoundingBox>* bboxes_gt_scaled);
 
-  // Helper function to generate one moved box, non-gaussian version
-  // trans_range, scale_range are defaults for uniform sampling of uniform samples
-  static BoundingBox GenerateOneRandomCandidate(BoundingBox &bbox, gsl_rng* rng, int W, int H, 
-                                                const string method = "uniform", const double trans_range = POS_TRANS_RANGE, const double scale_range = POS_SCALE_RANGE, 
-                                                const double sd_x = SD_X, const double sd_y = SD_Y, const double sd_scale = SD_SCALE);
-
   // Make candidates given one frame
   // candidates: 200 neg and 50 pos candidates 
   // labels: vector of scalar 1 means pos and 0 means neg 
@@ -78,17 +74,31 @@ public:
                                    const int num_neg = NEG_CANDIDATES);
   
   void MakeCandidatesPos(vector<BoundingBox> *candidates, const int num = POS_CANDIDATES,
-                                  const string method = "gaussian", const double trans_range = POS_TRANS_RANGE, const double scale_range = POS_SCALE_RANGE,
+                                  const SampleMethod method = SAMPLE_GAUSSIAN, const double trans_range = POS_TRANS_RANGE, const double scale_range = POS_SCALE_RANGE,
                                   const double sd_x = SD_X, const double sd_y = SD_Y, const double sd_scale = SD_SCALE, const double pos_iou_th = POS_IOU_TH );
 
   void MakeCandidatesNeg(vector<BoundingBox> *candidates, const int num = NEG_CANDIDATES,
-                                  const string method = "uniform", const double trans_range = 2 * SD_X, const double scale_range = POS_SCALE_RANGE,
+                                  const SampleMethod method = SAMPLE_UNIFORM, const double trans_range = 2 * SD_X, const double scale_range = POS_SCALE_RANGE,
                                   const double sd_x = SD_X, const double sd_y = SD_Y, const double sd_scale = SD_SCALE);
 
+  // Draw candidates around bbox until num of them are valid in image_curr_ and have an IOU with bbox
+  // in [min_iou, max_iou], appended to candidates in the order drawn.
+  void DrawCandidatesInIOURange(BoundingBox &bbox, const int num, const double min_iou, const double max_iou,
+                                vector<BoundingBox> *candidates,
+                                const SampleMethod method = SAMPLE_UNIFORM, const double trans_range = POS_TRANS_RANGE, const double scale_range = POS_SCALE_RANGE,
+                                const double sd_x = SD_X, const double sd_y = SD_Y, const double sd_scale = SD_SCALE);
+
   void set_indices(const int video_index, const int frame_index) {
     video_index_ = video_index; frame_index_ = frame_index;
   }
 
+  // With reuse_crops, target and search region crops are views into the frames or go to buffers kept by this
+  // generator, overwritten by the next Reset / example. Only for callers that do not keep crops across calls.
+  void set_reuse_crops(const bool reuse_crops) { reuse_crops_ = reuse_crops; }
+
+  // Restart the random draws of this generator, two generators with the same seed make the same examples
+  void Seed(const uint64_t seed) { rng_.Seed(seed, RNG_STREAM_EXAMPLE_GENERATOR); }
+
 private:
   void MakeTrainingExampleBBShift(const bool visualize_example,
                                   const BBParams& bbparams,
@@ -102,6 +112,9 @@ private:
 
   void get_default_bb_params(BBParams* default_params) const;
 
+  // buffer when crops are reused, NULL for crops of their own
+  CropBuffer* crop_buffer(CropBuffer* buffer) const { return reuse_crops_ ? buffer : NULL; }
+
   // To generate synethic examples, shift the bounding box by an exponential with the given lambda parameter.
   double lambda_shift_;
 
@@ -124,15 +137,25 @@ private:
   // tight previous target in previous image
   cv::Mat target_tight_;
 
+  // storage of target_pad_ and of the search regions, used when reuse_crops_
+  bool reuse_crops_;
+  CropBuffer target_crop_;
+  mutable CropBuffer search_crop_;
+
   // Video and frame index from which the current example was generated.
   // These values are only used when saving images to a file, to assign them
   // a unique identifier.
   int video_index_;
   int frame_index_;
 
-  gsl_rng* rng_;
+  // every random draw of this generator comes from rng_, mutable as drawing does not change the examples set up
+  mutable RngStream rng_;
+
+  // batched candidate drawing from rng_
+  CandidateSampler sampler_;
 
-  static std::mt19937 engine_;
+  // scratch for DrawCandidatesInIOURange
+  CandidateSet accepted_;
 };
 
 #endif // EXAMPLE_GENERATOR_H
@@ -7,6 +7,9 @@
 // Number of images in each batch, just do 1 first to compare with original training with three streams, TODO: use 8 as in MDNet
 const int kBatchSize = 50;
 
+// Number of frames stacked into one forward/backward and solver step, 8 as in MDNet
+const int kFramesPerStep = 8;
+
 // Number of examples that we generate (by applying synthetic transformations)
 // to each image.
 const int kGeneratedExamplesPerImage = 0;
@@ -66,7 +69,10 @@ void TrackerTrainerMultiDomain::ProcessBatch() {
                                bboxes_gt_scaled_batch_,
                                candidates_batch_,
                                labels_batch_,
-                               current_k_);
+                               current_k_,
+                               INNER_BATCH_SIZE,
+                               -1,
+                               kFramesPerStep);
 }
 
 
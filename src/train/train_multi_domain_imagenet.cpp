@@ -26,10 +26,11 @@ const int NUM_CYCLES = 3200;
 
 namespace {
 
-// Train on all annotated frames in the set of videos.
-void train_video(const std::vector<VideoImageNet>& videos, TrackerTrainerMultiDomain* tracker_trainer_multi_domain) {
+// Train on all annotated frames in the set of videos, picking videos, frames and objects with rng.
+void train_video(const std::vector<VideoImageNet>& videos, TrackerTrainerMultiDomain* tracker_trainer_multi_domain,
+                 RngStream* rng) {
   // Get a random video.
-  const int video_num = rand() % videos.size();
+  const int video_num = rng->UniformInt(videos.size());
   const VideoImageNet& video = videos[video_num];
   const vector<string> & frames = video.all_frames;
 
@@ -40,16 +41,16 @@ void train_video(const std::vector<VideoImageNet>& videos, TrackerTrainerMultiDo
   }
 
   // Choose a random annotation.
-  int frame_index = rand() % (frames.size() - 1);
+  int frame_index = rng->UniformInt(frames.size() - 1);
   vector<int> common_trackids;
   video.CheckTwoFramesCommonTrackObject(frame_index, frame_index + 1, common_trackids);
   while (common_trackids.size() == 0) {
-    frame_index = rand() % (frames.size() - 1); // sample another frame
+    frame_index = rng->UniformInt(frames.size() - 1); // sample another frame
     video.CheckTwoFramesCommonTrackObject(frame_index, frame_index + 1, common_trackids);
   }
   
   // Choose a random track object
-  int track_object_id = common_trackids[rand() % (common_trackids.size())];
+  int track_object_id = common_trackids[rng->UniformInt(common_trackids.size())];
   
   // Load the frame's annotation.
   int frame_num_prev;
@@ -66,18 +67,18 @@ void train_video(const std::vector<VideoImageNet>& videos, TrackerTrainerMultiDo
   // make sure both bboxes are valid before process
   while((!prev_success) || (!curr_success) || (!(bbox_prev.valid_bbox() && bbox_curr.valid_bbox()))) {
     // repick the frame_index
-    frame_index = rand() % (frames.size() - 1);
+    frame_index = rng->UniformInt(frames.size() - 1);
     
     // recheck common objects
     common_trackids.clear();
     video.CheckTwoFramesCommonTrackObject(frame_index, frame_index + 1, common_trackids);
     while (common_trackids.size() == 0) {
-        frame_index = rand() % (frames.size() - 1); // sample another frame
+        frame_index = rng->UniformInt(frames.size() - 1); // sample another frame
         video.CheckTwoFramesCommonTrackObject(frame_index, frame_index + 1, common_trackids);
     }
     
     // Choose a random track object
-    track_object_id = common_trackids[rand() % (common_trackids.size())];
+    track_object_id = common_trackids[rng->UniformInt(common_trackids.size())];
     
     // Load the frame's annotation.
     prev_success = video.LoadFrame(frame_index, track_object_id, false, false, &image_prev, &bbox_prev);
@@ -151,6 +152,10 @@ int main (int argc, char *argv[]) {
   // Create an ExampleGenerator to generate training examples.
   ExampleGenerator example_generator(lambda_shift, lambda_scale,
                                      min_scale, max_scale);
+  example_generator.Seed(random_seed);
+
+  // the choice of training frames follows random_seed too, on its own stream
+  RngStream rng(random_seed, RNG_STREAM_TRAINER);
 
   // save the loss_history when done, TODO: save loss along training instead end of training
   string save_dir = "loss_history/";
@@ -171,7 +176,7 @@ int main (int argc, char *argv[]) {
   TrackerTrainerMultiDomain tracker_trainer_multi_domain(&example_generator, &regressor_train);
 
   for (int i = 0;i < kNumBatches; i ++) {
-    train_video(train_videos, &tracker_trainer_multi_domain);
+    train_video(train_videos, &tracker_trainer_multi_domain, &rng);
   }
 
   return 0;
@@ -1,6 +1,7 @@
 // Visualize the tracker performance.
 
 #include <string>
+#include <boost/shared_ptr.hpp>
 #include <caffe/caffe.hpp>
 
 #include <opencv/cv.h>
@@ -12,6 +13,7 @@
 #include "tracker/tracker.h"
 #include "tracker/tracker_gmd.h"
 #include "tracker/tracker_manager.h"
+#include "tracker/async_head_trainer.h"
 
 // for fine tuning
 #include "network/regressor_train.h"
@@ -27,7 +29,7 @@ int main (int argc, char *argv[]) {
   if (argc < 9) {
     std::cerr << "Usage: " << argv[0]
               << " deploy.prototxt network.caffemodel solver_file videos_folder LAMBDA_SHIFT LAMBDA_SCALE MIN_SCALE MAX_SCALE"
-              << " [gpu_id] [video_num] [pauseval] [output_folder]" << std::endl;
+              << " [gpu_id] [video_num] [pauseval] [output_folder] [show_result] [prefetch_depth] [async_finetune]" << std::endl;
     return 1;
   }
 
@@ -72,6 +74,18 @@ int main (int argc, char *argv[]) {
     istringstream(argv[13]) >> show_result;
   }
 
+  // 0 to load every frame right before tracking it, to compare the end to end fps with prefetching
+  int prefetch_depth = PREFETCH_DEPTH;
+  if (argc >= 15) {
+    prefetch_depth = atoi(argv[14]);
+  }
+
+  // 1 to run online fine tuning on a shadow network in the background, tracking uses the last finished head
+  bool async_finetune = false;
+  if (argc >= 16) {
+    istringstream(argv[15]) >> async_finetune;
+  }
+
   // Set up the neural network.
   const bool do_train = true;
   RegressorTrain regressor_train(model_file,
@@ -84,7 +98,19 @@ int main (int argc, char *argv[]) {
   ExampleGenerator example_generator(lambda_shift, lambda_scale,
                                     min_scale, max_scale); // TODO: change to from input instead
 
-  TrackerGMD tracker_gmd(show_intermediate_output, &example_generator, &regressor_train);
+  // second copy of the network, only its fc head is trained in the background
+  boost::shared_ptr<RegressorTrain> regressor_shadow;
+  boost::shared_ptr<AsyncHeadTrainer> async_trainer;
+  if (async_finetune) {
+    regressor_shadow.reset(new RegressorTrain(model_file,
+                               trained_file,
+                               gpu_id,
+                               solver_file,
+                               3,
+                               do_train));
+    async_trainer.reset(new AsyncHeadTrainer(regressor_shadow.get(), regressor_shadow.get(), gpu_id));
+  }
+  TrackerGMD tracker_gmd(show_intermediate_output, &example_generator, &regressor_train, async_trainer.get());
 
   // Get videos.
   LoaderVOT loader(videos_folder);
@@ -92,6 +118,7 @@ int main (int argc, char *argv[]) {
 
   // Visualize the tracker performance.
   TrackerFineTune tracker_fine_tune(videos, &regressor_train, &tracker_gmd, true, output_folder, show_result);
+  tracker_fine_tune.SetPrefetch(prefetch_depth);
   tracker_fine_tune.TrackAll(start_video_num, pause_val);
 
   return 0;